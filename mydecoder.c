@@ -5,6 +5,8 @@
 #include "libavutil/dict.h"
 #include <libavutil/pixfmt.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/pixdesc.h>
 #include <libswscale/swscale.h>
 #ifdef RK_PLAT
 #include "rockchip/rk_mpi.h"
@@ -13,35 +15,14 @@
 #include "rockchip/mpp_packet.h"
 #endif
 
-#include "mydecoder.h"
-
-#define mydecoder_err(fmt, ...)  printf("[mydecoder]err: " fmt, ##__VA_ARGS__)
-#define mydecoder_info(fmt, ...) printf("[mydecoder]info: "fmt, ##__VA_ARGS__)
-#if DEBUG_LOG
-#define mydecoder_dbg(fmt, ...)  printf("[mydecoder]dbg: " fmt, ##__VA_ARGS__)
-#else
-#define mydecoder_dbg(fmt, ...)
-#endif
+#include "mydecoder_internal.h"
+#include "mydecoder_convert.h"
 
 #ifdef RK_PLAT
-int use_rkmpp = 0;
-MppCtx mpp_ctx;
-MppApi *mpi;
-#define MAX_BUFFER_FRAMES    16
-u8 *frames[MAX_BUFFER_FRAMES];
-u32 w_idx;
-u32 r_idx;
-u32 width;
-u32 height;
-
 #define msleep(x)    usleep((x)*1000)
 #define MPP_H264_DECODE_TIMEOUT    3
 #endif
 
-AVCodecContext *dec_ctx = NULL;
-struct SwsContext *img_convert_ctx;
-struct SwsContext *img_convert_ctx2;
-
 MyPacket mydecoder_packet_alloc(void)
 {
     MyPacket pkt;
@@ -67,21 +48,57 @@ MyFrame mydecoder_frame_alloc(void)
 MyContext mydecoder_context_alloc(void)
 {
     MyContext ctx;
-    ctx = (MyContext)avformat_alloc_context();
+    ctx = (MyContext)av_mallocz(sizeof(struct MyDecoderContext));
     if (!ctx) {
         mydecoder_err("Error allocating context\n");
+        return NULL;
     }
+    ctx->video_stream_idx = -1;
+    ctx->recv_frame = av_frame_alloc();
+    mydecoder_pool_init(&ctx->frame_pool);
     return ctx;
 }
 
-s32 mydecoder_open_avcodec(AVFormatContext *fmt_ctx, const s8 *filename, 
-    s8 *codec_name, s32 *frame_num)
+s32 mydecoder_set_color(MyContext ctx, MyColorMatrix matrix, MyColorRange range)
 {
-    AVCodec *codec = NULL;
-    s32 i;
+    ctx->color_matrix = matrix;
+    ctx->color_range = range;
+    return 0;
+}
 
-    avformat_open_input(&fmt_ctx, filename, NULL, NULL);
-    avformat_find_stream_info(fmt_ctx, NULL);
+s32 mydecoder_set_resize(MyContext ctx, const MyResizeConfig *config)
+{
+    if (config->width < 0 || config->height < 0 || (!config->width != !config->height)) {
+        mydecoder_err("Invalid output size %dx%d\n", config->width, config->height);
+        return -1;
+    }
+    ctx->resize = *config;
+    return 0;
+}
+
+s32 mydecoder_open_avcodec(MyContext ctx, const s8 *filename, 
+    s8 *codec_name, s32 *frame_num)
+{
+    const AVCodec *codec = NULL;
+    AVDictionary *dict = NULL;
+    AVFormatContext *fmt_ctx;
+    AVCodecContext *dec_ctx;
+    s32 i, ret;
+
+    mydecoder_fast_open_options(ctx, &dict);
+    mydecoder_live_options(ctx, &dict);
+    if (mydecoder_mmap_open(ctx, filename) < 0) {
+        av_dict_free(&dict);
+        return -1;
+    }
+    ret = avformat_open_input(&ctx->fmt_ctx, filename, NULL, &dict);
+    av_dict_free(&dict);
+    if (ret < 0) {
+        mydecoder_err("Could not open %s\n", filename);
+        return -1;
+    }
+    fmt_ctx = ctx->fmt_ctx;
+    mydecoder_probe(ctx, filename);
 
     /* find the video decoder: ie: h264_v4l2m2m */
     codec = avcodec_find_decoder_by_name(codec_name);
@@ -91,6 +108,7 @@ s32 mydecoder_open_avcodec(AVFormatContext *fmt_ctx, const s8 *filename,
     }
     
     dec_ctx = avcodec_alloc_context3(codec);
+    ctx->dec_ctx = dec_ctx;
     if (!dec_ctx) {
         mydecoder_err("Could not allocate video codec context\n");
         exit(1);
@@ -99,7 +117,13 @@ s32 mydecoder_open_avcodec(AVFormatContext *fmt_ctx, const s8 *filename,
     for (i = 0; i < fmt_ctx->nb_streams; i++) {
         if (AVMEDIA_TYPE_VIDEO == fmt_ctx->streams[i]->codecpar->codec_type) {
             *frame_num = fmt_ctx->streams[i]->nb_frames;
+            ctx->video_stream_idx = i;
             avcodec_parameters_to_context(dec_ctx, fmt_ctx->streams[i]->codecpar);
+            dec_ctx->opaque = ctx;
+            dec_ctx->get_buffer2 = mydecoder_get_buffer2;
+            mydecoder_fast_open_codec(ctx, dec_ctx);
+            mydecoder_live_codec(ctx, dec_ctx);
+            mydecoder_quality_codec(ctx, dec_ctx);
             //dec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
             //dec_ctx->coded_height = 1080;
             //dec_ctx->coded_width = 1920;
@@ -109,6 +133,7 @@ s32 mydecoder_open_avcodec(AVFormatContext *fmt_ctx, const s8 *filename,
                 mydecoder_err("Could not open codec\n");
                 exit(1);
             }
+            mydecoder_sample_apply(ctx);
             break;
         }
     }
@@ -116,100 +141,171 @@ s32 mydecoder_open_avcodec(AVFormatContext *fmt_ctx, const s8 *filename,
 }
 
 #ifdef RK_PLAT
-s32 mydecoder_open_rkmpp(AVFormatContext *fmt_ctx, const s8 *filename, s32 *frame_num)
+s32 mydecoder_open_rkmpp(MyContext ctx, const s8 *filename, s32 *frame_num)
 {
-    MPP_RET ret = MPP_OK;
-    MpiCmd mpi_cmd = MPP_CMD_BASE;
-    MppParam param = NULL;
-    RK_U32 need_split = 1;
+    s32 ret;
 	AVDictionary *dict = NULL;
+    AVFormatContext *fmt_ctx;
     s32 i;
 
-    w_idx = 0;
-    r_idx = 0;
-    
 	av_dict_set(&dict, "rtsp_transport", "tcp", 0);
-    avformat_open_input(&fmt_ctx, filename, NULL, &dict);
-    avformat_find_stream_info(fmt_ctx, NULL);
+    mydecoder_fast_open_options(ctx, &dict);
+    mydecoder_live_options(ctx, &dict);
+    if (mydecoder_mmap_open(ctx, filename) < 0) {
+        av_dict_free(&dict);
+        return -1;
+    }
+    ret = avformat_open_input(&ctx->fmt_ctx, filename, NULL, &dict);
+    av_dict_free(&dict);
+    if (ret < 0) {
+        mydecoder_err("Could not open %s\n", filename);
+        return -1;
+    }
+    fmt_ctx = ctx->fmt_ctx;
+    mydecoder_probe(ctx, filename);
     
     for (i = 0; i < fmt_ctx->nb_streams; i++) {
         if (AVMEDIA_TYPE_VIDEO == fmt_ctx->streams[i]->codecpar->codec_type) {
             *frame_num = fmt_ctx->streams[i]->nb_frames;
+            ctx->video_stream_idx = i;
             mydecoder_info("total frame: %d\n", *frame_num);
+            mydecoder_sample_apply(ctx);
             break;
         }
     }
-    
-    ret = mpp_create(&mpp_ctx, &mpi);
+
+    return mydecoder_rkmpp_init(ctx);
+}
+
+/* The MPP decoder and the frame ring, without any input */
+s32 mydecoder_rkmpp_init(MyContext ctx)
+{
+    MPP_RET ret = MPP_OK;
+    MpiCmd mpi_cmd = MPP_CMD_BASE;
+    MppParam param = NULL;
+    RK_U32 need_split = 1;
+    MppApi *mpi;
+    s32 i;
+
+    ctx->w_idx = 0;
+    ctx->r_idx = 0;
+
+    ret = mpp_create(&ctx->mpp_ctx, &ctx->mpi);
     if (MPP_OK != ret) {
         mydecoder_err("mpi->control failed\n");
         exit(1);
     }
+    mpi = ctx->mpi;
 
     mpi_cmd = MPP_DEC_SET_PARSER_SPLIT_MODE;
     param = &need_split;
-    ret = mpi->control(mpp_ctx, mpi_cmd, param);
+    ret = mpi->control(ctx->mpp_ctx, mpi_cmd, param);
     if (MPP_OK != ret) {
         mydecoder_err("mpi->control failed\n");
         exit(1);
     }
 
-    ret = mpp_init(mpp_ctx, MPP_CTX_DEC, MPP_VIDEO_CodingAVC);
+    if (ctx->live.config.enable) {
+        /* frames in decode order, without waiting to fill the reorder buffer */
+        RK_U32 immediate_out = 1;
+
+        mpi->control(ctx->mpp_ctx, MPP_DEC_SET_IMMEDIATE_OUT, &immediate_out);
+    }
+
+    ret = mpp_init(ctx->mpp_ctx, MPP_CTX_DEC, MPP_VIDEO_CodingAVC);
     if (MPP_OK != ret) {
         mydecoder_err("mpp_init failed\n");
         exit(1);
     }
 
+    /* one MppPacket and one ring of frames, reused for the whole stream */
+    ret = mpp_packet_init(&ctx->mpp_pkt, NULL, 0);
+    if (MPP_OK != ret) {
+        mydecoder_err("mpp_packet_init failed\n");
+        exit(1);
+    }
+    for (i = 0; i < MAX_BUFFER_FRAMES; i++) {
+        ctx->frames[i] = av_frame_alloc();
+        if (!ctx->frames[i]) {
+            mydecoder_err("Error allocating frame\n");
+            exit(1);
+        }
+    }
+
     return 0;
 }
 #endif
 
-s32 mydecoder_open(MyContext *ctx, const s8 *file_name, s8 *codec_name, s32 *frame_num)
+s32 mydecoder_open(MyContext ctx, const s8 *file_name, s8 *codec_name, s32 *frame_num)
 {
-    AVCodec codec;
-    AVFormatContext *fmt_ctx = (AVFormatContext *)(*ctx);
+    s32 ret;
 
+    ctx->stats.open_start_ns = mydecoder_now_ns();
 #ifdef RK_PLAT
     if (!strcmp(codec_name, "rkmpp")) {
-        use_rkmpp = 1;
-        mydecoder_open_rkmpp(fmt_ctx, file_name, frame_num);
+        ctx->use_rkmpp = 1;
+        ret = mydecoder_open_rkmpp(ctx, file_name, frame_num);
     } else 
 #endif
-    mydecoder_open_avcodec(fmt_ctx, file_name, codec_name, frame_num);
-
-    return 0;
+    ret = mydecoder_open_avcodec(ctx, file_name, codec_name, frame_num);
+    atomic_store(&ctx->stats.open_ns, mydecoder_now_ns() - ctx->stats.open_start_ns);
+    return ret;
 }
 
 s32 mydecoder_get_packet(MyContext ctx, MyPacket *packet, s32 *packet_size)
 {
     s32 ret = 0;
     AVPacket *avpkt = (AVPacket *)(*packet);
+    s64 start = mydecoder_timer_start(ctx);
 
-    ret = av_read_frame((AVFormatContext *)ctx, avpkt);
+    /* drop the previous payload, the AVPacket itself is reused */
+    av_packet_unref(avpkt);
+    ret = av_read_frame(ctx->fmt_ctx, avpkt);
+    mydecoder_timer_stop(ctx, MYDECODER_TIMER_READ, start);
     *packet_size = avpkt->size;
+    if (ret >= 0) {
+        mydecoder_record_packet(ctx, avpkt);
+        mydecoder_stat_add(ctx, packets, 1);
+        mydecoder_stat_add(ctx, bytes, avpkt->size);
+    }
     
     return ret;
 }
 
-s32 mydecoder_decode_avcodec(AVFrame *frame, AVPacket *pkt, s32 *got_frame)
+s32 mydecoder_decode_avcodec(MyContext ctx, AVFrame *frame, AVPacket *pkt, s32 *got_frame)
 {
+    AVCodecContext *dec_ctx = ctx->dec_ctx;
     int ret;
+    s64 start;
 
     *got_frame = 0;
+    start = mydecoder_timer_start(ctx);
     ret = avcodec_send_packet(dec_ctx, pkt);
+    mydecoder_timer_stop(ctx, MYDECODER_TIMER_SEND, start);
     if (ret < 0) {
         mydecoder_err("Error sending a packet for decoding\n");
+        mydecoder_stat_add(ctx, decode_errors, 1);
         return ret;
     }
 
     while (ret >= 0) {
+        start = mydecoder_timer_start(ctx);
         ret = avcodec_receive_frame(dec_ctx, frame);
+        mydecoder_timer_stop(ctx, MYDECODER_TIMER_RECEIVE, start);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
             return ret;
         else if (ret < 0) {
             mydecoder_err("Error during decoding\n");
+            mydecoder_stat_add(ctx, decode_errors, 1);
             return ret;
+        }
+        mydecoder_stat_add(ctx, frames_decoded, 1);
+        if (!mydecoder_sample_frame(ctx, frame->pts)) {
+            mydecoder_stat_add(ctx, dropped[MYDECODER_DROP_SAMPLED], 1);
+            av_frame_unref(frame);
         } else {
+            mydecoder_stat_first_frame(ctx);
+            mydecoder_live_out(ctx, frame);
             *got_frame = 1;
             break;
         }
@@ -219,70 +315,109 @@ s32 mydecoder_decode_avcodec(AVFrame *frame, AVPacket *pkt, s32 *got_frame)
 }
 
 #ifdef RK_PLAT
-s32 mydecoder_fill_frame_mpp(MppFrame mpp_frame)
+s32 mydecoder_fill_frame_mpp(MyContext ctx, MppFrame mpp_frame)
 {
     u32 h_stride = mpp_frame_get_hor_stride(mpp_frame);
     u32 v_stride = mpp_frame_get_ver_stride(mpp_frame);
+    u32 width = mpp_frame_get_width(mpp_frame);
+    u32 height = mpp_frame_get_height(mpp_frame);
     u8 *src = mpp_buffer_get_ptr(mpp_frame_get_buffer(mpp_frame));
-    u8 *dst, *base_y, *base_uv;
-    s32 i;
+    AVFrame *dst = ctx->frames[ctx->w_idx];
     
-    width = mpp_frame_get_width(mpp_frame);
-    height = mpp_frame_get_height(mpp_frame);
-
-    frames[w_idx] = (u8 *)malloc(width * height * 3 / 2);
-    dst = frames[w_idx];
-    base_y = src;
-    base_uv = src + h_stride * v_stride;
-
-    for (i = 0; i < height; i++, base_y += h_stride, dst += width)
-        memcpy(dst, base_y, width);
-    for (i = 0; i < height / 2; i++, base_uv += h_stride, dst += width)
-        memcpy(dst, base_uv, width);
-
-    mydecoder_dbg("write idx: %d\n", w_idx);
-
-    w_idx++;
-    if (w_idx >= MAX_BUFFER_FRAMES)
-        w_idx = 0;
+    /* keep the decoder's stride so each plane is one memcpy */
+    dst->buf[0] = mydecoder_pool_get(&ctx->frame_pool, width, height, AV_PIX_FMT_NV12,
+                                     h_stride * height * 3 / 2);
+    if (!dst->buf[0])
+        return AVERROR(ENOMEM);
+
+    dst->format = AV_PIX_FMT_NV12;
+    dst->width = width;
+    dst->height = height;
+    dst->pts = mpp_frame_get_pts(mpp_frame);
+    dst->data[0] = dst->buf[0]->data;
+    dst->data[1] = dst->data[0] + h_stride * height;
+    dst->linesize[0] = h_stride;
+    dst->linesize[1] = h_stride;
+    memcpy(dst->data[0], src, h_stride * height);
+    memcpy(dst->data[1], src + h_stride * v_stride, h_stride * height / 2);
+    mydecoder_live_out(ctx, dst);
+
+    mydecoder_dbg("write idx: %d\n", ctx->w_idx);
+
+    ctx->w_idx++;
+    if (ctx->w_idx >= MAX_BUFFER_FRAMES)
+        ctx->w_idx = 0;
     
-    if (r_idx == w_idx) {
-        mydecoder_info("Busy! Discard current frame!\n");
+    if (ctx->r_idx == ctx->w_idx) {
+        mydecoder_dbg("Busy! Discard current frame!\n");
+        mydecoder_stat_add(ctx, dropped[MYDECODER_DROP_OVERRUN], 1);
         // Discard the oldest frame
-        free(frames[r_idx]);
-        r_idx++;
-        if (r_idx >= MAX_BUFFER_FRAMES) 
-            r_idx = 0;
+        av_frame_unref(ctx->frames[ctx->r_idx]);
+        ctx->r_idx++;
+        if (ctx->r_idx >= MAX_BUFFER_FRAMES) 
+            ctx->r_idx = 0;
+    }
+#if MYDECODER_STATS
+    {
+        s32 used = (ctx->w_idx + MAX_BUFFER_FRAMES - ctx->r_idx) % MAX_BUFFER_FRAMES;
+
+        if (used > atomic_load_explicit(&ctx->stats.ring_high_water, memory_order_relaxed))
+            atomic_store_explicit(&ctx->stats.ring_high_water, used, memory_order_relaxed);
     }
+#endif
 
     return 0;
 }
 
-s32 mydecoder_decode_rkmpp(AVPacket *pkt, s32 *got_frame)
+/*
+ * A frame is polled for up to 5 times, MPP_H264_DECODE_TIMEOUT ms apart;
+ * in live mode poll_us apart for about as long, so a finished frame does
+ * not sit out the rest of a 3 ms sleep.
+ */
+static s32 rkmpp_tries(MyContext ctx)
 {
+    if (!ctx->live.config.enable)
+        return 5;
+    return 5 * MPP_H264_DECODE_TIMEOUT * 1000 / ctx->live.config.poll_us + 1;
+}
+
+static void rkmpp_wait(MyContext ctx)
+{
+    if (ctx->live.config.enable)
+        usleep(ctx->live.config.poll_us);
+    else
+        msleep(MPP_H264_DECODE_TIMEOUT);
+}
+
+s32 mydecoder_decode_rkmpp(MyContext ctx, AVPacket *pkt, s32 *got_frame)
+{
+    MppCtx mpp_ctx = ctx->mpp_ctx;
+    MppApi *mpi = ctx->mpi;
     int ret;
     unsigned int pkt_done = 0;
-    MppPacket packet;
+    MppPacket packet = ctx->mpp_pkt;
     MppFrame frame;
-    MppBufferGroup frm_grp;
+    s64 start;
     
     *got_frame = 0;
 
-    ret = mpp_packet_init(&packet, pkt->data, pkt->size);
-    if (MPP_OK != ret) {
-        mydecoder_err("mpp_packet_init failed\n");
-        return ret;
-    }
-
+    mpp_packet_set_data(packet, pkt->data);
+    mpp_packet_set_size(packet, pkt->size);
+    mpp_packet_set_pos(packet, pkt->data);
+    mpp_packet_set_length(packet, pkt->size);
 	mpp_packet_set_pts(packet, pkt->pts);
     if (!(pkt->data))
         mpp_packet_set_eos(packet);
+    else
+        mpp_packet_clr_eos(packet);
 
         do {
-            s32 times = 5;
+            s32 times = rkmpp_tries(ctx);
             // send the packet first if packet is not done
             if (!pkt_done) {
+                start = mydecoder_timer_start(ctx);
                 ret = mpi->decode_put_packet(mpp_ctx, packet);
+                mydecoder_timer_stop(ctx, MYDECODER_TIMER_SEND, start);
                 if (MPP_OK == ret)
                     pkt_done = 1;
             }
@@ -292,11 +427,13 @@ s32 mydecoder_decode_rkmpp(AVPacket *pkt, s32 *got_frame)
                 s32 get_frm = 0;
                 u32 frm_eos = 0;
             try_again:
+                start = mydecoder_timer_start(ctx);
                 ret = mpi->decode_get_frame(mpp_ctx, &frame);
+                mydecoder_timer_stop(ctx, MYDECODER_TIMER_RECEIVE, start);
                 if (MPP_ERR_TIMEOUT == ret) {
                     if (times > 0) {
                         times--;
-                        msleep(MPP_H264_DECODE_TIMEOUT);
+                        rkmpp_wait(ctx);
                         goto try_again;
                     }
                     mydecoder_err("decode_get_frame failed too much time\n");
@@ -304,28 +441,39 @@ s32 mydecoder_decode_rkmpp(AVPacket *pkt, s32 *got_frame)
                 
                 if (MPP_OK != ret) {
                     mydecoder_err("decode_get_frame failed ret %d\n", ret);
+                    mydecoder_stat_add(ctx, decode_errors, 1);
                     break;
                 }
 
                 if (frame) {
                     if (mpp_frame_get_info_change(frame)) {
-                        ret = mpp_buffer_group_get_internal(&frm_grp, MPP_BUFFER_TYPE_DRM);
-                        if (ret) {
-                            mydecoder_err("get mpp buffer group failed ret %d\n", ret);
-                            break;
+                        if (!ctx->frm_grp) {
+                            ret = mpp_buffer_group_get_internal(&ctx->frm_grp, MPP_BUFFER_TYPE_DRM);
+                            if (ret) {
+                                mydecoder_err("get mpp buffer group failed ret %d\n", ret);
+                                break;
+                            }
+                        } else {
+                            mpp_buffer_group_clear(ctx->frm_grp);
                         }
-                        mpi->control(mpp_ctx, MPP_DEC_SET_EXT_BUF_GROUP, frm_grp);
+                        mpi->control(mpp_ctx, MPP_DEC_SET_EXT_BUF_GROUP, ctx->frm_grp);
                         mpi->control(mpp_ctx, MPP_DEC_SET_INFO_CHANGE_READY, NULL);
                     } else {
                         u32 err_info = mpp_frame_get_errinfo(frame) | mpp_frame_get_discard(frame);
                         if (err_info) {
                             mydecoder_err("decoder_get_frame get err info:%d discard:%d.\n",
                                     mpp_frame_get_errinfo(frame), mpp_frame_get_discard(frame));
+                            mydecoder_stat_add(ctx, dropped[MYDECODER_DROP_CORRUPT], 1);
                         }
-                        else {
+                        else if (mydecoder_sample_frame(ctx, mpp_frame_get_pts(frame))) {
                             //TBD
                             *got_frame += 1;
-                            mydecoder_fill_frame_mpp(frame);
+                            mydecoder_stat_add(ctx, frames_decoded, 1);
+                            mydecoder_stat_first_frame(ctx);
+                            mydecoder_fill_frame_mpp(ctx, frame);
+                        } else {
+                            mydecoder_stat_add(ctx, frames_decoded, 1);
+                            mydecoder_stat_add(ctx, dropped[MYDECODER_DROP_SAMPLED], 1);
                         }
                     }
                     frm_eos = mpp_frame_get_eos(frame);
@@ -351,232 +499,845 @@ s32 mydecoder_decode_rkmpp(AVPacket *pkt, s32 *got_frame)
              * mpi->decode_put_packet will failed when packet in internal queue is
              * full,waiting the package is consumed .
              */
-            msleep(MPP_H264_DECODE_TIMEOUT);
+            rkmpp_wait(ctx);
         } while (1);
+
+    return 0;
 }
 #endif
 
-s32 mydecoder_decode(MyPacket packet, MyFrame frame, s32 *got_frame)
+s32 mydecoder_decode(MyContext ctx, MyPacket packet, MyFrame frame, s32 *got_frame)
 {
+    if (!mydecoder_sample_packet(ctx, (AVPacket *)packet)) {
+        mydecoder_stat_add(ctx, dropped[MYDECODER_DROP_SKIPPED], 1);
+        *got_frame = 0;
+        return 0;
+    }
+    mydecoder_live_in(ctx, (AVPacket *)packet);
+
 #ifdef RK_PLAT
-    if (use_rkmpp)
-        mydecoder_decode_rkmpp(packet, got_frame);
+    if (ctx->use_rkmpp)
+        mydecoder_decode_rkmpp(ctx, packet, got_frame);
     else
 #endif
-        mydecoder_decode_avcodec((AVFrame *)frame, packet, got_frame);
+        mydecoder_decode_avcodec(ctx, (AVFrame *)frame, packet, got_frame);
 
     return 0;
 }
 
-s32 mydecoder_retrieve_frame_yuv420p(AVFrame *frame, u8 *bgr_data)
+/*
+ * Decode one packet (NULL flushes) and hand every frame it yields to sink,
+ * which may move the frame out. Unlike mydecoder_decode(), no frame is left
+ * inside the decoder, which is what the pipelined paths need.
+ */
+s32 mydecoder_decode_frames(MyContext ctx, AVPacket *pkt, MyFrameSink sink, void *opaque)
 {
-    AVFrame bgr_frame;
+    AVCodecContext *dec_ctx = ctx->dec_ctx;
+    AVFrame *frame = ctx->recv_frame;
+    s32 sent = 0;
+    s32 ret;
+    s64 start;
+
+    if (!mydecoder_sample_packet(ctx, pkt)) {
+        mydecoder_stat_add(ctx, dropped[MYDECODER_DROP_SKIPPED], 1);
+        return 0;
+    }
+    mydecoder_live_in(ctx, pkt);
 
-    av_image_fill_arrays(bgr_frame.data, bgr_frame.linesize, bgr_data, 
-                         AV_PIX_FMT_BGR24, frame->width, frame->height, 1);
+#ifdef RK_PLAT
+    if (ctx->use_rkmpp) {
+        AVPacket *eos = NULL;
+        s32 got_frame;
+
+        if (!pkt)
+            pkt = eos = av_packet_alloc();
+        mydecoder_decode_rkmpp(ctx, pkt, &got_frame);
+        av_packet_free(&eos);
+
+        while (ctx->r_idx != ctx->w_idx) {
+            ret = sink(opaque, ctx->frames[ctx->r_idx]);
+            av_frame_unref(ctx->frames[ctx->r_idx]);
+            ctx->r_idx++;
+            if (ctx->r_idx >= MAX_BUFFER_FRAMES)
+                ctx->r_idx = 0;
+            if (ret < 0)
+                return ret;
+        }
+        return 0;
+    }
+#endif
+
+    while (!sent) {
+        start = mydecoder_timer_start(ctx);
+        ret = avcodec_send_packet(dec_ctx, pkt);
+        mydecoder_timer_stop(ctx, MYDECODER_TIMER_SEND, start);
+        if (ret != AVERROR(EAGAIN)) {
+            sent = 1;
+            if (ret < 0 && ret != AVERROR_EOF) {
+                mydecoder_err("Error sending a packet for decoding\n");
+                mydecoder_stat_add(ctx, decode_errors, 1);
+                return ret;
+            }
+        }
+
+        /* EAGAIN on send: output must be drained before the packet fits */
+        while (1) {
+            start = mydecoder_timer_start(ctx);
+            ret = avcodec_receive_frame(dec_ctx, frame);
+            mydecoder_timer_stop(ctx, MYDECODER_TIMER_RECEIVE, start);
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+                break;
+            if (ret < 0) {
+                mydecoder_err("Error during decoding\n");
+                mydecoder_stat_add(ctx, decode_errors, 1);
+                return ret;
+            }
+            mydecoder_stat_add(ctx, frames_decoded, 1);
+            if (!mydecoder_sample_frame(ctx, frame->pts)) {
+                mydecoder_stat_add(ctx, dropped[MYDECODER_DROP_SAMPLED], 1);
+                av_frame_unref(frame);
+                continue;
+            }
+            mydecoder_stat_first_frame(ctx);
+            mydecoder_live_out(ctx, frame);
+            ret = sink(opaque, frame);
+            av_frame_unref(frame);
+            if (ret < 0)
+                return ret;
+        }
+    }
+
+    return 0;
+}
+
+void mydecoder_frame_coeffs(MyContext ctx, const AVFrame *frame, MyYuvCoeffs *coeffs)
+{
+    s32 bt709 = ctx->color_matrix == MYDECODER_CSC_BT709;
+    s32 full_range = ctx->color_range == MYDECODER_RANGE_FULL;
+
+    if (frame && MYDECODER_CSC_AUTO == ctx->color_matrix)
+        bt709 = (AVCOL_SPC_BT709 == frame->colorspace);
+    if (frame && MYDECODER_RANGE_AUTO == ctx->color_range)
+        full_range = (AVCOL_RANGE_JPEG == frame->color_range ||
+                      AV_PIX_FMT_YUVJ420P == frame->format);
+
+    mydecoder_yuv_coeffs(coeffs, bt709, full_range);
+}
+
+s32 mydecoder_set_output_format(MyContext ctx, MyOutFormat format)
+{
+    if (format < MYDECODER_OUT_BGR24 || format > MYDECODER_OUT_I420) {
+        mydecoder_err("Invalid output format %d\n", format);
+        return -1;
+    }
+    ctx->out_format = format;
+    return 0;
+}
+
+s32 mydecoder_output_buffer_size(MyOutFormat format, s32 width, s32 height)
+{
+    s32 chroma = ((width + 1) / 2) * ((height + 1) / 2);
+
+    switch (format) {
+    case MYDECODER_OUT_BGRA:
+    case MYDECODER_OUT_RGBA:
+        return width * height * 4;
+    case MYDECODER_OUT_GRAY8:
+        return width * height;
+    case MYDECODER_OUT_NV12:
+    case MYDECODER_OUT_I420:
+        return width * height + 2 * chroma;
+    default:
+        return width * height * 3;
+    }
+}
+
+s32 mydecoder_out_av_format(MyOutFormat format)
+{
+    static const s32 av_formats[] = {
+        AV_PIX_FMT_BGR24, AV_PIX_FMT_RGB24, AV_PIX_FMT_BGRA, AV_PIX_FMT_RGBA, AV_PIX_FMT_GRAY8,
+        AV_PIX_FMT_GBRP, AV_PIX_FMT_GBRP, AV_PIX_FMT_NV12, AV_PIX_FMT_YUV420P,
+    };
+
+    return av_formats[format];
+}
+
+/*
+ * Planes of a tightly packed picture in out, in memory order: planar
+ * formats are three width x height planes in the order of their name,
+ * NV12/I420 chroma follows the luma plane.
+ */
+void mydecoder_out_planes(MyOutFormat format, u8 *out, s32 width, s32 height,
+    u8 *data[4], s32 linesize[4])
+{
+    s32 cw = (width + 1) / 2, ch = (height + 1) / 2;
+
+    memset(data, 0, 4 * sizeof(u8 *));
+    memset(linesize, 0, 4 * sizeof(s32));
+    data[0] = out;
+    switch (format) {
+    case MYDECODER_OUT_BGR24:
+    case MYDECODER_OUT_RGB24:
+        linesize[0] = width * 3;
+        break;
+    case MYDECODER_OUT_BGRA:
+    case MYDECODER_OUT_RGBA:
+        linesize[0] = width * 4;
+        break;
+    case MYDECODER_OUT_GRAY8:
+        linesize[0] = width;
+        break;
+    case MYDECODER_OUT_BGR_PLANAR:
+    case MYDECODER_OUT_RGB_PLANAR:
+        data[1] = out + width * height;
+        data[2] = out + 2 * width * height;
+        linesize[0] = linesize[1] = linesize[2] = width;
+        break;
+    case MYDECODER_OUT_NV12:
+        data[1] = out + width * height;
+        linesize[0] = width;
+        linesize[1] = 2 * cw;
+        break;
+    case MYDECODER_OUT_I420:
+        data[1] = out + width * height;
+        data[2] = data[1] + cw * ch;
+        linesize[0] = width;
+        linesize[1] = linesize[2] = cw;
+        break;
+    }
+}
+
+static MyRgbLayout out_rgb_layout(MyOutFormat format)
+{
+    switch (format) {
+    case MYDECODER_OUT_RGB24:
+        return MYDECODER_RGB_RGB24;
+    case MYDECODER_OUT_BGRA:
+        return MYDECODER_RGB_BGRA;
+    case MYDECODER_OUT_RGBA:
+        return MYDECODER_RGB_RGBA;
+    case MYDECODER_OUT_BGR_PLANAR:
+    case MYDECODER_OUT_RGB_PLANAR:
+        return MYDECODER_RGB_PLANAR;
+    default:
+        return MYDECODER_RGB_BGR24;
+    }
+}
+
+/* B, G, R plane order the row kernels take for planar output */
+static void out_rgb_planes(MyOutFormat format, u8 *const data[4], u8 *planes[3])
+{
+    planes[0] = data[0];
+    planes[1] = data[1];
+    planes[2] = data[2];
+    if (MYDECODER_OUT_RGB_PLANAR == format) {
+        planes[0] = data[2];
+        planes[2] = data[0];
+    }
+}
 
-    if (img_convert_ctx == NULL || frame->data == NULL) {
-        img_convert_ctx = sws_getCachedContext(
-                img_convert_ctx,
-                frame->width, frame->height,
-                AV_PIX_FMT_YUV420P,
-                frame->width, frame->height,
-                AV_PIX_FMT_BGR24,
-                SWS_BICUBIC,
-                NULL, NULL, NULL);
+static void copy_plane(u8 *dst, s32 dst_stride, const u8 *src, s32 src_stride, s32 bytes,
+    s32 rows)
+{
+    s32 i;
+
+    for (i = 0; i < rows; i++)
+        memcpy(dst + i * dst_stride, src + i * src_stride, bytes);
+}
+
+/*
+ * One conversion of 4:2:0 input (NV12 when nv12, I420 otherwise) to the
+ * output format, cut into bands that start on even rows so each band
+ * owns its chroma rows: one pass for RGB, plane copies for the rest.
+ */
+typedef struct {
+    MyOutFormat format;
+    AVFrame *frame;
+    s32 nv12;
+    u8 *data[4];
+    s32 linesize[4];
+    MyYuvCoeffs coeffs;
+} MyYuvJob;
+
+static u8 *plane_row(u8 *plane, s32 linesize, s32 y)
+{
+    return plane ? plane + y * linesize : NULL;
+}
+
+static void yuv_band(void *arg, s32 band, s32 nb)
+{
+    MyYuvJob *job = (MyYuvJob *)arg;
+    AVFrame *frame = job->frame;
+    MyOutFormat format = job->format;
+    u8 *const *data = job->data;
+    const s32 *linesize = job->linesize;
+    s32 width = frame->width, cw = (width + 1) / 2;
+    s32 y0 = mydecoder_slice_row(frame->height, band, nb, 2);
+    s32 y1 = mydecoder_slice_row(frame->height, band + 1, nb, 2);
+    s32 c0 = y0 / 2, rows = y1 - y0, crows = (y1 + 1) / 2 - c0;
+    const u8 *src_y = frame->data[0] + y0 * frame->linesize[0];
+    const u8 *src_u = frame->data[1] + c0 * frame->linesize[1];
+    const u8 *src_v = job->nv12 ? NULL : frame->data[2] + c0 * frame->linesize[2];
+    u8 *planes[3], *dst[3];
+    s32 i;
+
+    switch (format) {
+    case MYDECODER_OUT_GRAY8:
+        copy_plane(data[0] + y0 * linesize[0], linesize[0], src_y, frame->linesize[0], width,
+                   rows);
+        return;
+    case MYDECODER_OUT_NV12:
+    case MYDECODER_OUT_I420:
+        copy_plane(data[0] + y0 * linesize[0], linesize[0], src_y, frame->linesize[0], width,
+                   rows);
+        dst[1] = data[1] + c0 * linesize[1];
+        dst[2] = plane_row(data[2], linesize[2], c0);
+        if (job->nv12 && MYDECODER_OUT_NV12 == format) {
+            copy_plane(dst[1], linesize[1], src_u, frame->linesize[1], 2 * cw, crows);
+        } else if (!job->nv12 && MYDECODER_OUT_I420 == format) {
+            copy_plane(dst[1], linesize[1], src_u, frame->linesize[1], cw, crows);
+            copy_plane(dst[2], linesize[2], src_v, frame->linesize[2], cw, crows);
+        } else {
+            for (i = 0; i < crows; i++) {
+                if (job->nv12)
+                    mydecoder_uv_deinterleave(src_u + i * frame->linesize[1],
+                                              dst[1] + i * linesize[1],
+                                              dst[2] + i * linesize[2], cw);
+                else
+                    mydecoder_uv_interleave(src_u + i * frame->linesize[1],
+                                            src_v + i * frame->linesize[2],
+                                            dst[1] + i * linesize[1], cw);
+            }
+        }
+        return;
+    default:
+        break;
+    }
+
+    out_rgb_planes(format, data, planes);
+    for (i = 0; i < 3; i++)
+        dst[i] = plane_row(planes[i], linesize[i], y0);
+    if (job->nv12)
+        mydecoder_nv12_to_rgb(src_y, frame->linesize[0], src_u, frame->linesize[1],
+                              dst, linesize, out_rgb_layout(format), width, rows, &job->coeffs);
+    else
+        mydecoder_i420_to_rgb(src_y, frame->linesize[0], src_u, frame->linesize[1],
+                              src_v, frame->linesize[2], dst, linesize,
+                              out_rgb_layout(format), width, rows, &job->coeffs);
+}
+
+static s32 retrieve_frame_yuv(MyContext ctx, AVFrame *frame, s32 nv12, u8 *data[4],
+    s32 linesize[4])
+{
+    MyYuvJob job;
+    s32 i;
+
+    job.format = ctx->out_format;
+    job.frame = frame;
+    job.nv12 = nv12;
+    for (i = 0; i < 4; i++) {
+        job.data[i] = data[i];
+        job.linesize[i] = linesize[i];
+    }
+    mydecoder_frame_coeffs(ctx, frame, &job.coeffs);
+    mydecoder_slice_run(yuv_band, &job, mydecoder_slice_count(ctx, frame->height));
+    return 0;
+}
+
+/*
+ * swscale straight into the output planes, without resizing. In bands, each
+ * band has a context of its own, and band edges are aligned to the chroma
+ * subsampling of both formats so that plane offsets are whole rows.
+ */
+typedef struct {
+    MyContext ctx;
+    AVFrame *frame;
+    s32 av_format;
+    u8 *const *data;
+    const s32 *linesize;
+    s32 align;
+} MySwsJob;
+
+/* Row y of plane p of a picture in format desc, chroma planes subsampled */
+static const u8 *sws_plane_row(const AVPixFmtDescriptor *desc, const u8 *plane, s32 linesize,
+    s32 p, s32 y)
+{
+    s32 shift = (1 == p || 2 == p) && !(desc->flags & AV_PIX_FMT_FLAG_RGB) ?
+                desc->log2_chroma_h : 0;
+
+    return plane ? plane + (y >> shift) * linesize : NULL;
+}
+
+static void sws_band(void *arg, s32 band, s32 nb)
+{
+    MySwsJob *job = (MySwsJob *)arg;
+    AVFrame *frame = job->frame;
+    const AVPixFmtDescriptor *src_desc = av_pix_fmt_desc_get(frame->format);
+    const AVPixFmtDescriptor *dst_desc = av_pix_fmt_desc_get(job->av_format);
+    struct SwsContext **sws = &job->ctx->slice_sws[band];
+    s32 y0 = mydecoder_slice_row(frame->height, band, nb, job->align);
+    s32 y1 = mydecoder_slice_row(frame->height, band + 1, nb, job->align);
+    const u8 *src[4];
+    u8 *dst[4];
+    s32 p;
+
+    for (p = 0; p < 4; p++) {
+        src[p] = sws_plane_row(src_desc, frame->data[p], frame->linesize[p], p, y0);
+        dst[p] = (u8 *)sws_plane_row(dst_desc, job->data[p], job->linesize[p], p, y0);
+    }
+    *sws = sws_getCachedContext(*sws, frame->width, y1 - y0, frame->format,
+                                frame->width, y1 - y0, job->av_format, SWS_POINT,
+                                NULL, NULL, NULL);
+    if (*sws)
+        sws_scale(*sws, (const uint8_t * const*)src, frame->linesize, 0, y1 - y0,
+                  dst, job->linesize);
+}
+
+static s32 retrieve_frame_sws(MyContext ctx, AVFrame *frame, s32 av_format, u8 *const data[4],
+    const s32 linesize[4])
+{
+    const AVPixFmtDescriptor *src_desc = av_pix_fmt_desc_get(frame->format);
+    const AVPixFmtDescriptor *dst_desc = av_pix_fmt_desc_get(av_format);
+    s32 nb = mydecoder_slice_count(ctx, frame->height);
+    MySwsJob job;
+
+    /* a palette is no plane to offset */
+    if (nb > 1 && src_desc && dst_desc && !(src_desc->flags & AV_PIX_FMT_FLAG_PAL)) {
+        job.ctx = ctx;
+        job.frame = frame;
+        job.av_format = av_format;
+        job.data = data;
+        job.linesize = linesize;
+        job.align = 1 << FFMAX(src_desc->log2_chroma_h, dst_desc->log2_chroma_h);
+        mydecoder_slice_run(sws_band, &job, nb);
+        return 0;
     }
 
-    if (img_convert_ctx) {
+    ctx->img_convert_ctx = sws_getCachedContext(
+            ctx->img_convert_ctx,
+            frame->width, frame->height,
+            frame->format,
+            frame->width, frame->height,
+            av_format,
+            SWS_POINT,
+            NULL, NULL, NULL);
+
+    if (ctx->img_convert_ctx) {
         sws_scale(
-                img_convert_ctx,
+                ctx->img_convert_ctx,
                 (const uint8_t * const*)frame->data,
                 frame->linesize,
                 0, frame->height,
-                bgr_frame.data,
-                bgr_frame.linesize);
+                data,
+                linesize);
     }
     
     return 0;
 }
 
-s32 mydecoder_retrieve_frame_nv12(AVFrame *frame, u8 *bgr_data)
+/* Any other software format goes through swscale, without resizing */
+s32 mydecoder_retrieve_frame_sws(MyContext ctx, AVFrame *frame, u8 *bgr_data)
 {
-    AVFrame yuv_frame, bgr_frame;
-    u8 *yuv_data = (u8 *)malloc(frame->width * frame->height * 3 / 2);
-    
-    av_image_fill_arrays(yuv_frame.data, yuv_frame.linesize, yuv_data,
-                         AV_PIX_FMT_YUV420P, frame->width, frame->height, 1);
+    AVFrame bgr_frame;
+
     av_image_fill_arrays(bgr_frame.data, bgr_frame.linesize, bgr_data, 
                          AV_PIX_FMT_BGR24, frame->width, frame->height, 1);
+    return retrieve_frame_sws(ctx, frame, AV_PIX_FMT_BGR24, bgr_frame.data, bgr_frame.linesize);
+}
+
+/* Map the dma-buf (NV12 from rkmpp and v4l2m2m) and convert from the mapping */
+s32 mydecoder_retrieve_frame_drmprime(MyContext ctx, AVFrame *frame, u8 *out)
+{
+    s32 ret;
 
-    /* NV12 to YUV420P */
-    if (img_convert_ctx == NULL || frame->data == NULL) {
-        img_convert_ctx = sws_getCachedContext(
-                img_convert_ctx,
-                frame->width, frame->height,
-                AV_PIX_FMT_NV12,
-                frame->width, frame->height,
-                AV_PIX_FMT_YUV420P,
-                SWS_BICUBIC,
-                NULL, NULL, NULL);
+    if (!ctx->map_frame) {
+        ctx->map_frame = av_frame_alloc();
+        if (!ctx->map_frame)
+            return AVERROR(ENOMEM);
     }
+    ret = av_hwframe_map(ctx->map_frame, frame, AV_HWFRAME_MAP_READ);
+    if (ret < 0 || AV_PIX_FMT_DRM_PRIME == ctx->map_frame->format) {
+        mydecoder_err("Could not map DRM_PRIME frame\n");
+        av_frame_unref(ctx->map_frame);
+        return ret < 0 ? ret : AVERROR(ENOSYS);
+    }
+    ret = mydecoder_retrieve_avframe(ctx, ctx->map_frame, out);
+    av_frame_unref(ctx->map_frame);
+    return ret;
+}
 
-    if (img_convert_ctx) {
-        sws_scale(
-                img_convert_ctx,
-                (const uint8_t * const*)frame->data,
-                frame->linesize,
-                0, frame->height,
-                yuv_frame.data,
-                yuv_frame.linesize);
+void mydecoder_output_size(MyContext ctx, const AVFrame *frame, s32 *width, s32 *height)
+{
+    /* the passthrough formats are never scaled */
+    if (MYDECODER_OUT_NV12 == ctx->out_format || MYDECODER_OUT_I420 == ctx->out_format) {
+        *width = frame->width;
+        *height = frame->height;
+        return;
     }
+    *width = ctx->resize.width > 0 ? ctx->resize.width : frame->width >> ctx->quality_shift;
+    *height = ctx->resize.height > 0 ? ctx->resize.height : frame->height >> ctx->quality_shift;
+}
+
+/* BGR24 row to the other scaled formats; gray is BT.601 luma in the stream's range */
+void mydecoder_repack_row(MyOutFormat format, const u8 *bgr, u8 *const data[4],
+    const s32 linesize[4], s32 y, s32 width, s32 limited)
+{
+    u8 *dst = data[0] + y * linesize[0];
+    u8 *planes[3];
+    s32 x;
+
+    switch (format) {
+    case MYDECODER_OUT_RGB24:
+        for (x = 0; x < width; x++) {
+            dst[3 * x] = bgr[3 * x + 2];
+            dst[3 * x + 1] = bgr[3 * x + 1];
+            dst[3 * x + 2] = bgr[3 * x];
+        }
+        break;
+    case MYDECODER_OUT_BGRA:
+    case MYDECODER_OUT_RGBA:
+        for (x = 0; x < width; x++) {
+            dst[4 * x] = bgr[3 * x + (MYDECODER_OUT_RGBA == format ? 2 : 0)];
+            dst[4 * x + 1] = bgr[3 * x + 1];
+            dst[4 * x + 2] = bgr[3 * x + (MYDECODER_OUT_RGBA == format ? 0 : 2)];
+            dst[4 * x + 3] = 255;
+        }
+        break;
+    case MYDECODER_OUT_GRAY8:
+        for (x = 0; x < width; x++) {
+            const u8 *p = bgr + 3 * x;
 
-    /* YUV420P to BGR */
-    if (img_convert_ctx2 == NULL || yuv_frame.data == NULL) {
-        img_convert_ctx2 = sws_getCachedContext(
-                img_convert_ctx2,
-                frame->width, frame->height,
-                AV_PIX_FMT_YUV420P,
-                frame->width, frame->height,
-                AV_PIX_FMT_BGR24,
-                SWS_BICUBIC,
-                NULL, NULL, NULL);
+            dst[x] = limited ? 16 + ((25 * p[0] + 129 * p[1] + 66 * p[2] + 128) >> 8) :
+                               (29 * p[0] + 150 * p[1] + 77 * p[2] + 128) >> 8;
+        }
+        break;
+    default:
+        out_rgb_planes(format, data, planes);
+        for (x = 0; x < width; x++) {
+            planes[0][y * linesize[0] + x] = bgr[3 * x];
+            planes[1][y * linesize[1] + x] = bgr[3 * x + 1];
+            planes[2][y * linesize[2] + x] = bgr[3 * x + 2];
+        }
+        break;
     }
+}
 
-    if (img_convert_ctx2) {
-        sws_scale(
-                img_convert_ctx2,
-                (const uint8_t * const*)yuv_frame.data,
-                yuv_frame.linesize,
-                0, frame->height,
-                bgr_frame.data,
-                bgr_frame.linesize);
+/* Resize fused with the conversion, row by row straight into the output */
+s32 mydecoder_retrieve_frame_scaled(MyContext ctx, AVFrame *frame, s32 width, s32 height,
+    u8 *const out[4], const s32 out_linesize[4])
+{
+    struct MyScaler *scaler;
+    MyYuvCoeffs coeffs;
+    u8 *data[4], *row = out[0];
+    s32 linesize[4];
+    s32 format, y, ret;
+    s32 bgr24 = MYDECODER_OUT_BGR24 == ctx->out_format;
+
+    ret = mydecoder_scaler_source(ctx, frame, data, linesize, &format);
+    if (ret < 0)
+        return ret;
+    scaler = mydecoder_scaler_get(ctx, frame->width, frame->height, format, width, height);
+    if (!scaler)
+        return AVERROR(ENOMEM);
+    /* the scaler emits BGR24 rows; other formats are repacked from one line */
+    if (!bgr24) {
+        av_fast_malloc(&ctx->line_buf, &ctx->line_buf_size, width * 3);
+        if (!ctx->line_buf)
+            return AVERROR(ENOMEM);
+        row = ctx->line_buf;
+    }
+
+    mydecoder_frame_coeffs(ctx, frame, &coeffs);
+    for (y = 0; y < height; y++) {
+        if (bgr24) {
+            mydecoder_scaler_row(scaler, data, linesize, &coeffs, y, row + y * out_linesize[0]);
+            continue;
+        }
+        mydecoder_scaler_row(scaler, data, linesize, &coeffs, y, row);
+        mydecoder_repack_row(ctx->out_format, row, out, out_linesize, y, width,
+                             coeffs.y_offset != 0);
     }
-    
-    free(yuv_data);
     return 0;
 }
 
-#ifdef RK_PLAT
-s32 mydecoder_retrieve_frame_nv12_mpp(u8 *bgr_data)
+static s32 retrieve_avframe(MyContext ctx, AVFrame *avfrm, u8 *out)
 {
-    AVFrame frame, yuv_frame, bgr_frame;
-    u8 *yuv_data;
+    u8 *data[4];
+    s32 linesize[4];
+    s32 width, height;
+
+    mydecoder_output_size(ctx, avfrm, &width, &height);
+    mydecoder_out_planes(ctx->out_format, out, width, height, data, linesize);
+    if (width != avfrm->width || height != avfrm->height)
+        return mydecoder_retrieve_frame_scaled(ctx, avfrm, width, height, data, linesize);
+
+    if (AV_PIX_FMT_YUV420P == avfrm->format || AV_PIX_FMT_YUVJ420P == avfrm->format)
+        return retrieve_frame_yuv(ctx, avfrm, 0, data, linesize);
+    if (AV_PIX_FMT_NV12 == avfrm->format)
+        return retrieve_frame_yuv(ctx, avfrm, 1, data, linesize);
+
+    /* swscale's planar RGB is G, B, R */
+    if (MYDECODER_OUT_BGR_PLANAR == ctx->out_format || MYDECODER_OUT_RGB_PLANAR == ctx->out_format) {
+        u8 *planes[3], *gbr[4] = { NULL };
+        s32 gbr_linesize[4] = { width, width, width, 0 };
+
+        out_rgb_planes(ctx->out_format, data, planes);
+        gbr[0] = planes[1];
+        gbr[1] = planes[0];
+        gbr[2] = planes[2];
+        return retrieve_frame_sws(ctx, avfrm, AV_PIX_FMT_GBRP, gbr, gbr_linesize);
+    }
+    return retrieve_frame_sws(ctx, avfrm, mydecoder_out_av_format(ctx->out_format),
+                              data, linesize);
+}
 
-    frame.width = width;
-    frame.height = height;
-    
-    yuv_data = (u8 *)malloc(width * height * 3 / 2);
+s32 mydecoder_retrieve_avframe(MyContext ctx, AVFrame *avfrm, u8 *out)
+{
+    s64 start;
+    s32 ret;
+
+    /* timed once, on the mapped frame */
+    if (AV_PIX_FMT_DRM_PRIME == avfrm->format)
+        return mydecoder_retrieve_frame_drmprime(ctx, avfrm, out);
+
+    start = mydecoder_timer_start(ctx);
+    ret = retrieve_avframe(ctx, avfrm, out);
+    mydecoder_timer_stop(ctx, MYDECODER_TIMER_CONVERT, start);
+    if (ret >= 0)
+        mydecoder_stat_add(ctx, frames_converted, 1);
+    return ret;
+}
 
-    mydecoder_dbg("read idx: %d\n", r_idx);
+#ifdef RK_PLAT
+/* Oldest decoded frame of the rkmpp ring, NULL when it is empty */
+AVFrame *mydecoder_ring_peek(MyContext ctx)
+{
+    if (ctx->r_idx == ctx->w_idx)
+        return NULL;
+    mydecoder_dbg("read idx: %d\n", ctx->r_idx);
+    return ctx->frames[ctx->r_idx];
+}
 
-    av_image_fill_arrays(frame.data, frame.linesize, frames[r_idx], 
-                         AV_PIX_FMT_NV12, frame.width, frame.height, 1);
-    av_image_fill_arrays(yuv_frame.data, yuv_frame.linesize, yuv_data,
-                         AV_PIX_FMT_YUV420P, frame.width, frame.height, 1);
-    av_image_fill_arrays(bgr_frame.data, bgr_frame.linesize, bgr_data, 
-                         AV_PIX_FMT_BGR24, frame.width, frame.height, 1);
+/* Give the oldest frame's NV12 buffer back to the pool and move on */
+void mydecoder_ring_pop(MyContext ctx)
+{
+    av_frame_unref(ctx->frames[ctx->r_idx]);
+    ctx->r_idx++;
+    if (ctx->r_idx >= MAX_BUFFER_FRAMES)
+        ctx->r_idx = 0;
+}
+#endif
 
-    /* NV12 to YUV420P */
-    if (img_convert_ctx == NULL || frame.data == NULL) {
-        img_convert_ctx = sws_getCachedContext(
-                img_convert_ctx,
-                frame.width, frame.height,
-                AV_PIX_FMT_NV12,
-                frame.width, frame.height,
-                AV_PIX_FMT_YUV420P,
-                SWS_BICUBIC,
-                NULL, NULL, NULL);
-    }
+s32 mydecoder_retrieve_frame(MyContext ctx, MyFrame frame, u8 *out)
+{
+#ifdef RK_PLAT
+    if (ctx->use_rkmpp) {
+        AVFrame *avfrm = mydecoder_ring_peek(ctx);
+        s32 ret;
+
+        if (!avfrm)
+            return -1;
+        ret = mydecoder_motion_gate(ctx, avfrm) ? MYDECODER_UNCHANGED :
+              mydecoder_retrieve_avframe(ctx, avfrm, out);
+        mydecoder_ring_pop(ctx);
+        return ret;
+    } else 
+#endif
+    if (mydecoder_motion_gate(ctx, (AVFrame *)frame))
+        return MYDECODER_UNCHANGED;
+    return mydecoder_retrieve_avframe(ctx, (AVFrame *)frame, out);
+}
 
-    if (img_convert_ctx) {
-        sws_scale(
-                img_convert_ctx,
-                (const uint8_t * const*)frame.data,
-                frame.linesize,
-                0, frame.height,
-                yuv_frame.data,
-                yuv_frame.linesize);
-    }
-
-    /* YUV420P to BGR */
-    if (img_convert_ctx2 == NULL || yuv_frame.data == NULL) {
-        img_convert_ctx2 = sws_getCachedContext(
-                img_convert_ctx2,
-                frame.width, frame.height,
-                AV_PIX_FMT_YUV420P,
-                frame.width, frame.height,
-                AV_PIX_FMT_BGR24,
-                SWS_BICUBIC,
-                NULL, NULL, NULL);
-    }
-
-    if (img_convert_ctx2) {
-        sws_scale(
-                img_convert_ctx2,
-                (const uint8_t * const*)yuv_frame.data,
-                yuv_frame.linesize,
-                0, frame.height,
-                bgr_frame.data,
-                bgr_frame.linesize);
-    }
-
-    free(yuv_data);
-    free(frames[r_idx]);
-    r_idx++;
-    if (r_idx >= MAX_BUFFER_FRAMES)
-        r_idx = 0;
-    
+s32 mydecoder_get_output_size(MyContext ctx, MyFrame frame, s32 *width, s32 *height)
+{
+    AVFrame *avfrm = (AVFrame *)frame;
+
+#ifdef RK_PLAT
+    if (ctx->use_rkmpp)
+        avfrm = mydecoder_ring_peek(ctx);
+#endif
+    if (!avfrm || avfrm->width <= 0 || avfrm->height <= 0)
+        return -1;
+    mydecoder_output_size(ctx, avfrm, width, height);
     return 0;
 }
-#endif
 
-s32 mydecoder_retrieve_frame_drmprime(AVFrame *frame, u8 *bgr_data)
+MyPixFmt mydecoder_pix_fmt(s32 av_format)
 {
-    //TBD
-    return 0;
+    switch (av_format) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+        return MYDECODER_PIX_FMT_I420;
+    case AV_PIX_FMT_NV12:
+        return MYDECODER_PIX_FMT_NV12;
+    case AV_PIX_FMT_BGR24:
+        return MYDECODER_PIX_FMT_BGR24;
+    case AV_PIX_FMT_RGB24:
+        return MYDECODER_PIX_FMT_RGB24;
+    case AV_PIX_FMT_BGRA:
+        return MYDECODER_PIX_FMT_BGRA;
+    case AV_PIX_FMT_RGBA:
+        return MYDECODER_PIX_FMT_RGBA;
+    case AV_PIX_FMT_GRAY8:
+        return MYDECODER_PIX_FMT_GRAY8;
+    case AV_PIX_FMT_GBRP:
+        return MYDECODER_PIX_FMT_BGR_PLANAR;
+    default:
+        return MYDECODER_PIX_FMT_NONE;
+    }
 }
 
-s32 mydecoder_retrieve_frame(MyFrame frame, u8 *bgr_data)
+const u8 mydecoder_rgb_planar_tag;
+
+void mydecoder_fill_view(MyFrameView *view, AVFrame *ref)
 {
+    s32 i;
+
+    for (i = 0; i < 4; i++) {
+        view->data[i] = ref->data[i];
+        view->linesize[i] = ref->linesize[i];
+    }
+    view->width = ref->width;
+    view->height = ref->height;
+    view->av_format = ref->format;
+    view->format = mydecoder_pix_fmt(ref->format);
+    if (AV_PIX_FMT_GBRP == ref->format) {
+        /* G, B, R in the frame; native GBRP is reported as BGR_PLANAR */
+        if (ref->opaque == &mydecoder_rgb_planar_tag) {
+            view->format = MYDECODER_PIX_FMT_RGB_PLANAR;
+            view->data[0] = ref->data[2];
+            view->data[2] = ref->data[1];
+        } else {
+            view->data[0] = ref->data[1];
+            view->data[2] = ref->data[2];
+        }
+        view->data[1] = ref->data[0];
+    }
+    view->pts = ref->pts;
+    view->priv = ref;
+}
+
+s32 mydecoder_frame_view_get(MyContext ctx, MyFrame frame, MyFrameView *view)
+{
+    AVFrame *avfrm = (AVFrame *)frame;
+    AVFrame *ref;
+    s32 ret = 0;
+
+    memset(view, 0, sizeof(*view));
+    ref = av_frame_alloc();
+    if (!ref) {
+        mydecoder_err("Error allocating frame\n");
+        return AVERROR(ENOMEM);
+    }
+
 #ifdef RK_PLAT
-    if (use_rkmpp) {
-        return mydecoder_retrieve_frame_nv12_mpp(bgr_data);
-    } else 
+    if (ctx->use_rkmpp) {
+        if (!mydecoder_ring_peek(ctx)) {
+            av_frame_free(&ref);
+            return -1;
+        }
+        /* the view takes over the ring slot's pooled buffer */
+        av_frame_move_ref(ref, mydecoder_ring_peek(ctx));
+        mydecoder_ring_pop(ctx);
+    } else
 #endif
-    {
-        if (AV_PIX_FMT_YUV420P == dec_ctx->pix_fmt)
-            return mydecoder_retrieve_frame_yuv420p((AVFrame *)frame, bgr_data);
-        if (AV_PIX_FMT_NV12 == dec_ctx->pix_fmt)
-            return mydecoder_retrieve_frame_nv12((AVFrame *)frame, bgr_data);
-        if (AV_PIX_FMT_DRM_PRIME == dec_ctx->pix_fmt)
-            return mydecoder_retrieve_frame_drmprime((AVFrame *)frame, bgr_data);
+    if (AV_PIX_FMT_DRM_PRIME == avfrm->format) {
+        /* mmap the dma-buf, the mapping keeps the hardware frame alive */
+        ret = av_hwframe_map(ref, avfrm, AV_HWFRAME_MAP_READ);
+        if (ret >= 0)
+            ref->pts = avfrm->pts;
+    } else {
+        ret = av_frame_ref(ref, avfrm);
     }
+
+    if (ret < 0) {
+        mydecoder_err("Error referencing frame\n");
+        av_frame_free(&ref);
+        return ret;
+    }
+
+    mydecoder_fill_view(view, ref);
+    return 0;
+}
+
+void mydecoder_frame_view_release(MyFrameView *view)
+{
+    AVFrame *ref = (AVFrame *)view->priv;
+
+    av_frame_free(&ref);
+    memset(view, 0, sizeof(*view));
+}
+
+s32 mydecoder_get_pool_stats(MyContext ctx, MyPoolStats *stats)
+{
+    MyBufferPool *pool = &ctx->frame_pool;
+
+    pthread_mutex_lock(&pool->lock);
+    stats->width = pool->width;
+    stats->height = pool->height;
+    stats->buffer_size = pool->size;
+    stats->buffers = pool->allocated;
+    stats->high_water = pool->high_water;
+    stats->resizes = pool->resizes;
+    pthread_mutex_unlock(&pool->lock);
+
     return 0;
 }
 
-s32 mydecoder_close(MyFrame frame, MyPacket packet)
+s32 mydecoder_close(MyContext ctx, MyFrame frame, MyPacket packet)
 {
+    s32 i;
+
+    if (ctx->async)
+        mydecoder_async_stop(ctx);
+    if (ctx->record)
+        mydecoder_record_stop(ctx, NULL);
+
 #ifdef RK_PLAT
-    if (use_rkmpp) {
-        mpi->reset(mpp_ctx);
-        mpp_destroy(mpp_ctx);
-        mpp_ctx = NULL;
+    if (ctx->use_rkmpp) {
+        ctx->mpi->reset(ctx->mpp_ctx);
+        mpp_destroy(ctx->mpp_ctx);
+        ctx->mpp_ctx = NULL;
+        mpp_packet_deinit(&ctx->mpp_pkt);
+        if (ctx->frm_grp)
+            mpp_buffer_group_put(ctx->frm_grp);
+        for (i = 0; i < MAX_BUFFER_FRAMES; i++)
+            av_frame_free(&ctx->frames[i]);
     } else 
 #endif
     {
-        AVFrame *avfrm = (AVFrame *)frame;
-        avcodec_free_context(&dec_ctx);
-        av_frame_free(&avfrm);
-        avfrm = NULL;
-        frame = NULL;
+        avcodec_free_context(&ctx->dec_ctx);
     }
+    /* after the decoder, which may still hold borrowed push buffers */
+    if (ctx->push)
+        mydecoder_push_free(ctx);
+    if (ctx->seek)
+        mydecoder_seek_free(ctx);
+    if (ctx->motion)
+        mydecoder_motion_free(ctx);
+    mydecoder_fast_open_free(ctx);
+    AVFrame *avfrm = (AVFrame *)frame;
+    av_frame_free(&avfrm);
     AVPacket *avpkt = (AVPacket *)packet;
     av_packet_free(&avpkt);
-    sws_freeContext(img_convert_ctx);
-    img_convert_ctx = NULL;
-    sws_freeContext(img_convert_ctx2);
-    img_convert_ctx2 = NULL;
+    av_frame_free(&ctx->recv_frame);
+    av_frame_free(&ctx->map_frame);
+    sws_freeContext(ctx->img_convert_ctx);
+    for (i = 0; i < MYDECODER_CONVERT_THREADS_MAX; i++)
+        sws_freeContext(ctx->slice_sws[i]);
+    ctx->img_convert_ctx = NULL;
+    avformat_close_input(&ctx->fmt_ctx);
+    if (ctx->mmap)
+        mydecoder_mmap_free(ctx);
+    mydecoder_pool_uninit(&ctx->frame_pool);
+    mydecoder_scaler_free(&ctx->scaler);
+    for (i = 0; i < MYDECODER_ROI_MAX; i++)
+        mydecoder_scaler_free(&ctx->roi_scalers[i]);
+    for (i = 0; i < MYDECODER_OUTPUTS_MAX; i++)
+        mydecoder_scaler_free(&ctx->out_scalers[i]);
+    av_freep(&ctx->line_buf);
+    av_freep(&ctx->frame_buf);
+    av_free(ctx);
 
     return 0;
 }
@@ -6,23 +6,645 @@ extern "C" {
 #endif
 
 #define DEBUG_LOG 0
+/* 0 compiles the counters and stage timers out */
+#ifndef MYDECODER_STATS
+#define MYDECODER_STATS 1
+#endif
 
 typedef unsigned char    u8;
+typedef unsigned short   u16;
 typedef unsigned int     u32;
 typedef char             s8;
+typedef short            s16;
 typedef int              s32;
+typedef long long        s64;
 typedef void *           MyPacket;
 typedef void *           MyFrame;
-typedef void *           MyContext;
+
+typedef enum {
+    MYDECODER_CSC_AUTO = 0,     /* from the stream, BT.601 when unspecified */
+    MYDECODER_CSC_BT601,
+    MYDECODER_CSC_BT709,
+} MyColorMatrix;
+
+typedef enum {
+    MYDECODER_RANGE_AUTO = 0,   /* from the stream, limited when unspecified */
+    MYDECODER_RANGE_LIMITED,
+    MYDECODER_RANGE_FULL,
+} MyColorRange;
+
+typedef enum {
+    MYDECODER_FIT_STRETCH = 0,  /* fill the output, ignoring the aspect ratio */
+    MYDECODER_FIT_LETTERBOX,    /* whole frame, centred, bars in the pad colour */
+    MYDECODER_FIT_CROP,         /* fill the output, centre of the frame */
+} MyFitMode;
+
+typedef enum {
+    MYDECODER_INTERP_BILINEAR = 0,
+    MYDECODER_INTERP_NEAREST,
+    MYDECODER_INTERP_AREA,      /* box average when shrinking, bilinear otherwise */
+} MyInterp;
+
+/*
+ * Output geometry of the BGR24 retrieve paths. Scaling is done on the YUV
+ * planes as part of the conversion, so the full size BGR24 picture is
+ * never produced.
+ */
+typedef struct {
+    s32 width;          /* 0 keeps the frame size */
+    s32 height;
+    MyFitMode fit;
+    MyInterp interp;
+    u8 pad[3];          /* B, G, R of the letterbox bars */
+} MyResizeConfig;
+
+typedef enum {
+    MYDECODER_SAMPLE_ALL = 0,
+    MYDECODER_SAMPLE_KEYFRAME,  /* keyframes only */
+    MYDECODER_SAMPLE_NONREF,    /* skip frames no other frame refers to */
+    MYDECODER_SAMPLE_FPS,       /* about target_fps frames per second of stream time */
+} MySampleMode;
+
+/*
+ * Which frames of a stream are wanted. Unwanted frames are dropped before
+ * decoding where the reference structure allows it (non-reference frames,
+ * whole GOPs in which nothing is wanted); the remaining unwanted ones are
+ * decoded for their references but never converted or returned.
+ */
+typedef struct {
+    MySampleMode mode;
+    double target_fps;
+} MySamplePolicy;
+
+/* Decoded-frame buffer pool of a context */
+typedef struct {
+    s32 width;
+    s32 height;
+    s32 buffer_size;
+    s32 buffers;        /* buffers owned by the pool at the current resolution */
+    s32 high_water;     /* most buffers ever in use at once */
+    s32 resizes;        /* resolution changes seen */
+} MyPoolStats;
+
+typedef enum {
+    MYDECODER_TIMER_READ = 0,   /* av_read_frame */
+    MYDECODER_TIMER_SEND,       /* avcodec_send_packet, mpp decode_put_packet */
+    MYDECODER_TIMER_RECEIVE,    /* avcodec_receive_frame, mpp decode_get_frame */
+    MYDECODER_TIMER_CONVERT,    /* BGR24 and tensor conversion, sws_scale included */
+    MYDECODER_TIMER_LATENCY,    /* packet into the decoder to frame out, live mode */
+    MYDECODER_TIMER_NB,
+} MyTimer;
+
+typedef enum {
+    MYDECODER_DROP_SKIPPED = 0, /* packet not decoded, see mydecoder_set_sampling() */
+    MYDECODER_DROP_SAMPLED,     /* decoded but not returned, same */
+    MYDECODER_DROP_OVERRUN,     /* rkmpp ring full, oldest frame overwritten */
+    MYDECODER_DROP_CORRUPT,     /* flagged as broken by the decoder */
+    MYDECODER_DROP_UNCHANGED,   /* held back by the motion gate */
+    MYDECODER_DROP_CONVERT,     /* decoded but its conversion failed */
+    MYDECODER_DROP_NB,
+} MyDropReason;
+
+/* Bucket i counts calls under 2^i us, the last one everything slower */
+#define MYDECODER_STATS_BUCKETS    16
+
+typedef struct {
+    s64 count;
+    s64 total_ns;
+    s64 max_ns;
+    s64 buckets[MYDECODER_STATS_BUCKETS];
+} MyTimerStats;
+
+/*
+ * Counters of a context since it was allocated. Counting is always on;
+ * the stage timers only run after mydecoder_set_stats(ctx, 1), as they
+ * read the clock twice per call. The latency timer runs in live mode.
+ */
+typedef struct {
+    s64 packets;            /* read from the input */
+    s64 bytes;
+    s64 frames_decoded;
+    s64 frames_converted;
+    s64 dropped[MYDECODER_DROP_NB];
+    s64 decode_errors;
+    s64 open_us;            /* time spent in mydecoder_open() */
+    s64 first_frame_us;     /* from the start of open to the first frame out, 0 before */
+    s64 frame_interval_us;  /* pts step between the last two frames, live mode */
+    s64 late_frames;        /* live mode frames whose latency exceeded that step */
+    s32 ring_frames;        /* decoded frames waiting in the rkmpp ring */
+    s32 ring_size;
+    s32 ring_high_water;
+    MyTimerStats timers[MYDECODER_TIMER_NB];
+} MyStats;
+
+typedef enum {
+    MYDECODER_STATS_PROMETHEUS = 0,     /* text exposition format */
+    MYDECODER_STATS_JSON,
+} MyStatsFormat;
+
+typedef enum {
+    MYDECODER_PIX_FMT_NONE = 0,     /* anything else, see av_format */
+    MYDECODER_PIX_FMT_I420,
+    MYDECODER_PIX_FMT_NV12,
+    MYDECODER_PIX_FMT_BGR24,
+    MYDECODER_PIX_FMT_RGB24,
+    MYDECODER_PIX_FMT_BGRA,
+    MYDECODER_PIX_FMT_RGBA,
+    MYDECODER_PIX_FMT_GRAY8,
+    MYDECODER_PIX_FMT_BGR_PLANAR,   /* data[0..2] = B, G, R */
+    MYDECODER_PIX_FMT_RGB_PLANAR,   /* data[0..2] = R, G, B */
+} MyPixFmt;
+
+/*
+ * What retrieve_frame, async convert and the other converting paths write,
+ * as one tightly packed buffer of mydecoder_output_buffer_size() bytes.
+ * Planar formats are three width x height planes in the order of their
+ * name. GRAY8 is the luma plane as decoded. NV12 and I420 are copies of
+ * the decoded planes (chroma of (width + 1) / 2 x (height + 1) / 2) and
+ * are never resized.
+ */
+typedef enum {
+    MYDECODER_OUT_BGR24 = 0,
+    MYDECODER_OUT_RGB24,
+    MYDECODER_OUT_BGRA,
+    MYDECODER_OUT_RGBA,
+    MYDECODER_OUT_GRAY8,
+    MYDECODER_OUT_BGR_PLANAR,
+    MYDECODER_OUT_RGB_PLANAR,
+    MYDECODER_OUT_NV12,
+    MYDECODER_OUT_I420,
+} MyOutFormat;
+
+#define MYDECODER_MOTION_GRID_MAX    256
+
+/*
+ * Motion gate, off by default: a frame whose downsampled luma differs from
+ * the last frame let through by less than threshold (mean absolute
+ * difference, 0-255) is not converted. mydecoder_retrieve_frame() then
+ * returns MYDECODER_UNCHANGED and leaves its buffer alone; async, push and
+ * scheduler output drop the frame. Only 8-bit 4:2:0 and gray frames are
+ * scored, others always pass.
+ */
+typedef struct {
+    s32 enable;
+    s32 step;               /* luma averaged over step x step boxes, 4 by default, <= 257 */
+    float threshold;
+    float cell_threshold;   /* > 0: one grid cell this far off is a change as well */
+    s32 grid_cols;          /* change grid, cols x rows <= MYDECODER_MOTION_GRID_MAX */
+    s32 grid_rows;
+    s32 max_unchanged;      /* > 0: let a frame through after that many held back */
+} MyMotionConfig;
+
+/* Score of the last frame the gate saw */
+typedef struct {
+    s64 pts;
+    float score;
+    s32 changed;
+    s32 grid_cols;          /* 0 without a grid */
+    s32 grid_rows;
+    float grid[MYDECODER_MOTION_GRID_MAX];  /* mean difference per cell, row by row */
+} MyMotionInfo;
+
+#define MYDECODER_UNCHANGED    1
+
+/*
+ * Planes of a decoded frame, without conversion or copy. The view holds a
+ * reference on the frame buffers until mydecoder_frame_view_release(), so
+ * views may be kept and released from any thread while decoding goes on.
+ * With rkmpp the view takes the next frame of the decoded ring (frame is
+ * unused), just like mydecoder_retrieve_frame() does.
+ */
+typedef struct {
+    u8 *data[4];
+    s32 linesize[4];
+    s32 width;
+    s32 height;
+    MyPixFmt format;
+    s32 av_format;      /* AVPixelFormat of the planes */
+    s64 pts;            /* in stream time base */
+    void *priv;
+} MyFrameView;
+
+/*
+ * Called from the pipeline's last stage for every frame; the callee owns
+ * the view and releases it with mydecoder_frame_view_release(). A NULL
+ * view signals the end of the stream.
+ */
+typedef void (*MyFrameCallback)(void *opaque, MyFrameView *view);
+
+typedef struct {
+    s32 queue_depth;            /* items in flight per stage, 0 for the default */
+    s32 convert;                /* deliver BGR24 instead of the decoded planes */
+    MyFrameCallback callback;   /* NULL to collect frames with mydecoder_async_poll() */
+    void *opaque;
+} MyAsyncConfig;
+
+/* Codec parameters that make probing unnecessary */
+typedef struct {
+    s32 codec_id;           /* AVCodecID, 0 when unknown */
+    s32 width;
+    s32 height;
+    s32 pix_fmt;            /* AVPixelFormat, -1 when unknown */
+    const u8 *extradata;    /* SPS/PPS (VPS), as avcC/hvcC or Annex B */
+    s32 extradata_size;
+} MyStreamParams;
+
+/*
+ * Faster opening, mostly for reconnecting to live sources. Probing reads
+ * at most probesize bytes and analyze_us of stream time. With skip_probe
+ * it is left out when the parameters are known, from params or from the
+ * cache file a previous probe of the same URL left in cache_dir. Packets
+ * before the first IDR are dropped so the first frame decoded is whole.
+ */
+typedef struct {
+    s32 probesize;          /* 0 for 32 KiB */
+    s32 analyze_us;         /* 0 for 500 ms */
+    s32 skip_probe;
+    s32 low_delay;          /* slice threads and no reorder delay, for streams without B-frames */
+    const char *cache_dir;  /* NULL for no cache */
+    MyStreamParams params;
+} MyFastOpenConfig;
+
+/*
+ * Live mode, for sources where latency matters more than throughput: no
+ * demuxer buffering, no reorder delay or frame threads in the decoder
+ * (AV_CODEC_FLAG_LOW_DELAY, AV_CODEC_FLAG2_FAST and slice threads; rkmpp
+ * immediate output and short polls), so each frame comes out of the decode
+ * call its packet went into. The latency of every frame is measured, see
+ * MyStats. Streams with B-frames still wait for their reference frames.
+ */
+typedef struct {
+    s32 enable;
+    s32 threads;            /* slice threads, 0 for one per core */
+    s32 poll_us;            /* rkmpp wait for a frame between polls, 0 for 500 */
+} MyLiveConfig;
+
+/*
+ * Decode quality traded for speed, for analytics that do not need every
+ * detail of every frame. Each level adds to the one before:
+ *  FAST     no loop filter on non-reference frames, AV_CODEC_FLAG2_FAST
+ *  FASTER   no loop filter at all, no IDCT on non-reference frames
+ *  FASTEST  half resolution: lowres decoding where the codec has it,
+ *           otherwise retrieve_frame writes pictures of half the
+ *           frame size, rounded down
+ * Errors stay within a GOP, since reference frames keep their IDCT. Knobs
+ * a decoder does not implement (H.264 has no lowres or skip_idct, hardware
+ * decoders honour none) are ignored by it.
+ */
+typedef enum {
+    MYDECODER_QUALITY_FULL = 0,
+    MYDECODER_QUALITY_FAST,
+    MYDECODER_QUALITY_FASTER,
+    MYDECODER_QUALITY_FASTEST,
+} MyDecodeQuality;
+
+/* Zeroed bytes a borrowed push buffer must have readable past its end */
+#define MYDECODER_PUSH_PADDING    64
+
+/*
+ * Elementary stream input without a demuxer, e.g. Annex B H.264 from an
+ * RTP depacketizer. Decoded frames go to callback from inside
+ * mydecoder_push_data(), a NULL view after the flush.
+ */
+typedef struct {
+    s32 framed;         /* every push is one whole access unit, no parser needed */
+    s32 convert;        /* deliver BGR24 instead of the decoded planes */
+    s32 time_base_num;  /* unit of the pushed pts, 0 for 1/90000 (RTP video) */
+    s32 time_base_den;
+    MyFrameCallback callback;
+    void *opaque;
+    /*
+     * When set, pushed data is borrowed instead of copied and release is
+     * called, from any thread, once nothing refers to it any more. The
+     * buffer then needs MYDECODER_PUSH_PADDING zeroed bytes after size.
+     * Only framed avcodec input is passed on without a copy; otherwise
+     * release comes before mydecoder_push_data() returns.
+     */
+    void (*release)(void *opaque, const u8 *data);
+} MyPushConfig;
+
+/*
+ * Scheduler running many open contexts on a fixed pool of workers, one
+ * per core. A stream stays with the worker that last ran it and is only
+ * moved when another worker runs out of work and steals it.
+ */
+typedef struct MyScheduler * MySched;
+
+typedef struct {
+    s32 workers;        /* 0 for one per core the process may run on */
+    s32 pin;            /* pin worker i to the i-th core of the affinity mask */
+    s32 quantum;        /* packets per turn of a stream, 0 for the default */
+} MySchedConfig;
+
+typedef struct {
+    s32 priority;       /* runnable streams of a higher priority always go first */
+    s32 weight;         /* share of worker time among equal priorities, 0 for 1 */
+    s32 convert;        /* deliver BGR24 instead of the decoded planes */
+    MyFrameCallback callback;   /* on the worker thread, NULL view at the end */
+    void *opaque;
+} MyStreamConfig;
+
+typedef struct {
+    s32 core;           /* -1 when not pinned */
+    s32 streams;        /* queued on the worker right now */
+    s64 turns;
+    s64 steals;
+    s64 packets;
+    s64 frames;
+    s64 busy_us;
+    double utilization; /* busy share of the time since the scheduler started */
+} MyWorkerStats;
+
+/*
+ * Offline decoding of one file on several decoder instances at once, see
+ * mydecoder_batch_decode(). Frames reach callback in display order.
+ */
+typedef struct {
+    s32 workers;        /* decoder instances, 0 for one per online core */
+    s32 shard_gops;     /* GOPs decoded in one go, 0 for about 4 shards per worker */
+    s32 max_pending;    /* decoded frames held for reordering, 0 for 64 */
+    s32 convert;        /* deliver BGR24 instead of the decoded planes */
+    MyFrameCallback callback;   /* on the calling thread, NULL view at the end */
+    void *opaque;
+} MyBatchConfig;
+
+/*
+ * What the publisher of a shared-memory ring does when the slot it is
+ * about to reuse is still being read: overwrite it (the reader learns from
+ * mydecoder_shm_done()), or keep it and drop the new frame.
+ */
+typedef enum {
+    MYDECODER_SHM_OVERWRITE = 0,
+    MYDECODER_SHM_PROTECT,
+} MyShmPolicy;
+
+typedef struct {
+    s32 slots;          /* 0 for 8 */
+    s32 slot_size;      /* picture bytes per slot, see mydecoder_output_buffer_size() */
+    s32 readers;        /* reader cursors, 0 for 8 */
+    MyShmPolicy policy;
+} MyShmConfig;
+
+/* One publisher process, any number of reader processes, same name */
+typedef struct MyShmRing * MyShm;
+
+typedef enum {
+    MYDECODER_RECORD_MP4 = 0,   /* fragmented, playable even when cut short */
+    MYDECODER_RECORD_MPEGTS,
+} MyRecordFormat;
+
+/*
+ * Recording of the packets read for decoding, without decoding them
+ * again: the video stream and any audio go into segment files path_00000.mp4
+ * (or .ts), path_00001.mp4, ... each starting on a keyframe.
+ */
+typedef struct {
+    const char *path;
+    MyRecordFormat format;
+    s32 segment_sec;        /* new segment at the first keyframe after that long, 0 for one file */
+    s32 max_buffer_kb;      /* packets waiting for the disk, 0 for 8 MiB */
+} MyRecordConfig;
+
+typedef struct {
+    s64 segments;           /* files started */
+    s64 packets;            /* written */
+    s64 bytes;
+    s64 dropped;            /* buffer full or write failed, up to the next keyframe */
+    s32 buffered_kb;
+} MyRecordStats;
+
+typedef enum {
+    MYDECODER_LAYOUT_NCHW = 0,
+    MYDECODER_LAYOUT_NHWC,
+} MyTensorLayout;
+
+typedef enum {
+    MYDECODER_DTYPE_U8 = 0,
+    MYDECODER_DTYPE_F32,
+    MYDECODER_DTYPE_F16,        /* IEEE half, stored as u16 */
+} MyTensorDtype;
+
+typedef enum {
+    MYDECODER_ORDER_RGB = 0,
+    MYDECODER_ORDER_BGR,
+} MyChannelOrder;
+
+/*
+ * A contiguous batch of 3 channel images, N x 3 x H x W or N x H x W x 3.
+ * Float outputs are (pixel - mean[c]) / std[c] with pixel in 0..255 and c
+ * the output channel, e.g. mean 123.675/116.28/103.53 and std
+ * 58.395/57.12/57.375 for ImageNet in RGB order, or mean 0 and std 255 to
+ * get 0..1. A std of 0 counts as 1. u8 outputs ignore mean/std.
+ */
+typedef struct {
+    MyTensorLayout layout;
+    MyTensorDtype dtype;
+    MyChannelOrder order;
+    s32 width;
+    s32 height;
+    float mean[3];
+    float std[3];
+} MyTensorDesc;
+
+/*
+ * A region of a frame and the size it is wanted at. x and y are rounded
+ * down to even (whole chroma samples); the rectangle is clipped to the
+ * frame.
+ */
+typedef struct {
+    s32 x;
+    s32 y;
+    s32 width;
+    s32 height;
+    s32 out_width;
+    s32 out_height;
+} MyRoi;
+
+#define MYDECODER_ROI_MAX    64
+
+/* One picture of a fan-out, in a buffer of mydecoder_output_buffer_size() bytes */
+typedef struct {
+    MyOutFormat format;
+    s32 width;          /* 0 for the frame size */
+    s32 height;
+    u8 *out;
+} MyOutputSpec;
+
+#define MYDECODER_OUTPUTS_MAX    8
+
+/* One context per stream; contexts share no state and may be used from different threads. */
+typedef struct MyDecoderContext * MyContext;
 
 MyPacket mydecoder_packet_alloc(void);
 MyFrame mydecoder_frame_alloc(void);
 MyContext mydecoder_context_alloc(void);
-s32 mydecoder_open(MyContext *ctx, const s8 *file_name, s8 *codec_name, s32 *frame_num);
+s32 mydecoder_set_color(MyContext ctx, MyColorMatrix matrix, MyColorRange range);
+/* retrieve_frame and async convert then write config->width x height pictures */
+s32 mydecoder_set_resize(MyContext ctx, const MyResizeConfig *config);
+s32 mydecoder_set_sampling(MyContext ctx, const MySamplePolicy *policy);
+/* BGR24 by default */
+s32 mydecoder_set_output_format(MyContext ctx, MyOutFormat format);
+s32 mydecoder_output_buffer_size(MyOutFormat format, s32 width, s32 height);
+/* Size retrieve_frame writes frame at, after resize and decode quality */
+s32 mydecoder_get_output_size(MyContext ctx, MyFrame frame, s32 *width, s32 *height);
+/*
+ * Colour conversion of one frame in horizontal bands on up to threads
+ * threads (the caller's included) of a pool shared by all contexts; 0 or
+ * 1, the default, converts on the calling thread only. Resizing stays on
+ * one thread.
+ */
+#define MYDECODER_CONVERT_THREADS_MAX    64
+s32 mydecoder_set_convert_threads(MyContext ctx, s32 threads);
+/* Not while frames are being decoded; NULL or enable 0 turns the gate off */
+s32 mydecoder_set_motion_gate(MyContext ctx, const MyMotionConfig *config);
+s32 mydecoder_get_motion(MyContext ctx, MyMotionInfo *info);
+/* Before open; config and the data it points to are copied */
+s32 mydecoder_set_fast_open(MyContext ctx, const MyFastOpenConfig *config);
+/*
+ * Before open: read local files from a memory mapping, copied straight
+ * into the packets, instead of through the file protocol. URLs and files
+ * that cannot be mapped are opened as before.
+ */
+s32 mydecoder_set_mmap_input(MyContext ctx, s32 enable);
+/* Before open; NULL or enable 0 turns live mode off */
+s32 mydecoder_set_live(MyContext ctx, const MyLiveConfig *config);
+/* Before open; a resize set with mydecoder_set_resize() wins over FASTEST's half size */
+s32 mydecoder_set_decode_quality(MyContext ctx, MyDecodeQuality quality);
+s32 mydecoder_open(MyContext ctx, const s8 *file_name, s8 *codec_name, s32 *frame_num);
+/* Open for mydecoder_push_data() instead of a file; get_packet/decode are not used */
+s32 mydecoder_open_push(MyContext ctx, s8 *codec_name, const MyPushConfig *config);
+/* size 0 flushes the decoder at the end of the stream */
+s32 mydecoder_push_data(MyContext ctx, const u8 *data, s32 size, s64 pts);
 s32 mydecoder_get_packet(MyContext ctx, MyPacket *packet, s32 *packet_size);
-s32 mydecoder_decode(MyPacket packet, MyFrame frame, s32 *got_frame);
-s32 mydecoder_retrieve_frame(MyFrame frame, u8 *bgr_data);
-s32 mydecoder_close(MyFrame frame, MyPacket packet);
+/*
+ * Tee of every packet read, by get_packet or the async and scheduled
+ * pipelines, into a writer thread. Reading never waits for the disk: when
+ * more than max_buffer_kb is waiting the packets are dropped instead. Start
+ * after open, stop when no packets are being read; close stops it too.
+ * Stop writes what is still queued and finishes the last segment, then
+ * fills stats (may be NULL) with the final numbers.
+ */
+s32 mydecoder_record_start(MyContext ctx, const MyRecordConfig *config);
+s32 mydecoder_record_stop(MyContext ctx, MyRecordStats *stats);
+s32 mydecoder_get_record_stats(MyContext ctx, MyRecordStats *stats);
+/*
+ * Random access. mydecoder_index_build() scans a file once, demuxing only,
+ * and writes the byte offset and pts of every keyframe to index_file;
+ * mydecoder_index_load() maps that file for a context opened on the same
+ * file. Without an index the demuxer's own one is used, if it has any.
+ */
+s32 mydecoder_index_build(const s8 *file_name, const s8 *index_file);
+s32 mydecoder_index_load(MyContext ctx, const s8 *index_file);
+/* Unit of the pts of frames and of mydecoder_get_frame_at() */
+s32 mydecoder_get_time_base(MyContext ctx, s32 *num, s32 *den);
+/*
+ * The last frame shown at or before pts, as a view to release like any
+ * other (in the output format with convert). Decoding starts from the keyframe before pts;
+ * a later pts in the same GOP goes on from the previous call instead. The
+ * read position moves, so do not mix with get_packet/decode.
+ */
+s32 mydecoder_get_frame_at(MyContext ctx, s64 pts, s32 convert, MyFrameView *view);
+s32 mydecoder_decode(MyContext ctx, MyPacket packet, MyFrame frame, s32 *got_frame);
+/* Into out, in the output format (see MyOutFormat); MYDECODER_UNCHANGED when gated */
+s32 mydecoder_retrieve_frame(MyContext ctx, MyFrame frame, u8 *out);
+s32 mydecoder_frame_view_get(MyContext ctx, MyFrame frame, MyFrameView *view);
+void mydecoder_frame_view_release(MyFrameView *view);
+/*
+ * Convert num decoded frames into one caller-allocated tensor, frame i at
+ * batch index i; the YUV -> RGB conversion, normalisation and layout are
+ * done in a single pass per row. Frames of another size are scaled to
+ * desc->width x desc->height with the fit, interpolation and pad colour
+ * set by mydecoder_set_resize() (stretch, bilinear by default).
+ * With rkmpp up to num frames are taken from the decoded ring (frames is
+ * unused). Returns the number of frames written or a negative error.
+ */
+s32 mydecoder_retrieve_batch(MyContext ctx, MyFrame *frames, s32 num,
+    const MyTensorDesc *desc, void *tensor);
+/*
+ * Crop and resize num regions of one frame straight from its YUV planes
+ * into out as BGR24, one after another (out_width * out_height * 3 bytes
+ * each), so the rest of the frame is never converted. The interpolation
+ * is the one of mydecoder_set_resize(); regions are spread over the
+ * conversion threads. Returns num.
+ */
+s32 mydecoder_retrieve_rois(MyContext ctx, MyFrame frame, const MyRoi *rois, s32 num, u8 *out);
+/*
+ * Several pictures of one frame from a single pass over its planes, a
+ * band of rows at a time. The frame size RGB outputs share one YUV -> BGR
+ * conversion and are repacked from it; resized ones (stretched, with the
+ * interpolation of mydecoder_set_resize()) convert only their own pixels.
+ * Every output is what retrieve_frame writes for that format and size.
+ * NV12 and I420 outputs are copies at the frame size of a 4:2:0 frame.
+ * Returns num. rkmpp frames come off the ring as with retrieve_frame.
+ */
+s32 mydecoder_retrieve_outputs(MyContext ctx, MyFrame frame, const MyOutputSpec *outputs,
+    s32 num);
+/*
+ * Opt-in pipelined mode: demux, decode and conversion run on their own
+ * threads once the context is open. Do not call get_packet/decode/retrieve
+ * on the context while it runs. poll returns 0 with a frame, AVERROR(EAGAIN)
+ * on timeout (timeout_ms < 0 waits forever) and AVERROR_EOF at the end.
+ */
+s32 mydecoder_async_start(MyContext ctx, const MyAsyncConfig *config);
+s32 mydecoder_async_poll(MyContext ctx, MyFrameView *view, s32 timeout_ms);
+s32 mydecoder_async_stop(MyContext ctx);
+MySched mydecoder_sched_create(const MySchedConfig *config);
+/* ctx must be open and not running async; it stays owned by the caller */
+s32 mydecoder_sched_add(MySched sched, MyContext ctx, const MyStreamConfig *config);
+s32 mydecoder_sched_set_priority(MySched sched, MyContext ctx, s32 priority, s32 weight);
+/* Waits for the stream's current turn to end; the context may be closed afterwards */
+s32 mydecoder_sched_remove(MySched sched, MyContext ctx);
+s32 mydecoder_sched_workers(MySched sched);
+s32 mydecoder_sched_worker_stats(MySched sched, s32 worker, MyWorkerStats *stats);
+void mydecoder_sched_destroy(MySched sched);
+/*
+ * Decode file_name split at its keyframes, the GOP ranges in parallel on
+ * contexts of their own, with ctx's color and resize settings (ctx itself
+ * is not opened). Returns after the last frame with the number of frames
+ * delivered, or a negative error. Needs timestamps to split the file;
+ * without them it decodes in one piece.
+ */
+s32 mydecoder_batch_decode(MyContext ctx, const s8 *file_name, s8 *codec_name,
+    const MyBatchConfig *config);
+/*
+ * Shared-memory frame ring (POSIX shm, name like "/cam0"). The publisher
+ * converts a frame straight into the next slot with mydecoder_shm_publish()
+ * (retrieve_frame semantics, output format of ctx), or copies a view in
+ * with mydecoder_shm_write(); it never waits for readers. Readers map the
+ * ring and get views pointing into it: a reader that falls more than a
+ * ring behind skips to the oldest frame still there. The view stays valid
+ * until the next read or mydecoder_shm_done(), which returns
+ * AVERROR(ESTALE) if the publisher overwrote it meanwhile; do not pass it
+ * to mydecoder_frame_view_release(). Publish and write return 1 when the
+ * frame was dropped (PROTECT policy), 0 when it was published; a frame
+ * publish failed to convert returns the error and readers skip it.
+ */
+MyShm mydecoder_shm_create(const s8 *name, const MyShmConfig *config);
+s32 mydecoder_shm_publish(MyContext ctx, MyShm shm, MyFrame frame);
+s32 mydecoder_shm_write(MyShm shm, const MyFrameView *view);
+void mydecoder_shm_destroy(MyShm shm);
+MyShm mydecoder_shm_open(const s8 *name);
+/*
+ * Next frame, waiting up to timeout_ms (-1 for ever): AVERROR(EAGAIN) on
+ * timeout, AVERROR_EOF once the publisher is gone.
+ */
+s32 mydecoder_shm_read(MyShm shm, MyFrameView *view, s32 timeout_ms);
+s32 mydecoder_shm_done(MyShm shm);
+/* Frames this reader skipped, or the publisher dropped, so far */
+s64 mydecoder_shm_dropped(MyShm shm);
+void mydecoder_shm_close(MyShm shm);
+s32 mydecoder_get_pool_stats(MyContext ctx, MyPoolStats *stats);
+s32 mydecoder_set_stats(MyContext ctx, s32 timing);
+/* A snapshot, safe to take from any thread while the context runs */
+s32 mydecoder_get_stats(MyContext ctx, MyStats *stats);
+/*
+ * Print a snapshot into buf, with label as the stream label of the
+ * Prometheus samples (may be NULL). Returns the length of the whole dump
+ * like snprintf, so a return >= size means buf was too small.
+ */
+s32 mydecoder_stats_dump(const MyStats *stats, MyStatsFormat format, const char *label,
+    char *buf, s32 size);
+s32 mydecoder_close(MyContext ctx, MyFrame frame, MyPacket packet);
 
 #ifdef __cplusplus
 }
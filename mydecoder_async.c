@@ -0,0 +1,366 @@
+#include <libavutil/imgutils.h>
+
+#include "mydecoder_internal.h"
+#include "mydecoder_queue.h"
+
+#define ASYNC_DEFAULT_DEPTH    8
+
+/*
+ * Three stage pipeline on one context:
+ *   demux -> pkt_queue -> decode -> frm_queue -> convert -> out_queue/callback
+ * Packets and frames circulate between neighbouring stages through free
+ * queues, so every queue has exactly one producer and one consumer.
+ * A NULL item travelling down the queues marks the end of the stream.
+ */
+struct MyAsync {
+    MyContext ctx;
+    MyAsyncConfig config;
+    pthread_t demux_thread;
+    pthread_t decode_thread;
+    pthread_t convert_thread;
+    atomic_int stop;
+    MySpscQueue pkt_queue;
+    MySpscQueue pkt_free;
+    MySpscQueue frm_queue;
+    MySpscQueue frm_free;
+    MySpscQueue out_queue;
+    AVPacket **pkts;
+    AVFrame **frms;
+    s32 depth;
+    MyBufferPool bgr_pool;
+    s32 eof;
+};
+
+/* Blocking push/pop for the stage threads; -1 once the pipeline is stopping */
+static s32 async_push(struct MyAsync *async, MySpscQueue *q, void *item)
+{
+    u32 spins = 0;
+
+    while (mydecoder_queue_push(q, item) < 0) {
+        if (atomic_load(&async->stop))
+            return -1;
+        mydecoder_backoff(&spins);
+    }
+    return 0;
+}
+
+static s32 async_pop(struct MyAsync *async, MySpscQueue *q, void **item)
+{
+    u32 spins = 0;
+
+    while (mydecoder_queue_pop(q, item) < 0) {
+        if (atomic_load(&async->stop))
+            return -1;
+        mydecoder_backoff(&spins);
+    }
+    return 0;
+}
+
+/* Lets a blocking av_read_frame() on a live source return when stopping */
+static int async_interrupt(void *opaque)
+{
+    struct MyAsync *async = (struct MyAsync *)opaque;
+
+    return atomic_load(&async->stop);
+}
+
+static void *async_demux_thread(void *arg)
+{
+    struct MyAsync *async = (struct MyAsync *)arg;
+    MyContext ctx = async->ctx;
+    AVPacket *pkt;
+    s32 ret;
+
+    while (1) {
+        if (async_pop(async, &async->pkt_free, (void **)&pkt) < 0)
+            return NULL;
+
+        do {
+            s64 start = mydecoder_timer_start(ctx);
+
+            av_packet_unref(pkt);
+            ret = av_read_frame(ctx->fmt_ctx, pkt);
+            mydecoder_timer_stop(ctx, MYDECODER_TIMER_READ, start);
+            if (ret >= 0)
+                mydecoder_record_packet(ctx, pkt);
+        } while (ret == AVERROR(EAGAIN) ||
+                 (ret >= 0 && pkt->stream_index != ctx->video_stream_idx));
+
+        if (ret < 0) {
+            if (ret != AVERROR_EOF && !atomic_load(&async->stop))
+                mydecoder_err("Error reading packet: %d\n", ret);
+            av_packet_unref(pkt);
+            async_push(async, &async->pkt_queue, NULL);
+            return NULL;
+        }
+        mydecoder_stat_add(ctx, packets, 1);
+        mydecoder_stat_add(ctx, bytes, pkt->size);
+        if (async_push(async, &async->pkt_queue, pkt) < 0)
+            return NULL;
+    }
+}
+
+static s32 async_decode_sink(void *opaque, AVFrame *frame)
+{
+    struct MyAsync *async = (struct MyAsync *)opaque;
+    AVFrame *dst;
+
+    if (async_pop(async, &async->frm_free, (void **)&dst) < 0)
+        return -1;
+    av_frame_move_ref(dst, frame);
+    return async_push(async, &async->frm_queue, dst);
+}
+
+static void *async_decode_thread(void *arg)
+{
+    struct MyAsync *async = (struct MyAsync *)arg;
+    AVPacket *pkt;
+
+    while (1) {
+        if (async_pop(async, &async->pkt_queue, (void **)&pkt) < 0)
+            return NULL;
+
+        if (!pkt) {
+            /* drain what the decoder still holds, then pass the end on */
+            mydecoder_decode_frames(async->ctx, NULL, async_decode_sink, async);
+            async_push(async, &async->frm_queue, NULL);
+            return NULL;
+        }
+
+        if (mydecoder_decode_frames(async->ctx, pkt, async_decode_sink, async) < 0 &&
+            atomic_load(&async->stop))
+            return NULL;
+        av_packet_unref(pkt);
+        mydecoder_queue_push(&async->pkt_free, pkt);
+    }
+}
+
+/*
+ * Wrap a picture converted to the output format from bgr_pool, or take
+ * over the decoded frame, as a new AVFrame for a view; NULL, a drop,
+ * when that fails. frame is left unreferenced. Planar RGB is GBRP with
+ * the planes in the order of the output format; RGB_PLANAR frames are
+ * tagged in opaque so fill_view can tell them from native GBRP.
+ */
+AVFrame *mydecoder_output_frame(MyContext ctx, AVFrame *frame, MyBufferPool *bgr_pool,
+    s32 convert)
+{
+    AVFrame *out = av_frame_alloc();
+    u8 *data[4];
+    s32 linesize[4];
+    s32 width, height, size, format, i;
+
+    if (!out)
+        return NULL;
+
+    if (!convert) {
+        av_frame_move_ref(out, frame);
+        return out;
+    }
+
+    mydecoder_output_size(ctx, frame, &width, &height);
+    size = mydecoder_output_buffer_size(ctx->out_format, width, height);
+    format = mydecoder_out_av_format(ctx->out_format);
+    out->buf[0] = mydecoder_pool_get(bgr_pool, width, height, format, size);
+    if (!out->buf[0]) {
+        av_frame_free(&out);
+        return NULL;
+    }
+    out->format = format;
+    out->width = width;
+    out->height = height;
+    out->pts = frame->pts;
+    mydecoder_out_planes(ctx->out_format, out->buf[0]->data, width, height, data, linesize);
+    for (i = 0; i < 4; i++) {
+        out->data[i] = data[i];
+        out->linesize[i] = linesize[i];
+    }
+    if (AV_PIX_FMT_GBRP == format) {
+        /* G, B, R */
+        out->data[0] = data[1];
+        out->data[1] = MYDECODER_OUT_RGB_PLANAR == ctx->out_format ? data[2] : data[0];
+        out->data[2] = MYDECODER_OUT_RGB_PLANAR == ctx->out_format ? data[0] : data[2];
+        if (MYDECODER_OUT_RGB_PLANAR == ctx->out_format)
+            out->opaque = (void *)&mydecoder_rgb_planar_tag;
+    }
+    /* a picture that was not written is dropped rather than handed on */
+    if (mydecoder_retrieve_avframe(ctx, frame, out->buf[0]->data) < 0) {
+        mydecoder_stat_add(ctx, dropped[MYDECODER_DROP_CONVERT], 1);
+        av_frame_free(&out);
+    }
+    av_frame_unref(frame);
+    return out;
+}
+
+static s32 async_deliver(struct MyAsync *async, AVFrame *out)
+{
+    MyFrameView view;
+
+    if (!async->config.callback)
+        return async_push(async, &async->out_queue, out);
+
+    if (!out) {
+        async->config.callback(async->config.opaque, NULL);
+        return 0;
+    }
+    mydecoder_fill_view(&view, out);
+    async->config.callback(async->config.opaque, &view);
+    return 0;
+}
+
+static void *async_convert_thread(void *arg)
+{
+    struct MyAsync *async = (struct MyAsync *)arg;
+    AVFrame *frame, *out;
+
+    while (1) {
+        if (async_pop(async, &async->frm_queue, (void **)&frame) < 0)
+            return NULL;
+
+        if (!frame) {
+            async_deliver(async, NULL);
+            return NULL;
+        }
+
+        out = NULL;
+        if (!mydecoder_motion_gate(async->ctx, frame))
+            out = mydecoder_output_frame(async->ctx, frame, &async->bgr_pool,
+                                         async->config.convert);
+        av_frame_unref(frame);
+        mydecoder_queue_push(&async->frm_free, frame);
+        if (!out)
+            continue;
+        if (async_deliver(async, out) < 0) {
+            av_frame_free(&out);
+            return NULL;
+        }
+    }
+}
+
+static void async_free(struct MyAsync *async)
+{
+    AVFrame *out;
+    s32 i;
+
+    while (mydecoder_queue_pop(&async->out_queue, (void **)&out) == 0)
+        av_frame_free(&out);
+    for (i = 0; i < async->depth; i++) {
+        if (async->pkts)
+            av_packet_free(&async->pkts[i]);
+        if (async->frms)
+            av_frame_free(&async->frms[i]);
+    }
+    av_freep(&async->pkts);
+    av_freep(&async->frms);
+    mydecoder_queue_uninit(&async->pkt_queue);
+    mydecoder_queue_uninit(&async->pkt_free);
+    mydecoder_queue_uninit(&async->frm_queue);
+    mydecoder_queue_uninit(&async->frm_free);
+    mydecoder_queue_uninit(&async->out_queue);
+    mydecoder_pool_uninit(&async->bgr_pool);
+    av_free(async);
+}
+
+s32 mydecoder_async_start(MyContext ctx, const MyAsyncConfig *config)
+{
+    struct MyAsync *async;
+    s32 i;
+
+    if (ctx->async || !ctx->fmt_ctx) {
+        mydecoder_err("Context is not open or already running async\n");
+        return -1;
+    }
+
+    async = (struct MyAsync *)av_mallocz(sizeof(struct MyAsync));
+    if (!async) {
+        mydecoder_err("Error allocating async pipeline\n");
+        return AVERROR(ENOMEM);
+    }
+    async->ctx = ctx;
+    async->config = *config;
+    async->depth = config->queue_depth > 0 ? config->queue_depth : ASYNC_DEFAULT_DEPTH;
+    atomic_init(&async->stop, 0);
+    mydecoder_pool_init(&async->bgr_pool);
+
+    /* depth items circulate per stage pair, every queue can hold all of them */
+    if (mydecoder_queue_init(&async->pkt_queue, async->depth + 1) < 0 ||
+        mydecoder_queue_init(&async->pkt_free, async->depth + 1) < 0 ||
+        mydecoder_queue_init(&async->frm_queue, async->depth + 1) < 0 ||
+        mydecoder_queue_init(&async->frm_free, async->depth + 1) < 0 ||
+        mydecoder_queue_init(&async->out_queue, async->depth + 1) < 0)
+        goto fail;
+
+    async->pkts = (AVPacket **)av_calloc(async->depth, sizeof(AVPacket *));
+    async->frms = (AVFrame **)av_calloc(async->depth, sizeof(AVFrame *));
+    if (!async->pkts || !async->frms)
+        goto fail;
+    for (i = 0; i < async->depth; i++) {
+        async->pkts[i] = av_packet_alloc();
+        async->frms[i] = av_frame_alloc();
+        if (!async->pkts[i] || !async->frms[i])
+            goto fail;
+        mydecoder_queue_push(&async->pkt_free, async->pkts[i]);
+        mydecoder_queue_push(&async->frm_free, async->frms[i]);
+    }
+
+    ctx->async = async;
+    ctx->fmt_ctx->interrupt_callback.callback = async_interrupt;
+    ctx->fmt_ctx->interrupt_callback.opaque = async;
+    pthread_create(&async->demux_thread, NULL, async_demux_thread, async);
+    pthread_create(&async->decode_thread, NULL, async_decode_thread, async);
+    pthread_create(&async->convert_thread, NULL, async_convert_thread, async);
+    return 0;
+
+fail:
+    mydecoder_err("Error allocating async pipeline\n");
+    async_free(async);
+    return AVERROR(ENOMEM);
+}
+
+s32 mydecoder_async_poll(MyContext ctx, MyFrameView *view, s32 timeout_ms)
+{
+    struct MyAsync *async = ctx->async;
+    AVFrame *out;
+    u32 spins = 0;
+    s32 waited_us = 0;
+
+    memset(view, 0, sizeof(*view));
+    if (!async || async->config.callback)
+        return -1;
+    if (async->eof)
+        return AVERROR_EOF;
+
+    while (mydecoder_queue_pop(&async->out_queue, (void **)&out) < 0) {
+        if (timeout_ms >= 0 && waited_us >= timeout_ms * 1000)
+            return AVERROR(EAGAIN);
+        mydecoder_backoff(&spins);
+        if (spins >= 64)
+            waited_us += 200;
+    }
+
+    if (!out) {
+        async->eof = 1;
+        return AVERROR_EOF;
+    }
+    mydecoder_fill_view(view, out);
+    return 0;
+}
+
+s32 mydecoder_async_stop(MyContext ctx)
+{
+    struct MyAsync *async = ctx->async;
+
+    if (!async)
+        return -1;
+
+    atomic_store(&async->stop, 1);
+    pthread_join(async->demux_thread, NULL);
+    pthread_join(async->decode_thread, NULL);
+    pthread_join(async->convert_thread, NULL);
+    ctx->fmt_ctx->interrupt_callback.callback = NULL;
+    ctx->fmt_ctx->interrupt_callback.opaque = NULL;
+    ctx->async = NULL;
+    async_free(async);
+
+    return 0;
+}
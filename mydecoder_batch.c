@@ -0,0 +1,341 @@
+#include <pthread.h>
+#include <unistd.h>
+
+#include <libavutil/mem.h>
+
+#include "mydecoder_internal.h"
+
+#define BATCH_SHARDS_PER_WORKER    4
+#define BATCH_DEFAULT_PENDING      64
+
+/*
+ * Offline decoding of one file on all cores. The file is cut at its
+ * keyframes into shards of whole GOPs, which workers take in file order
+ * and decode on their own contexts. A shard outputs the frames shown from
+ * its first keyframe up to the next shard's; it decodes past its end only
+ * for the pictures shown before that keyframe (open GOPs). Frames wait in
+ * their shard's list until all earlier shards are delivered, and a worker
+ * ahead of the delivery point waits while max_pending frames are held, so
+ * the shard being delivered always progresses.
+ */
+typedef struct {
+    s64 key_pts;
+    s64 key_pos;
+    s64 start_pts;          /* frames shown in [start_pts, end_pts) */
+    s64 end_pts;
+    AVFrame **frames;
+    s32 count;
+    s32 capacity;
+    s32 read;
+    s32 done;
+} MyBatchShard;
+
+typedef struct {
+    struct MyBatch *batch;
+    pthread_t thread;
+    MyContext ctx;
+    AVPacket *hold;         /* next shard's keyframe, fed only if pictures before it follow */
+    s32 shard;
+} MyBatchWorker;
+
+struct MyBatch {
+    MyContext settings;
+    const s8 *file_name;
+    s8 *codec_name;
+    MyBatchConfig config;
+    MyBatchShard *shards;
+    s32 nb_shards;
+    atomic_int next_shard;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    s32 deliver;            /* shard being delivered */
+    s32 pending;            /* frames held in all shards */
+    s32 max_pending;
+    s32 error;
+    MyBufferPool bgr_pool;
+};
+
+static s32 batch_shards(struct MyBatch *batch, s32 workers)
+{
+    MyIndexEntry *entries;
+    MyIndexHeader header;
+    s32 gops, count, i, a, b, ret;
+
+    ret = mydecoder_index_scan(batch->file_name, &header, &entries);
+    if (ret < 0)
+        return ret;
+    count = header.count;
+    /* without timestamps the order of frames across shards is unknown */
+    for (i = 0; i < count; i++) {
+        if (AV_NOPTS_VALUE == entries[i].pts)
+            count = 0;
+    }
+
+    gops = batch->config.shard_gops;
+    if (gops <= 0)
+        gops = FFMAX(count / (workers * BATCH_SHARDS_PER_WORKER), 1);
+    batch->nb_shards = count ? (count + gops - 1) / gops : 1;
+    batch->shards = (MyBatchShard *)av_calloc(batch->nb_shards, sizeof(MyBatchShard));
+    if (!batch->shards) {
+        av_free(entries);
+        return AVERROR(ENOMEM);
+    }
+    for (i = 0; i < batch->nb_shards; i++) {
+        MyBatchShard *shard = &batch->shards[i];
+
+        a = i * gops;
+        b = FFMIN(a + gops, count);
+        shard->key_pts = count ? entries[a].pts : AV_NOPTS_VALUE;
+        shard->key_pos = count ? entries[a].pos : -1;
+        shard->start_pts = i ? entries[a].pts : INT64_MIN;
+        shard->end_pts = b < count ? entries[b].pts : INT64_MAX;
+    }
+    av_free(entries);
+    mydecoder_info("batch: %u keyframes, %d shards of %d GOPs\n", header.count,
+                   batch->nb_shards, gops);
+    return 0;
+}
+
+static s32 batch_sink(void *opaque, AVFrame *frame)
+{
+    MyBatchWorker *w = (MyBatchWorker *)opaque;
+    struct MyBatch *batch = w->batch;
+    MyBatchShard *shard = &batch->shards[w->shard];
+    s64 pts = mydecoder_frame_pts(frame);
+    AVFrame *out, **grown;
+    s32 ret;
+
+    if (pts < shard->start_pts || pts >= shard->end_pts)
+        return 0;
+    out = mydecoder_output_frame(w->ctx, frame, &batch->bgr_pool, batch->config.convert);
+    if (!out)
+        return AVERROR(ENOMEM);
+
+    pthread_mutex_lock(&batch->lock);
+    while (batch->pending >= batch->max_pending && w->shard != batch->deliver && !batch->error)
+        pthread_cond_wait(&batch->cond, &batch->lock);
+    /* nothing will be delivered any more, so stop decoding instead of queuing */
+    if (batch->error) {
+        ret = batch->error;
+        pthread_mutex_unlock(&batch->lock);
+        av_frame_free(&out);
+        return ret;
+    }
+    if (shard->count == shard->capacity) {
+        shard->capacity = shard->capacity ? shard->capacity * 2 : 64;
+        grown = (AVFrame **)av_realloc(shard->frames, shard->capacity * sizeof(*grown));
+        if (!grown) {
+            pthread_mutex_unlock(&batch->lock);
+            av_frame_free(&out);
+            return AVERROR(ENOMEM);
+        }
+        shard->frames = grown;
+    }
+    shard->frames[shard->count++] = out;
+    batch->pending++;
+    pthread_cond_broadcast(&batch->cond);
+    pthread_mutex_unlock(&batch->lock);
+    return 0;
+}
+
+/* Packets from the shard's keyframe on, until a frame shown after its end */
+static s32 batch_shard(MyBatchWorker *w)
+{
+    struct MyBatch *batch = w->batch;
+    MyBatchShard *shard = &batch->shards[w->shard];
+    MyContext ctx = w->ctx;
+    AVPacket *pkt = mydecoder_packet_alloc();
+    s32 codec_id, length_size, size, key, ret;
+    s32 boundary = 0;
+    s64 pts;
+
+    if (!pkt)
+        return AVERROR(ENOMEM);
+    /* a fresh context is at the start already */
+    if (w->shard) {
+        ret = mydecoder_seek_input(ctx, shard->key_pos, shard->key_pts);
+        if (ret < 0)
+            goto end;
+    }
+    codec_id = ctx->fmt_ctx->streams[ctx->video_stream_idx]->codecpar->codec_id;
+    length_size = ctx->sample_state.length_size;
+
+    while ((ret = mydecoder_get_packet(ctx, (MyPacket *)&pkt, &size)) >= 0) {
+        if (pkt->stream_index != ctx->video_stream_idx)
+            continue;
+        pts = AV_NOPTS_VALUE != pkt->pts ? pkt->pts : pkt->dts;
+        if (boundary) {
+            if (pts >= shard->end_pts)
+                break;
+            if (w->hold->data) {
+                ret = mydecoder_decode_frames(ctx, w->hold, batch_sink, w);
+                av_packet_unref(w->hold);
+                if (ret < 0)
+                    goto end;
+            }
+        } else if (pts >= shard->end_pts) {
+            key = (pkt->flags & AV_PKT_FLAG_KEY) ||
+                  (mydecoder_nal_flags(codec_id, pkt->data, pkt->size, length_size) &
+                   MYDECODER_NAL_KEY);
+            if (key) {
+                boundary = 1;
+                av_packet_move_ref(w->hold, pkt);
+                continue;
+            }
+        }
+        ret = mydecoder_decode_frames(ctx, pkt, batch_sink, w);
+        if (ret < 0)
+            goto end;
+    }
+    if (ret < 0 && ret != AVERROR_EOF)
+        goto end;
+    ret = mydecoder_decode_frames(ctx, NULL, batch_sink, w);
+
+end:
+    av_packet_unref(w->hold);
+    av_packet_free(&pkt);
+    return ret;
+}
+
+static void *batch_worker(void *arg)
+{
+    MyBatchWorker *w = (MyBatchWorker *)arg;
+    struct MyBatch *batch = w->batch;
+    s32 frame_num, ret = 0;
+
+    w->ctx = mydecoder_context_alloc();
+    w->hold = av_packet_alloc();
+    if (!w->ctx || !w->hold) {
+        ret = AVERROR(ENOMEM);
+    } else {
+        w->ctx->color_matrix = batch->settings->color_matrix;
+        w->ctx->color_range = batch->settings->color_range;
+        w->ctx->resize = batch->settings->resize;
+        ret = mydecoder_open(w->ctx, batch->file_name, batch->codec_name, &frame_num);
+    }
+
+    while (ret >= 0) {
+        w->shard = atomic_fetch_add(&batch->next_shard, 1);
+        if (w->shard >= batch->nb_shards)
+            break;
+        ret = batch_shard(w);
+
+        pthread_mutex_lock(&batch->lock);
+        batch->shards[w->shard].done = 1;
+        /* another worker or the callback failed, the rest is not wanted */
+        if (batch->error && ret >= 0)
+            ret = batch->error;
+        pthread_cond_broadcast(&batch->cond);
+        pthread_mutex_unlock(&batch->lock);
+    }
+
+    if (ret < 0) {
+        pthread_mutex_lock(&batch->lock);
+        if (!batch->error) {
+            mydecoder_err("batch: worker failed with %d\n", ret);
+            batch->error = ret;
+        }
+        pthread_cond_broadcast(&batch->cond);
+        pthread_mutex_unlock(&batch->lock);
+    }
+    av_packet_free(&w->hold);
+    if (w->ctx)
+        mydecoder_close(w->ctx, NULL, NULL);
+    return NULL;
+}
+
+/* On the calling thread: every shard's frames in turn, as they come */
+static s32 batch_deliver(struct MyBatch *batch)
+{
+    MyBatchShard *shard;
+    MyFrameView view;
+    AVFrame *out;
+    s32 delivered = 0;
+
+    pthread_mutex_lock(&batch->lock);
+    while (batch->deliver < batch->nb_shards && !batch->error) {
+        shard = &batch->shards[batch->deliver];
+        if (shard->read < shard->count) {
+            out = shard->frames[shard->read++];
+            batch->pending--;
+            pthread_cond_broadcast(&batch->cond);
+            pthread_mutex_unlock(&batch->lock);
+            mydecoder_fill_view(&view, out);
+            batch->config.callback(batch->config.opaque, &view);
+            delivered++;
+            pthread_mutex_lock(&batch->lock);
+        } else if (shard->done) {
+            av_freep(&shard->frames);
+            batch->deliver++;
+            pthread_cond_broadcast(&batch->cond);
+        } else {
+            pthread_cond_wait(&batch->cond, &batch->lock);
+        }
+    }
+    pthread_mutex_unlock(&batch->lock);
+    batch->config.callback(batch->config.opaque, NULL);
+    return batch->error < 0 ? batch->error : delivered;
+}
+
+s32 mydecoder_batch_decode(MyContext ctx, const s8 *file_name, s8 *codec_name,
+    const MyBatchConfig *config)
+{
+    struct MyBatch batch;
+    MyBatchWorker *workers;
+    s32 cores = sysconf(_SC_NPROCESSORS_ONLN);
+    s32 nb_workers, started, i, j, ret;
+
+    if (!config->callback) {
+        mydecoder_err("No callback given\n");
+        return -1;
+    }
+    memset(&batch, 0, sizeof(batch));
+    batch.settings = ctx;
+    batch.file_name = file_name;
+    batch.codec_name = codec_name;
+    batch.config = *config;
+    batch.max_pending = config->max_pending > 0 ? config->max_pending : BATCH_DEFAULT_PENDING;
+    nb_workers = config->workers > 0 ? config->workers : FFMAX(cores, 1);
+
+    ret = batch_shards(&batch, nb_workers);
+    if (ret < 0)
+        return ret;
+    nb_workers = FFMIN(nb_workers, batch.nb_shards);
+    workers = (MyBatchWorker *)av_calloc(nb_workers, sizeof(MyBatchWorker));
+    if (!workers) {
+        av_free(batch.shards);
+        return AVERROR(ENOMEM);
+    }
+    atomic_init(&batch.next_shard, 0);
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.cond, NULL);
+    mydecoder_pool_init(&batch.bgr_pool);
+
+    /* workers take shards as they go, so any that started finish the file */
+    for (started = 0; started < nb_workers; started++) {
+        workers[started].batch = &batch;
+        ret = pthread_create(&workers[started].thread, NULL, batch_worker, &workers[started]);
+        if (ret) {
+            mydecoder_err("Could only start %d of %d batch workers\n", started, nb_workers);
+            break;
+        }
+    }
+    if (!started)
+        batch.error = AVERROR(ret);
+    ret = batch_deliver(&batch);
+    for (i = 0; i < started; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    /* left over after an error */
+    for (i = 0; i < batch.nb_shards; i++) {
+        for (j = batch.shards[i].read; j < batch.shards[i].count; j++)
+            av_frame_free(&batch.shards[i].frames[j]);
+        av_free(batch.shards[i].frames);
+    }
+    av_free(batch.shards);
+    av_free(workers);
+    mydecoder_pool_uninit(&batch.bgr_pool);
+    pthread_cond_destroy(&batch.cond);
+    pthread_mutex_destroy(&batch.lock);
+    return ret;
+}
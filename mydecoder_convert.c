@@ -0,0 +1,671 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "mydecoder_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MYDECODER_X86    1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MYDECODER_NEON   1
+#endif
+
+#define MULHI16(a, b)    (((a) * (b)) >> 16)
+
+typedef void (*yuv_row_fn)(const u8 *y, const u8 *u, const u8 *v, u8 *const dst[3],
+    MyRgbLayout layout, s32 width, const MyYuvCoeffs *c);
+
+typedef void (*half_fn)(u16 *dst, const float *src, s32 count);
+
+typedef u32 (*sad_fn)(const u8 *a, const u8 *b, s32 count);
+
+typedef struct {
+    const char *isa;
+    yuv_row_fn nv12_row;
+    yuv_row_fn i420_row;
+    half_fn float_to_half;
+    sad_fn sad;
+} MyConvertFuncs;
+
+static MyConvertFuncs convert_funcs_c;
+static MyConvertFuncs convert_funcs_best;
+static pthread_once_t convert_once = PTHREAD_ONCE_INIT;
+static s32 convert_use_c;
+
+void mydecoder_yuv_coeffs(MyYuvCoeffs *coeffs, s32 bt709, s32 full_range)
+{
+    double kr = bt709 ? 0.2126 : 0.299;
+    double kb = bt709 ? 0.0722 : 0.114;
+    double kg = 1.0 - kr - kb;
+    double ys = full_range ? 1.0 : 255.0 / 219.0;
+    double cs = full_range ? 1.0 : 255.0 / 224.0;
+
+    coeffs->y_offset = full_range ? 0 : 16;
+    coeffs->y_coef = (s16)lrint(ys * 8192);
+    coeffs->v_r = (s16)lrint(2 * (1 - kr) * cs * 8192);
+    coeffs->u_g = (s16)lrint(2 * (1 - kb) * kb / kg * cs * 8192);
+    coeffs->v_g = (s16)lrint(2 * (1 - kr) * kr / kg * cs * 8192);
+    coeffs->u_b = (s16)lrint(2 * (1 - kb) * cs * 8192);
+}
+
+static inline u8 clip_q4(s32 v)
+{
+    v = (v + 8) >> 4;
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+/*
+ * Reference kernel, also used for the tail of every SIMD row.
+ * Chroma sample i covers pixels 2i and 2i+1; uv_step is 2 for NV12.
+ * Packed layouts write dst[0], planar ones the B, G and R rows in dst.
+ */
+static void yuv_row_c(const u8 *y, const u8 *u, const u8 *v, s32 uv_step, u8 *const dst[3],
+    MyRgbLayout layout, s32 x, s32 width, const MyYuvCoeffs *c)
+{
+    u8 *b = dst[0], *g = dst[1], *r = dst[2], *a = NULL;
+    s32 step = 1;
+
+    if (MYDECODER_RGB_PLANAR != layout) {
+        step = MYDECODER_RGB_BGRA == layout || MYDECODER_RGB_RGBA == layout ? 4 : 3;
+        b = dst[0];
+        r = dst[0] + 2;
+        if (MYDECODER_RGB_RGB24 == layout || MYDECODER_RGB_RGBA == layout) {
+            r = dst[0];
+            b = dst[0] + 2;
+        }
+        g = dst[0] + 1;
+        if (4 == step)
+            a = dst[0] + 3;
+    }
+
+    for (; x < width; x++) {
+        s32 ci = (x >> 1) * uv_step;
+        s32 yy = MULHI16((y[x] - c->y_offset) * 128, c->y_coef);
+        s32 uu = (u[ci] - 128) * 128;
+        s32 vv = (v[ci] - 128) * 128;
+
+        b[step * x] = clip_q4(yy + MULHI16(uu, c->u_b));
+        g[step * x] = clip_q4(yy - (MULHI16(uu, c->u_g) + MULHI16(vv, c->v_g)));
+        r[step * x] = clip_q4(yy + MULHI16(vv, c->v_r));
+        if (a)
+            a[step * x] = 255;
+    }
+}
+
+static void nv12_row_c(const u8 *y, const u8 *u, const u8 *v, u8 *const dst[3],
+    MyRgbLayout layout, s32 width, const MyYuvCoeffs *c)
+{
+    yuv_row_c(y, u, v, 2, dst, layout, 0, width, c);
+}
+
+static void i420_row_c(const u8 *y, const u8 *u, const u8 *v, u8 *const dst[3],
+    MyRgbLayout layout, s32 width, const MyYuvCoeffs *c)
+{
+    yuv_row_c(y, u, v, 1, dst, layout, 0, width, c);
+}
+
+/* Round to nearest even, overflow to inf, denormals kept */
+static inline u16 half_c(float f)
+{
+    union { u32 u; float f; } in, denorm;
+    u32 sign, out;
+
+    in.f = f;
+    denorm.u = ((127 - 15) + (23 - 10) + 1) << 23;
+    sign = in.u & 0x80000000;
+    in.u ^= sign;
+
+    if (in.u >= 0x47800000) {
+        /* >= 65536: inf, or nan */
+        out = in.u > 0x7f800000 ? 0x7e00 : 0x7c00;
+    } else if (in.u < 0x38800000) {
+        /* half denormal: let the fpu round the mantissa into place */
+        in.f += denorm.f;
+        out = in.u - denorm.u;
+    } else {
+        in.u += ((u32)(15 - 127) << 23) + 0xfff + ((in.u >> 13) & 1);
+        out = in.u >> 13;
+    }
+    return (u16)(out | (sign >> 16));
+}
+
+static void float_to_half_c(u16 *dst, const float *src, s32 count)
+{
+    s32 i;
+
+    for (i = 0; i < count; i++)
+        dst[i] = half_c(src[i]);
+}
+
+static u32 sad_c(const u8 *a, const u8 *b, s32 count)
+{
+    u32 sum = 0;
+    s32 i;
+
+    for (i = 0; i < count; i++)
+        sum += abs(a[i] - b[i]);
+    return sum;
+}
+
+#ifdef MYDECODER_X86
+/* pshufb masks spreading 16 B, G, R bytes over 48 bytes of BGR24 */
+static const s8 bgr24_shuf[9][16] __attribute__((aligned(16))) = {
+    {  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1, -1,  5 },
+    { -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1, 10, -1 },
+    { -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1 },
+    { -1,  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1, -1 },
+    {  5, -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1, 10 },
+    { -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1 },
+    { -1, -1,  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1 },
+    { -1,  5, -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1 },
+    { 10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15 },
+};
+
+__attribute__((target("ssse3")))
+static inline void store_bgr24_ssse3(u8 *dst, __m128i b, __m128i g, __m128i r)
+{
+    const __m128i *m = (const __m128i *)bgr24_shuf;
+    __m128i o0, o1, o2;
+
+    o0 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, _mm_load_si128(m + 0)),
+            _mm_shuffle_epi8(g, _mm_load_si128(m + 3))), _mm_shuffle_epi8(r, _mm_load_si128(m + 6)));
+    o1 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, _mm_load_si128(m + 1)),
+            _mm_shuffle_epi8(g, _mm_load_si128(m + 4))), _mm_shuffle_epi8(r, _mm_load_si128(m + 7)));
+    o2 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, _mm_load_si128(m + 2)),
+            _mm_shuffle_epi8(g, _mm_load_si128(m + 5))), _mm_shuffle_epi8(r, _mm_load_si128(m + 8)));
+    _mm_storeu_si128((__m128i *)dst, o0);
+    _mm_storeu_si128((__m128i *)(dst + 16), o1);
+    _mm_storeu_si128((__m128i *)(dst + 32), o2);
+}
+
+/* 16 pixels with alpha 255, as 64 bytes of B, G, R, A */
+__attribute__((target("ssse3")))
+static inline void store_bgra_ssse3(u8 *dst, __m128i b, __m128i g, __m128i r)
+{
+    const __m128i a = _mm_set1_epi8(-1);
+    __m128i bg_lo = _mm_unpacklo_epi8(b, g), bg_hi = _mm_unpackhi_epi8(b, g);
+    __m128i ra_lo = _mm_unpacklo_epi8(r, a), ra_hi = _mm_unpackhi_epi8(r, a);
+
+    _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(bg_lo, ra_lo));
+    _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(bg_lo, ra_lo));
+    _mm_storeu_si128((__m128i *)(dst + 32), _mm_unpacklo_epi16(bg_hi, ra_hi));
+    _mm_storeu_si128((__m128i *)(dst + 48), _mm_unpackhi_epi16(bg_hi, ra_hi));
+}
+
+/* Pixels x..x+15 of the row in layout */
+__attribute__((target("ssse3")))
+static inline void store16_ssse3(u8 *const dst[3], MyRgbLayout layout, s32 x,
+    __m128i b, __m128i g, __m128i r)
+{
+    switch (layout) {
+    case MYDECODER_RGB_BGR24:
+        store_bgr24_ssse3(dst[0] + 3 * x, b, g, r);
+        break;
+    case MYDECODER_RGB_RGB24:
+        store_bgr24_ssse3(dst[0] + 3 * x, r, g, b);
+        break;
+    case MYDECODER_RGB_BGRA:
+        store_bgra_ssse3(dst[0] + 4 * x, b, g, r);
+        break;
+    case MYDECODER_RGB_RGBA:
+        store_bgra_ssse3(dst[0] + 4 * x, r, g, b);
+        break;
+    default:
+        _mm_storeu_si128((__m128i *)(dst[0] + x), b);
+        _mm_storeu_si128((__m128i *)(dst[1] + x), g);
+        _mm_storeu_si128((__m128i *)(dst[2] + x), r);
+        break;
+    }
+}
+
+/* 16 pixels; u/v hold the 8 chroma samples as 16 bit lanes */
+__attribute__((target("ssse3")))
+static inline void yuv16_ssse3(u8 *const dst[3], MyRgbLayout layout, s32 x, const u8 *y,
+    __m128i u, __m128i v, const MyYuvCoeffs *c)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i yoff = _mm_set1_epi16(c->y_offset);
+    const __m128i ycoef = _mm_set1_epi16(c->y_coef);
+    const __m128i c128 = _mm_set1_epi16(128);
+    const __m128i rnd = _mm_set1_epi16(8);
+    __m128i yv = _mm_loadu_si128((const __m128i *)y);
+    __m128i y0, y1, bu, gu, rv, b, g, r;
+
+    y0 = _mm_unpacklo_epi8(yv, zero);
+    y1 = _mm_unpackhi_epi8(yv, zero);
+    y0 = _mm_add_epi16(_mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(y0, yoff), 7), ycoef), rnd);
+    y1 = _mm_add_epi16(_mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(y1, yoff), 7), ycoef), rnd);
+
+    u = _mm_slli_epi16(_mm_sub_epi16(u, c128), 7);
+    v = _mm_slli_epi16(_mm_sub_epi16(v, c128), 7);
+    bu = _mm_mulhi_epi16(u, _mm_set1_epi16(c->u_b));
+    gu = _mm_add_epi16(_mm_mulhi_epi16(u, _mm_set1_epi16(c->u_g)),
+                       _mm_mulhi_epi16(v, _mm_set1_epi16(c->v_g)));
+    rv = _mm_mulhi_epi16(v, _mm_set1_epi16(c->v_r));
+
+    b = _mm_packus_epi16(_mm_srai_epi16(_mm_add_epi16(y0, _mm_unpacklo_epi16(bu, bu)), 4),
+                         _mm_srai_epi16(_mm_add_epi16(y1, _mm_unpackhi_epi16(bu, bu)), 4));
+    g = _mm_packus_epi16(_mm_srai_epi16(_mm_sub_epi16(y0, _mm_unpacklo_epi16(gu, gu)), 4),
+                         _mm_srai_epi16(_mm_sub_epi16(y1, _mm_unpackhi_epi16(gu, gu)), 4));
+    r = _mm_packus_epi16(_mm_srai_epi16(_mm_add_epi16(y0, _mm_unpacklo_epi16(rv, rv)), 4),
+                         _mm_srai_epi16(_mm_add_epi16(y1, _mm_unpackhi_epi16(rv, rv)), 4));
+    store16_ssse3(dst, layout, x, b, g, r);
+}
+
+__attribute__((target("ssse3")))
+static void nv12_row_ssse3(const u8 *y, const u8 *u, const u8 *v, u8 *const dst[3],
+    MyRgbLayout layout, s32 width, const MyYuvCoeffs *c)
+{
+    const __m128i lo = _mm_set1_epi16(0xff);
+    s32 x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m128i uv = _mm_loadu_si128((const __m128i *)(u + x));
+        yuv16_ssse3(dst, layout, x, y + x, _mm_and_si128(uv, lo), _mm_srli_epi16(uv, 8), c);
+    }
+    yuv_row_c(y, u, v, 2, dst, layout, x, width, c);
+}
+
+__attribute__((target("ssse3")))
+static void i420_row_ssse3(const u8 *y, const u8 *u, const u8 *v, u8 *const dst[3],
+    MyRgbLayout layout, s32 width, const MyYuvCoeffs *c)
+{
+    const __m128i zero = _mm_setzero_si128();
+    s32 x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m128i uu = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(u + x / 2)), zero);
+        __m128i vv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(v + x / 2)), zero);
+        yuv16_ssse3(dst, layout, x, y + x, uu, vv, c);
+    }
+    yuv_row_c(y, u, v, 1, dst, layout, x, width, c);
+}
+
+/* 32 pixels; u/v hold the 16 chroma samples in order */
+__attribute__((target("avx2")))
+static inline void yuv32_avx2(u8 *const dst[3], MyRgbLayout layout, s32 x, const u8 *y,
+    __m256i u, __m256i v, const MyYuvCoeffs *c)
+{
+    const __m256i yoff = _mm256_set1_epi16(c->y_offset);
+    const __m256i ycoef = _mm256_set1_epi16(c->y_coef);
+    const __m256i c128 = _mm256_set1_epi16(128);
+    const __m256i rnd = _mm256_set1_epi16(8);
+    __m256i y0, y1, bu, gu, rv, b, g, r;
+
+    y0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)y));
+    y1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(y + 16)));
+    y0 = _mm256_add_epi16(_mm256_mulhi_epi16(_mm256_slli_epi16(_mm256_sub_epi16(y0, yoff), 7), ycoef), rnd);
+    y1 = _mm256_add_epi16(_mm256_mulhi_epi16(_mm256_slli_epi16(_mm256_sub_epi16(y1, yoff), 7), ycoef), rnd);
+
+    u = _mm256_slli_epi16(_mm256_sub_epi16(u, c128), 7);
+    v = _mm256_slli_epi16(_mm256_sub_epi16(v, c128), 7);
+    bu = _mm256_mulhi_epi16(u, _mm256_set1_epi16(c->u_b));
+    gu = _mm256_add_epi16(_mm256_mulhi_epi16(u, _mm256_set1_epi16(c->u_g)),
+                          _mm256_mulhi_epi16(v, _mm256_set1_epi16(c->v_g)));
+    rv = _mm256_mulhi_epi16(v, _mm256_set1_epi16(c->v_r));
+
+    /* unpack works per 128 bit lane: regroup chroma so lane 0 feeds pixels 0..15 */
+    bu = _mm256_permute4x64_epi64(bu, 0xD8);
+    gu = _mm256_permute4x64_epi64(gu, 0xD8);
+    rv = _mm256_permute4x64_epi64(rv, 0xD8);
+
+    b = _mm256_packus_epi16(_mm256_srai_epi16(_mm256_add_epi16(y0, _mm256_unpacklo_epi16(bu, bu)), 4),
+                            _mm256_srai_epi16(_mm256_add_epi16(y1, _mm256_unpackhi_epi16(bu, bu)), 4));
+    g = _mm256_packus_epi16(_mm256_srai_epi16(_mm256_sub_epi16(y0, _mm256_unpacklo_epi16(gu, gu)), 4),
+                            _mm256_srai_epi16(_mm256_sub_epi16(y1, _mm256_unpackhi_epi16(gu, gu)), 4));
+    r = _mm256_packus_epi16(_mm256_srai_epi16(_mm256_add_epi16(y0, _mm256_unpacklo_epi16(rv, rv)), 4),
+                            _mm256_srai_epi16(_mm256_add_epi16(y1, _mm256_unpackhi_epi16(rv, rv)), 4));
+    b = _mm256_permute4x64_epi64(b, 0xD8);
+    g = _mm256_permute4x64_epi64(g, 0xD8);
+    r = _mm256_permute4x64_epi64(r, 0xD8);
+
+    store16_ssse3(dst, layout, x, _mm256_castsi256_si128(b), _mm256_castsi256_si128(g),
+                  _mm256_castsi256_si128(r));
+    store16_ssse3(dst, layout, x + 16, _mm256_extracti128_si256(b, 1),
+                  _mm256_extracti128_si256(g, 1), _mm256_extracti128_si256(r, 1));
+}
+
+__attribute__((target("avx2")))
+static void nv12_row_avx2(const u8 *y, const u8 *u, const u8 *v, u8 *const dst[3],
+    MyRgbLayout layout, s32 width, const MyYuvCoeffs *c)
+{
+    const __m256i lo = _mm256_set1_epi16(0xff);
+    s32 x;
+
+    for (x = 0; x + 32 <= width; x += 32) {
+        __m256i uv = _mm256_loadu_si256((const __m256i *)(u + x));
+        yuv32_avx2(dst, layout, x, y + x, _mm256_and_si256(uv, lo), _mm256_srli_epi16(uv, 8), c);
+    }
+    yuv_row_c(y, u, v, 2, dst, layout, x, width, c);
+}
+
+__attribute__((target("avx2")))
+static void i420_row_avx2(const u8 *y, const u8 *u, const u8 *v, u8 *const dst[3],
+    MyRgbLayout layout, s32 width, const MyYuvCoeffs *c)
+{
+    s32 x;
+
+    for (x = 0; x + 32 <= width; x += 32) {
+        __m256i uu = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(u + x / 2)));
+        __m256i vv = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(v + x / 2)));
+        yuv32_avx2(dst, layout, x, y + x, uu, vv, c);
+    }
+    yuv_row_c(y, u, v, 1, dst, layout, x, width, c);
+}
+
+__attribute__((target("sse2")))
+static u32 sad_sse2(const u8 *a, const u8 *b, s32 count)
+{
+    __m128i acc = _mm_setzero_si128();
+    s32 i;
+
+    for (i = 0; i + 16 <= count; i += 16) {
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(a + i)),
+                                              _mm_loadu_si128((const __m128i *)(b + i))));
+    }
+    return _mm_cvtsi128_si32(acc) + _mm_extract_epi16(acc, 4) +
+           (_mm_extract_epi16(acc, 5) << 16) + sad_c(a + i, b + i, count - i);
+}
+
+__attribute__((target("avx,f16c")))
+static void float_to_half_f16c(u16 *dst, const float *src, s32 count)
+{
+    s32 i;
+
+    for (i = 0; i + 8 <= count; i += 8) {
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+    for (; i < count; i++)
+        dst[i] = half_c(src[i]);
+}
+#endif
+
+#ifdef MYDECODER_NEON
+static inline int16x8_t mulhi_neon(int16x8_t a, int16x8_t b)
+{
+    int32x4_t lo = vmull_s16(vget_low_s16(a), vget_low_s16(b));
+    int32x4_t hi = vmull_s16(vget_high_s16(a), vget_high_s16(b));
+
+    return vcombine_s16(vshrn_n_s32(lo, 16), vshrn_n_s32(hi, 16));
+}
+
+/* Pixels x..x+15 of the row in layout */
+static inline void store16_neon(u8 *const dst[3], MyRgbLayout layout, s32 x,
+    uint8x16_t b, uint8x16_t g, uint8x16_t r)
+{
+    uint8x16x3_t p3;
+    uint8x16x4_t p4;
+
+    switch (layout) {
+    case MYDECODER_RGB_BGR24:
+    case MYDECODER_RGB_RGB24:
+        p3.val[0] = MYDECODER_RGB_BGR24 == layout ? b : r;
+        p3.val[1] = g;
+        p3.val[2] = MYDECODER_RGB_BGR24 == layout ? r : b;
+        vst3q_u8(dst[0] + 3 * x, p3);
+        break;
+    case MYDECODER_RGB_BGRA:
+    case MYDECODER_RGB_RGBA:
+        p4.val[0] = MYDECODER_RGB_BGRA == layout ? b : r;
+        p4.val[1] = g;
+        p4.val[2] = MYDECODER_RGB_BGRA == layout ? r : b;
+        p4.val[3] = vdupq_n_u8(255);
+        vst4q_u8(dst[0] + 4 * x, p4);
+        break;
+    default:
+        vst1q_u8(dst[0] + x, b);
+        vst1q_u8(dst[1] + x, g);
+        vst1q_u8(dst[2] + x, r);
+        break;
+    }
+}
+
+/* 16 pixels; u/v hold the 8 chroma samples */
+static inline void yuv16_neon(u8 *const dst[3], MyRgbLayout layout, s32 x, const u8 *y,
+    uint8x8_t u8v, uint8x8_t v8v, const MyYuvCoeffs *c)
+{
+    const int16x8_t yoff = vdupq_n_s16(c->y_offset);
+    const int16x8_t ycoef = vdupq_n_s16(c->y_coef);
+    const int16x8_t c128 = vdupq_n_s16(128);
+    const int16x8_t rnd = vdupq_n_s16(8);
+    uint8x16_t yv = vld1q_u8(y);
+    int16x8_t y0, y1, u, v, bu, gu, rv;
+    int16x8x2_t bd, gd, rd;
+    uint8x16_t b, g, r;
+
+    y0 = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(yv)));
+    y1 = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(yv)));
+    y0 = vaddq_s16(mulhi_neon(vshlq_n_s16(vsubq_s16(y0, yoff), 7), ycoef), rnd);
+    y1 = vaddq_s16(mulhi_neon(vshlq_n_s16(vsubq_s16(y1, yoff), 7), ycoef), rnd);
+
+    u = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u8v)), c128), 7);
+    v = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v8v)), c128), 7);
+    bu = mulhi_neon(u, vdupq_n_s16(c->u_b));
+    gu = vaddq_s16(mulhi_neon(u, vdupq_n_s16(c->u_g)), mulhi_neon(v, vdupq_n_s16(c->v_g)));
+    rv = mulhi_neon(v, vdupq_n_s16(c->v_r));
+
+    bd = vzipq_s16(bu, bu);
+    gd = vzipq_s16(gu, gu);
+    rd = vzipq_s16(rv, rv);
+
+    b = vcombine_u8(vqshrun_n_s16(vaddq_s16(y0, bd.val[0]), 4),
+                    vqshrun_n_s16(vaddq_s16(y1, bd.val[1]), 4));
+    g = vcombine_u8(vqshrun_n_s16(vsubq_s16(y0, gd.val[0]), 4),
+                    vqshrun_n_s16(vsubq_s16(y1, gd.val[1]), 4));
+    r = vcombine_u8(vqshrun_n_s16(vaddq_s16(y0, rd.val[0]), 4),
+                    vqshrun_n_s16(vaddq_s16(y1, rd.val[1]), 4));
+    store16_neon(dst, layout, x, b, g, r);
+}
+
+static void nv12_row_neon(const u8 *y, const u8 *u, const u8 *v, u8 *const dst[3],
+    MyRgbLayout layout, s32 width, const MyYuvCoeffs *c)
+{
+    s32 x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        uint8x8x2_t uv = vld2_u8(u + x);
+        yuv16_neon(dst, layout, x, y + x, uv.val[0], uv.val[1], c);
+    }
+    yuv_row_c(y, u, v, 2, dst, layout, x, width, c);
+}
+
+static void i420_row_neon(const u8 *y, const u8 *u, const u8 *v, u8 *const dst[3],
+    MyRgbLayout layout, s32 width, const MyYuvCoeffs *c)
+{
+    s32 x;
+
+    for (x = 0; x + 16 <= width; x += 16)
+        yuv16_neon(dst, layout, x, y + x, vld1_u8(u + x / 2), vld1_u8(v + x / 2), c);
+    yuv_row_c(y, u, v, 1, dst, layout, x, width, c);
+}
+
+static u32 sad_neon(const u8 *a, const u8 *b, s32 count)
+{
+    uint32x4_t acc = vdupq_n_u32(0);
+    uint64x2_t sum;
+    s32 i;
+
+    for (i = 0; i + 16 <= count; i += 16)
+        acc = vpadalq_u16(acc, vpaddlq_u8(vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i))));
+    sum = vpaddlq_u32(acc);
+    return (u32)(vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1)) +
+           sad_c(a + i, b + i, count - i);
+}
+
+#ifdef __aarch64__
+static void float_to_half_neon(u16 *dst, const float *src, s32 count)
+{
+    s32 i;
+
+    for (i = 0; i + 4 <= count; i += 4)
+        vst1_u16(dst + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+    for (; i < count; i++)
+        dst[i] = half_c(src[i]);
+}
+#endif
+#endif
+
+static void convert_init(void)
+{
+    convert_funcs_c.isa = "c";
+    convert_funcs_c.nv12_row = nv12_row_c;
+    convert_funcs_c.i420_row = i420_row_c;
+    convert_funcs_c.float_to_half = float_to_half_c;
+    convert_funcs_c.sad = sad_c;
+    convert_funcs_best = convert_funcs_c;
+
+#ifdef MYDECODER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        convert_funcs_best.sad = sad_sse2;
+    if (__builtin_cpu_supports("ssse3")) {
+        convert_funcs_best.isa = "ssse3";
+        convert_funcs_best.nv12_row = nv12_row_ssse3;
+        convert_funcs_best.i420_row = i420_row_ssse3;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        convert_funcs_best.isa = "avx2";
+        convert_funcs_best.nv12_row = nv12_row_avx2;
+        convert_funcs_best.i420_row = i420_row_avx2;
+    }
+    /* the kernel is 256 bits wide; avx also means the OS saves the YMM registers */
+    if (__builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c"))
+        convert_funcs_best.float_to_half = float_to_half_f16c;
+#endif
+#ifdef MYDECODER_NEON
+    convert_funcs_best.isa = "neon";
+    convert_funcs_best.nv12_row = nv12_row_neon;
+    convert_funcs_best.i420_row = i420_row_neon;
+    convert_funcs_best.sad = sad_neon;
+#ifdef __aarch64__
+    convert_funcs_best.float_to_half = float_to_half_neon;
+#endif
+#endif
+}
+
+static const MyConvertFuncs *convert_funcs(void)
+{
+    pthread_once(&convert_once, convert_init);
+    return convert_use_c ? &convert_funcs_c : &convert_funcs_best;
+}
+
+const char *mydecoder_convert_isa(void)
+{
+    return convert_funcs()->isa;
+}
+
+void mydecoder_convert_force_c(s32 force)
+{
+    convert_use_c = force;
+}
+
+/* Row i of every destination plane */
+static void rgb_rows(u8 *const dst[3], const s32 dst_stride[3], s32 i, u8 *rows[3])
+{
+    s32 p;
+
+    for (p = 0; p < 3; p++)
+        rows[p] = dst[p] ? dst[p] + i * dst_stride[p] : NULL;
+}
+
+void mydecoder_nv12_to_rgb(const u8 *src_y, s32 y_stride, const u8 *src_uv, s32 uv_stride,
+    u8 *const dst[3], const s32 dst_stride[3], MyRgbLayout layout, s32 width, s32 height,
+    const MyYuvCoeffs *coeffs)
+{
+    const MyConvertFuncs *f = convert_funcs();
+    u8 *rows[3];
+    s32 i;
+
+    for (i = 0; i < height; i++) {
+        const u8 *uv = src_uv + (i >> 1) * uv_stride;
+
+        rgb_rows(dst, dst_stride, i, rows);
+        f->nv12_row(src_y + i * y_stride, uv, uv + 1, rows, layout, width, coeffs);
+    }
+}
+
+void mydecoder_i420_to_rgb(const u8 *src_y, s32 y_stride, const u8 *src_u, s32 u_stride,
+    const u8 *src_v, s32 v_stride, u8 *const dst[3], const s32 dst_stride[3],
+    MyRgbLayout layout, s32 width, s32 height, const MyYuvCoeffs *coeffs)
+{
+    const MyConvertFuncs *f = convert_funcs();
+    u8 *rows[3];
+    s32 i;
+
+    for (i = 0; i < height; i++) {
+        rgb_rows(dst, dst_stride, i, rows);
+        f->i420_row(src_y + i * y_stride, src_u + (i >> 1) * u_stride,
+                    src_v + (i >> 1) * v_stride, rows, layout, width, coeffs);
+    }
+}
+
+void mydecoder_nv12_to_bgr24(const u8 *src_y, s32 y_stride, const u8 *src_uv, s32 uv_stride,
+    u8 *dst, s32 dst_stride, s32 width, s32 height, const MyYuvCoeffs *coeffs)
+{
+    u8 *planes[3] = { dst, NULL, NULL };
+    s32 strides[3] = { dst_stride, 0, 0 };
+
+    mydecoder_nv12_to_rgb(src_y, y_stride, src_uv, uv_stride, planes, strides,
+                          MYDECODER_RGB_BGR24, width, height, coeffs);
+}
+
+void mydecoder_i420_to_bgr24(const u8 *src_y, s32 y_stride, const u8 *src_u, s32 u_stride,
+    const u8 *src_v, s32 v_stride, u8 *dst, s32 dst_stride, s32 width, s32 height,
+    const MyYuvCoeffs *coeffs)
+{
+    u8 *planes[3] = { dst, NULL, NULL };
+    s32 strides[3] = { dst_stride, 0, 0 };
+
+    mydecoder_i420_to_rgb(src_y, y_stride, src_u, u_stride, src_v, v_stride, planes, strides,
+                          MYDECODER_RGB_BGR24, width, height, coeffs);
+}
+
+void mydecoder_nv12_row_bgr24(const u8 *src_y, const u8 *src_uv, u8 *dst, s32 width,
+    const MyYuvCoeffs *coeffs)
+{
+    u8 *planes[3] = { dst, NULL, NULL };
+
+    convert_funcs()->nv12_row(src_y, src_uv, src_uv + 1, planes, MYDECODER_RGB_BGR24, width,
+                              coeffs);
+}
+
+void mydecoder_i420_row_bgr24(const u8 *src_y, const u8 *src_u, const u8 *src_v, u8 *dst,
+    s32 width, const MyYuvCoeffs *coeffs)
+{
+    u8 *planes[3] = { dst, NULL, NULL };
+
+    convert_funcs()->i420_row(src_y, src_u, src_v, planes, MYDECODER_RGB_BGR24, width, coeffs);
+}
+
+void mydecoder_uv_interleave(const u8 *src_u, const u8 *src_v, u8 *dst_uv, s32 count)
+{
+    s32 i;
+
+    for (i = 0; i < count; i++) {
+        dst_uv[2 * i] = src_u[i];
+        dst_uv[2 * i + 1] = src_v[i];
+    }
+}
+
+void mydecoder_uv_deinterleave(const u8 *src_uv, u8 *dst_u, u8 *dst_v, s32 count)
+{
+    s32 i;
+
+    for (i = 0; i < count; i++) {
+        dst_u[i] = src_uv[2 * i];
+        dst_v[i] = src_uv[2 * i + 1];
+    }
+}
+
+void mydecoder_float_to_half(u16 *dst, const float *src, s32 count)
+{
+    convert_funcs()->float_to_half(dst, src, count);
+}
+
+u32 mydecoder_sad(const u8 *a, const u8 *b, s32 count)
+{
+    return convert_funcs()->sad(a, b, count);
+}
@@ -0,0 +1,76 @@
+#ifndef _MYDECODER_CONVERT_H_
+#define _MYDECODER_CONVERT_H_
+
+#include "mydecoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * YUV -> RGB matrix in the fixed point form shared by the C and SIMD
+ * kernels: luma/chroma are pre-shifted by 7, multiplied by the Q13
+ * coefficients keeping the high 16 bits, which leaves the result in Q4.
+ */
+typedef struct {
+    s16 y_offset;
+    s16 y_coef;
+    s16 v_r;
+    s16 u_g;
+    s16 v_g;
+    s16 u_b;
+} MyYuvCoeffs;
+
+void mydecoder_yuv_coeffs(MyYuvCoeffs *coeffs, s32 bt709, s32 full_range);
+
+/* Byte order of the RGB outputs; planar writes B, G and R to three planes */
+typedef enum {
+    MYDECODER_RGB_BGR24 = 0,
+    MYDECODER_RGB_RGB24,
+    MYDECODER_RGB_BGRA,         /* alpha 255 */
+    MYDECODER_RGB_RGBA,
+    MYDECODER_RGB_PLANAR,
+} MyRgbLayout;
+
+/* Single pass 4:2:0 -> packed BGR24, no scaling, nearest chroma */
+void mydecoder_nv12_to_bgr24(const u8 *src_y, s32 y_stride, const u8 *src_uv, s32 uv_stride,
+    u8 *dst, s32 dst_stride, s32 width, s32 height, const MyYuvCoeffs *coeffs);
+void mydecoder_i420_to_bgr24(const u8 *src_y, s32 y_stride, const u8 *src_u, s32 u_stride,
+    const u8 *src_v, s32 v_stride, u8 *dst, s32 dst_stride, s32 width, s32 height,
+    const MyYuvCoeffs *coeffs);
+/*
+ * Single pass 4:2:0 -> any RGB layout. Packed layouts use dst[0] and
+ * dst_stride[0]; planar takes the B, G and R planes in that order, so
+ * planar RGB is the same call with dst[0] and dst[2] swapped.
+ */
+void mydecoder_nv12_to_rgb(const u8 *src_y, s32 y_stride, const u8 *src_uv, s32 uv_stride,
+    u8 *const dst[3], const s32 dst_stride[3], MyRgbLayout layout, s32 width, s32 height,
+    const MyYuvCoeffs *coeffs);
+void mydecoder_i420_to_rgb(const u8 *src_y, s32 y_stride, const u8 *src_u, s32 u_stride,
+    const u8 *src_v, s32 v_stride, u8 *const dst[3], const s32 dst_stride[3],
+    MyRgbLayout layout, s32 width, s32 height, const MyYuvCoeffs *coeffs);
+/* One row of the BGR24 ones, for callers that consume the output row by row */
+void mydecoder_nv12_row_bgr24(const u8 *src_y, const u8 *src_uv, u8 *dst, s32 width,
+    const MyYuvCoeffs *coeffs);
+void mydecoder_i420_row_bgr24(const u8 *src_y, const u8 *src_u, const u8 *src_v, u8 *dst,
+    s32 width, const MyYuvCoeffs *coeffs);
+
+/* NV12 <-> I420 chroma rows, count samples per plane */
+void mydecoder_uv_interleave(const u8 *src_u, const u8 *src_v, u8 *dst_uv, s32 count);
+void mydecoder_uv_deinterleave(const u8 *src_uv, u8 *dst_u, u8 *dst_v, s32 count);
+
+/* IEEE half conversion, round to nearest even */
+void mydecoder_float_to_half(u16 *dst, const float *src, s32 count);
+
+/* Sum of absolute differences of two byte rows */
+u32 mydecoder_sad(const u8 *a, const u8 *b, s32 count);
+
+/* Name of the kernel set in use: "c", "ssse3", "avx2" or "neon" */
+const char *mydecoder_convert_isa(void);
+/* Force the plain C kernels (for tests and benchmarks) */
+void mydecoder_convert_force_c(s32 force);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
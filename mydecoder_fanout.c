@@ -0,0 +1,253 @@
+#include <libavutil/hwcontext.h>
+#include <libavutil/mem.h>
+
+#include "mydecoder_internal.h"
+
+#define FANOUT_BAND     16      /* source rows converted at a time, even */
+
+/*
+ * The source is walked once, a band of rows at a time, and every output
+ * takes what it needs from the band while it is in cache. The chroma
+ * upsampling and colour matrix are paid once per source pixel for all the
+ * frame size RGB outputs: the band is converted to BGR24 (into a frame
+ * size BGR24 output when there is one, the frame buffer otherwise) and
+ * the others are repacked from it. Resized outputs resample the YUV
+ * planes and convert only their own pixels, the way retrieve_frame's
+ * fused resize does, so a small output never costs a full size
+ * conversion; each row is emitted once the band holds every source row
+ * its filters read.
+ */
+typedef struct {
+    MyOutFormat format;
+    s32 width;
+    s32 height;
+    u8 *data[4];
+    s32 linesize[4];
+    struct MyScaler *scaler;    /* NULL at the frame size */
+    s32 next_row;               /* resized: first row not written yet */
+} MyFanout;
+
+typedef struct {
+    u8 *src[4];                 /* NV12/I420 planes, or the frame as BGR24 when not yuv */
+    s32 src_linesize[4];
+    s32 yuv;
+    s32 nv12;
+    u8 *bgr[4];                 /* the frame converted, BGR24 */
+    s32 bgr_linesize[4];
+    MyYuvCoeffs coeffs;
+    u8 *line;                   /* one resized row, for the formats other than BGR24 */
+} MyFanoutSource;
+
+static s32 passthrough(MyOutFormat format)
+{
+    return MYDECODER_OUT_NV12 == format || MYDECODER_OUT_I420 == format;
+}
+
+/* Source rows y0..y1 of NV12 or I420 planes into an NV12 or I420 output */
+static void copy_yuv_rows(const MyFanout *o, const MyFanoutSource *s, s32 y0, s32 y1)
+{
+    s32 cw = (o->width + 1) / 2, c1 = (y1 + 1) / 2;
+    s32 y, c;
+
+    for (y = y0; y < y1; y++)
+        memcpy(o->data[0] + y * o->linesize[0], s->src[0] + y * s->src_linesize[0], o->width);
+    for (c = y0 / 2; c < c1; c++) {
+        const u8 *u = s->src[1] + c * s->src_linesize[1];
+        const u8 *v = s->nv12 ? NULL : s->src[2] + c * s->src_linesize[2];
+        u8 *dst_u = o->data[1] + c * o->linesize[1];
+        u8 *dst_v = o->data[2] ? o->data[2] + c * o->linesize[2] : NULL;
+
+        if (s->nv12 && MYDECODER_OUT_NV12 == o->format) {
+            memcpy(dst_u, u, 2 * cw);
+        } else if (!s->nv12 && MYDECODER_OUT_I420 == o->format) {
+            memcpy(dst_u, u, cw);
+            memcpy(dst_v, v, cw);
+        } else if (s->nv12) {
+            mydecoder_uv_deinterleave(u, dst_u, dst_v, cw);
+        } else {
+            mydecoder_uv_interleave(u, v, dst_u, cw);
+        }
+    }
+}
+
+/* What o can take once source rows r0..r1 are converted */
+static void fanout_rows(MyFanout *o, const MyFanoutSource *s, s32 r0, s32 r1)
+{
+    s32 limited = s->coeffs.y_offset != 0;
+    s32 y;
+
+    if (o->scaler) {
+        for (; o->next_row < o->height &&
+               mydecoder_scaler_rows_end(o->scaler, o->next_row) <= r1; o->next_row++) {
+            y = o->next_row;
+            if (MYDECODER_OUT_BGR24 == o->format) {
+                mydecoder_scaler_row(o->scaler, s->src, s->src_linesize, &s->coeffs, y,
+                                     o->data[0] + y * o->linesize[0]);
+                continue;
+            }
+            mydecoder_scaler_row(o->scaler, s->src, s->src_linesize, &s->coeffs, y, s->line);
+            mydecoder_repack_row(o->format, s->line, o->data, o->linesize, y, o->width, limited);
+        }
+        return;
+    }
+
+    if (passthrough(o->format)) {
+        copy_yuv_rows(o, s, r0, r1);
+        return;
+    }
+    for (y = r0; y < r1; y++) {
+        const u8 *row = s->bgr[0] + y * s->bgr_linesize[0];
+
+        if (MYDECODER_OUT_GRAY8 == o->format && s->yuv) {
+            /* the luma plane as decoded, as retrieve_frame has it */
+            memcpy(o->data[0] + y * o->linesize[0], s->src[0] + y * s->src_linesize[0],
+                   o->width);
+        } else if (MYDECODER_OUT_BGR24 == o->format) {
+            if (o->data[0] != s->bgr[0])
+                memcpy(o->data[0] + y * o->linesize[0], row, o->width * 3);
+        } else {
+            mydecoder_repack_row(o->format, row, o->data, o->linesize, y, o->width, limited);
+        }
+    }
+}
+
+/* Whether o reads the converted frame, rather than only the source planes */
+static s32 fanout_needs_bgr(const MyFanout *o, s32 yuv)
+{
+    if (o->scaler || passthrough(o->format))
+        return 0;
+    return !(MYDECODER_OUT_GRAY8 == o->format && yuv);
+}
+
+static s32 retrieve_outputs(MyContext ctx, AVFrame *frame, const MyOutputSpec *outputs,
+    s32 num)
+{
+    MyFanout fan[MYDECODER_OUTPUTS_MAX], *o;
+    MyFanoutSource s;
+    s32 rect[4] = { 0, 0, frame->width, frame->height };
+    s32 format, need_bgr = 0, line = 0, r0, r1, i, ret;
+
+    memset(&s, 0, sizeof(s));
+    ret = mydecoder_scaler_source(ctx, frame, s.src, s.src_linesize, &format);
+    if (ret < 0)
+        return ret;
+    s.yuv = AV_PIX_FMT_BGR24 != format;
+    s.nv12 = AV_PIX_FMT_NV12 == format;
+    /* anything else was converted by swscale already, the frame buffer is it */
+    if (!s.yuv)
+        s.bgr[0] = s.src[0];
+
+    for (i = 0; i < num; i++) {
+        o = &fan[i];
+        o->format = outputs[i].format;
+        o->width = outputs[i].width > 0 ? outputs[i].width : frame->width;
+        o->height = outputs[i].height > 0 ? outputs[i].height : frame->height;
+        o->scaler = NULL;
+        o->next_row = 0;
+        mydecoder_out_planes(o->format, outputs[i].out, o->width, o->height, o->data,
+                             o->linesize);
+        if (o->width != frame->width || o->height != frame->height) {
+            if (passthrough(o->format)) {
+                mydecoder_err("NV12 and I420 outputs are not resized\n");
+                return AVERROR(EINVAL);
+            }
+            o->scaler = mydecoder_scaler_rect(&ctx->out_scalers[i], frame->width,
+                                              frame->height, format, rect, o->width,
+                                              o->height, ctx->resize.interp);
+            if (!o->scaler)
+                return AVERROR(ENOMEM);
+            if (MYDECODER_OUT_BGR24 != o->format)
+                line = FFMAX(line, o->width * 3);
+        } else if (passthrough(o->format) && !s.yuv) {
+            mydecoder_err("NV12 and I420 outputs need a 4:2:0 frame\n");
+            return AVERROR(EINVAL);
+        } else if (MYDECODER_OUT_BGR24 == o->format && !s.bgr[0]) {
+            /* converted straight into the first frame size BGR24 output */
+            s.bgr[0] = o->data[0];
+        }
+        need_bgr |= fanout_needs_bgr(o, s.yuv);
+    }
+
+    if (need_bgr && !s.bgr[0]) {
+        av_fast_malloc(&ctx->frame_buf, &ctx->frame_buf_size, frame->width * frame->height * 3);
+        if (!ctx->frame_buf)
+            return AVERROR(ENOMEM);
+        s.bgr[0] = ctx->frame_buf;
+    }
+    s.bgr_linesize[0] = frame->width * 3;
+    if (line) {
+        av_fast_malloc(&ctx->line_buf, &ctx->line_buf_size, line);
+        if (!ctx->line_buf)
+            return AVERROR(ENOMEM);
+        s.line = ctx->line_buf;
+    }
+
+    mydecoder_frame_coeffs(ctx, frame, &s.coeffs);
+    for (r0 = 0; r0 < frame->height; r0 = r1) {
+        r1 = FFMIN(r0 + FANOUT_BAND, frame->height);
+        if (s.yuv && need_bgr) {
+            if (s.nv12)
+                mydecoder_nv12_to_bgr24(s.src[0] + r0 * s.src_linesize[0], s.src_linesize[0],
+                                        s.src[1] + r0 / 2 * s.src_linesize[1], s.src_linesize[1],
+                                        s.bgr[0] + r0 * s.bgr_linesize[0], s.bgr_linesize[0],
+                                        frame->width, r1 - r0, &s.coeffs);
+            else
+                mydecoder_i420_to_bgr24(s.src[0] + r0 * s.src_linesize[0], s.src_linesize[0],
+                                        s.src[1] + r0 / 2 * s.src_linesize[1], s.src_linesize[1],
+                                        s.src[2] + r0 / 2 * s.src_linesize[2], s.src_linesize[2],
+                                        s.bgr[0] + r0 * s.bgr_linesize[0], s.bgr_linesize[0],
+                                        frame->width, r1 - r0, &s.coeffs);
+        }
+        for (i = 0; i < num; i++)
+            fanout_rows(&fan[i], &s, r0, r1);
+    }
+    return num;
+}
+
+s32 mydecoder_retrieve_outputs(MyContext ctx, MyFrame frame, const MyOutputSpec *outputs,
+    s32 num)
+{
+    AVFrame *avfrm = (AVFrame *)frame;
+    s64 start;
+    s32 i, ret;
+
+    if (num <= 0 || num > MYDECODER_OUTPUTS_MAX)
+        return AVERROR(EINVAL);
+    for (i = 0; i < num; i++) {
+        if (outputs[i].format < MYDECODER_OUT_BGR24 || outputs[i].format > MYDECODER_OUT_I420 ||
+            outputs[i].width < 0 || outputs[i].height < 0 || !outputs[i].out)
+            return AVERROR(EINVAL);
+    }
+
+#ifdef RK_PLAT
+    if (ctx->use_rkmpp)
+        avfrm = mydecoder_ring_peek(ctx);
+#endif
+    if (!avfrm)
+        return -1;
+    if (AV_PIX_FMT_DRM_PRIME == avfrm->format) {
+        if (!ctx->map_frame)
+            ctx->map_frame = av_frame_alloc();
+        if (!ctx->map_frame || av_hwframe_map(ctx->map_frame, avfrm, AV_HWFRAME_MAP_READ) < 0) {
+            mydecoder_err("Could not map DRM_PRIME frame\n");
+            ret = AVERROR(ENOSYS);
+            goto end;
+        }
+        avfrm = ctx->map_frame;
+    }
+
+    start = mydecoder_timer_start(ctx);
+    ret = retrieve_outputs(ctx, avfrm, outputs, num);
+    mydecoder_timer_stop(ctx, MYDECODER_TIMER_CONVERT, start);
+    if (ret >= 0)
+        mydecoder_stat_add(ctx, frames_converted, 1);
+    if (ctx->map_frame)
+        av_frame_unref(ctx->map_frame);
+
+end:
+#ifdef RK_PLAT
+    if (ctx->use_rkmpp)
+        mydecoder_ring_pop(ctx);
+#endif
+    return ret;
+}
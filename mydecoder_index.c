@@ -0,0 +1,501 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libavutil/mem.h>
+
+#include "mydecoder_internal.h"
+
+#define INDEX_MAGIC         "MYDIDX1"
+#define INDEX_VERSION       1
+/* frames decoded past the target, kept for the next request */
+#define SEEK_AHEAD          MAX_BUFFER_FRAMES
+
+/*
+ * Random access state. The GOP decoded last stays in the decoder: cur is
+ * the newest frame at or before the last target and ahead the frames
+ * already decoded past it, so a later target in the same GOP only decodes
+ * what lies between.
+ */
+struct MySeek {
+    void *map;
+    size_t map_size;
+    const MyIndexEntry *entries;
+    s32 count;
+    AVPacket *pkt;
+    AVFrame *cur;
+    AVFrame *ahead[SEEK_AHEAD];
+    s32 ahead_head;
+    s32 ahead_num;
+    s64 target;
+    s32 valid;              /* decoder positioned by a seek */
+    s32 eof;                /* drained, nothing more to read */
+    s32 gop_started;
+    s64 gop_pos;            /* position of the GOP's keyframe, -1 when unknown */
+    s64 gop_end;            /* pts of the next keyframe read, once it was */
+    MyBufferPool bgr_pool;
+};
+
+static s32 index_compare(const void *a, const void *b)
+{
+    const MyIndexEntry *x = (const MyIndexEntry *)a, *y = (const MyIndexEntry *)b;
+
+    return x->pts < y->pts ? -1 : x->pts > y->pts;
+}
+
+static s32 index_write(const s8 *index_file, const MyIndexHeader *header,
+    const MyIndexEntry *entries)
+{
+    char tmp[1040];
+    FILE *f;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", index_file);
+    f = fopen(tmp, "wb");
+    if (!f) {
+        mydecoder_err("Could not write %s\n", tmp);
+        return -1;
+    }
+    if (fwrite(header, sizeof(*header), 1, f) != 1 ||
+        (header->count && fwrite(entries, sizeof(*entries), header->count, f) != header->count)) {
+        fclose(f);
+        remove(tmp);
+        return -1;
+    }
+    if (fclose(f) || rename(tmp, index_file)) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Demux only: the keyframes are told by the packet flag or, for demuxers
+ * that do not set it, by their NAL units, so nothing is decoded. Entries
+ * come out sorted by pts and are freed with av_free().
+ */
+s32 mydecoder_index_scan(const s8 *file_name, MyIndexHeader *header, MyIndexEntry **entries)
+{
+    AVFormatContext *fmt_ctx = NULL;
+    AVPacket *pkt = NULL;
+    MyIndexEntry *grown;
+    AVStream *st = NULL;
+    s32 count = 0, alloc = 0, length_size, key, i, ret;
+
+    *entries = NULL;
+    if (avformat_open_input(&fmt_ctx, file_name, NULL, NULL) < 0) {
+        mydecoder_err("Could not open %s\n", file_name);
+        return -1;
+    }
+    for (i = 0; i < (s32)fmt_ctx->nb_streams; i++) {
+        if (!st && AVMEDIA_TYPE_VIDEO == fmt_ctx->streams[i]->codecpar->codec_type)
+            st = fmt_ctx->streams[i];
+        else
+            fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+    pkt = av_packet_alloc();
+    if (!st || !pkt) {
+        mydecoder_err("No video stream in %s\n", file_name);
+        ret = -1;
+        goto end;
+    }
+    length_size = mydecoder_nal_length_size(st->codecpar);
+
+    while ((ret = av_read_frame(fmt_ctx, pkt)) >= 0) {
+        key = pkt->stream_index == st->index &&
+              ((pkt->flags & AV_PKT_FLAG_KEY) ||
+               (mydecoder_nal_flags(st->codecpar->codec_id, pkt->data, pkt->size,
+                                    length_size) & MYDECODER_NAL_KEY));
+        if (key) {
+            if (count == alloc) {
+                alloc = alloc ? alloc * 2 : 256;
+                grown = (MyIndexEntry *)av_realloc(*entries, alloc * sizeof(**entries));
+                if (!grown) {
+                    ret = AVERROR(ENOMEM);
+                    break;
+                }
+                *entries = grown;
+            }
+            (*entries)[count].pts = AV_NOPTS_VALUE != pkt->pts ? pkt->pts : pkt->dts;
+            (*entries)[count].pos = pkt->pos;
+            count++;
+        }
+        av_packet_unref(pkt);
+    }
+    if (ret != AVERROR_EOF) {
+        mydecoder_err("Error reading %s\n", file_name);
+        av_freep(entries);
+        goto end;
+    }
+    ret = 0;
+
+    qsort(*entries, count, sizeof(**entries), index_compare);
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, INDEX_MAGIC, sizeof(header->magic));
+    header->version = INDEX_VERSION;
+    header->count = count;
+    header->time_base_num = st->time_base.num;
+    header->time_base_den = st->time_base.den;
+    header->file_size = fmt_ctx->pb ? avio_size(fmt_ctx->pb) : -1;
+    header->stream_index = st->index;
+
+end:
+    av_packet_free(&pkt);
+    avformat_close_input(&fmt_ctx);
+    return ret;
+}
+
+s32 mydecoder_index_build(const s8 *file_name, const s8 *index_file)
+{
+    MyIndexEntry *entries;
+    MyIndexHeader header;
+    s32 ret;
+
+    ret = mydecoder_index_scan(file_name, &header, &entries);
+    if (ret < 0)
+        return ret;
+    ret = index_write(index_file, &header, entries);
+    if (!ret)
+        mydecoder_info("%u keyframes indexed\n", header.count);
+    av_free(entries);
+    return ret;
+}
+
+static struct MySeek *seek_get(MyContext ctx)
+{
+    struct MySeek *seek = ctx->seek;
+    s32 i;
+
+    if (seek)
+        return seek;
+    seek = (struct MySeek *)av_mallocz(sizeof(struct MySeek));
+    if (!seek)
+        return NULL;
+    mydecoder_pool_init(&seek->bgr_pool);
+    ctx->seek = seek;
+    seek->pkt = av_packet_alloc();
+    seek->cur = av_frame_alloc();
+    for (i = 0; i < SEEK_AHEAD; i++)
+        seek->ahead[i] = av_frame_alloc();
+    for (i = 0; i < SEEK_AHEAD && seek->ahead[i]; i++)
+        ;
+    if (!seek->pkt || !seek->cur || i < SEEK_AHEAD) {
+        mydecoder_err("Error allocating seek state\n");
+        mydecoder_seek_free(ctx);
+        return NULL;
+    }
+    return seek;
+}
+
+s32 mydecoder_index_load(MyContext ctx, const s8 *index_file)
+{
+    const MyIndexHeader *header;
+    struct MySeek *seek;
+    AVStream *st;
+    struct stat sb;
+    s64 file_size;
+    void *map;
+    s32 fd;
+
+    if (!ctx->fmt_ctx || ctx->video_stream_idx < 0) {
+        mydecoder_err("Context is not open on a file\n");
+        return -1;
+    }
+    seek = seek_get(ctx);
+    if (!seek)
+        return AVERROR(ENOMEM);
+
+    fd = open(index_file, O_RDONLY);
+    if (fd < 0) {
+        mydecoder_err("Could not open %s\n", index_file);
+        return -1;
+    }
+    if (fstat(fd, &sb) < 0 || sb.st_size < (off_t)sizeof(MyIndexHeader)) {
+        close(fd);
+        mydecoder_err("Invalid index %s\n", index_file);
+        return -1;
+    }
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map) {
+        mydecoder_err("Could not map %s\n", index_file);
+        return -1;
+    }
+
+    /* an index of another file, or of an older version of this one, is no use */
+    header = (const MyIndexHeader *)map;
+    st = ctx->fmt_ctx->streams[ctx->video_stream_idx];
+    file_size = ctx->fmt_ctx->pb ? avio_size(ctx->fmt_ctx->pb) : -1;
+    if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) ||
+        header->version != INDEX_VERSION ||
+        (sb.st_size - sizeof(*header)) / sizeof(MyIndexEntry) < header->count ||
+        header->stream_index != st->index ||
+        header->time_base_num != st->time_base.num ||
+        header->time_base_den != st->time_base.den ||
+        (file_size > 0 && header->file_size > 0 && file_size != header->file_size)) {
+        munmap(map, sb.st_size);
+        mydecoder_err("Index %s does not match the open file\n", index_file);
+        return -1;
+    }
+
+    if (seek->map)
+        munmap(seek->map, seek->map_size);
+    seek->map = map;
+    seek->map_size = sb.st_size;
+    seek->entries = (const MyIndexEntry *)(header + 1);
+    seek->count = header->count;
+    return 0;
+}
+
+s32 mydecoder_get_time_base(MyContext ctx, s32 *num, s32 *den)
+{
+    AVRational time_base;
+
+    if (mydecoder_time_base(ctx, &time_base) < 0)
+        return -1;
+    *num = time_base.num;
+    *den = time_base.den;
+    return 0;
+}
+
+/* Position of the last keyframe at or before pts, -1 when unknown */
+static s64 seek_key_pos(MyContext ctx, s64 pts)
+{
+    struct MySeek *seek = ctx->seek;
+    AVStream *st = ctx->fmt_ctx->streams[ctx->video_stream_idx];
+    const AVIndexEntry *entry;
+    s32 lo = 0, hi, mid;
+
+    if (seek->entries) {
+        hi = seek->count;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (seek->entries[mid].pts <= pts)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo ? seek->entries[lo - 1].pos : -1;
+    }
+
+    /* the demuxer's own index, complete for MP4/MKV */
+    mid = av_index_search_timestamp(st, pts, AVSEEK_FLAG_BACKWARD);
+    if (mid < 0)
+        return -1;
+    entry = avformat_index_get_entry(st, mid);
+    return entry ? entry->pos : -1;
+}
+
+s64 mydecoder_frame_pts(const AVFrame *frame)
+{
+    return AV_NOPTS_VALUE != frame->pts ? frame->pts : frame->best_effort_timestamp;
+}
+
+static void seek_reset(struct MySeek *seek)
+{
+    av_frame_unref(seek->cur);
+    while (seek->ahead_num) {
+        av_frame_unref(seek->ahead[seek->ahead_head]);
+        seek->ahead_head = (seek->ahead_head + 1) % SEEK_AHEAD;
+        seek->ahead_num--;
+    }
+    seek->valid = 0;
+}
+
+static s32 seek_sink(void *opaque, AVFrame *frame)
+{
+    struct MySeek *seek = (struct MySeek *)opaque;
+    AVFrame *dst = seek->cur;
+
+    if (mydecoder_frame_pts(frame) > seek->target) {
+        /* the reorder delay is well below this */
+        if (SEEK_AHEAD == seek->ahead_num)
+            return 0;
+        dst = seek->ahead[(seek->ahead_head + seek->ahead_num++) % SEEK_AHEAD];
+    }
+    av_frame_unref(dst);
+    av_frame_move_ref(dst, frame);
+    return 0;
+}
+
+/*
+ * Move the input to the keyframe at pos / pts and get the decoder ready
+ * for it. Byte seek where the demuxer allows it (MPEG-TS and raw streams,
+ * whose timestamp seek is a bisection over the file), timestamp seek
+ * otherwise.
+ */
+s32 mydecoder_seek_input(MyContext ctx, s64 pos, s64 pts)
+{
+    AVFormatContext *fmt_ctx = ctx->fmt_ctx;
+    s32 ret = -1;
+
+    if (pos >= 0 && !(fmt_ctx->iformat->flags & AVFMT_NO_BYTE_SEEK))
+        ret = av_seek_frame(fmt_ctx, ctx->video_stream_idx, pos, AVSEEK_FLAG_BYTE);
+    if (ret < 0)
+        ret = avformat_seek_file(fmt_ctx, ctx->video_stream_idx, INT64_MIN, pts, pts, 0);
+    /* before the first keyframe */
+    if (ret < 0)
+        ret = avformat_seek_file(fmt_ctx, ctx->video_stream_idx, INT64_MIN, pts, INT64_MAX, 0);
+    if (ret < 0) {
+        mydecoder_err("Could not seek to %lld\n", pts);
+        return ret;
+    }
+
+#ifdef RK_PLAT
+    if (ctx->use_rkmpp) {
+        ctx->mpi->reset(ctx->mpp_ctx);
+        while (mydecoder_ring_peek(ctx))
+            mydecoder_ring_pop(ctx);
+    } else
+#endif
+    avcodec_flush_buffers(ctx->dec_ctx);
+    mydecoder_sample_apply(ctx);
+    return 0;
+}
+
+static s32 seek_to(MyContext ctx, s64 pos, s64 pts)
+{
+    struct MySeek *seek = ctx->seek;
+    s32 ret;
+
+    seek_reset(seek);
+    ret = mydecoder_seek_input(ctx, pos, pts);
+    if (ret < 0)
+        return ret;
+    seek->valid = 1;
+    seek->eof = 0;
+    seek->gop_started = 0;
+    seek->gop_pos = -1;
+    seek->gop_end = AV_NOPTS_VALUE;
+    return 0;
+}
+
+/* Decode until a frame past the target comes out or the stream ends */
+static s32 seek_decode(MyContext ctx)
+{
+    struct MySeek *seek = ctx->seek;
+    AVPacket *pkt = seek->pkt;
+    s32 codec_id = ctx->fmt_ctx->streams[ctx->video_stream_idx]->codecpar->codec_id;
+    s32 size, flags, key, ret;
+    s64 pts;
+
+    while (1) {
+        while (seek->ahead_num &&
+               mydecoder_frame_pts(seek->ahead[seek->ahead_head]) <= seek->target) {
+            av_frame_unref(seek->cur);
+            av_frame_move_ref(seek->cur, seek->ahead[seek->ahead_head]);
+            seek->ahead_head = (seek->ahead_head + 1) % SEEK_AHEAD;
+            seek->ahead_num--;
+        }
+        if (seek->ahead_num || seek->eof)
+            return 0;
+
+        ret = mydecoder_get_packet(ctx, (MyPacket *)&seek->pkt, &size);
+        if (AVERROR_EOF == ret) {
+            seek->eof = 1;
+            ret = mydecoder_decode_frames(ctx, NULL, seek_sink, seek);
+            if (ret < 0)
+                return ret;
+            continue;
+        }
+        if (ret < 0)
+            return ret;
+        if (pkt->stream_index != ctx->video_stream_idx)
+            continue;
+
+        pts = AV_NOPTS_VALUE != pkt->pts ? pkt->pts : pkt->dts;
+        flags = mydecoder_nal_flags(codec_id, pkt->data, pkt->size, ctx->sample_state.length_size);
+        key = (pkt->flags & AV_PKT_FLAG_KEY) || (flags & MYDECODER_NAL_KEY);
+        if (key && !seek->gop_started) {
+            seek->gop_started = 1;
+            seek->gop_pos = pkt->pos;
+        } else if (key && AV_NOPTS_VALUE == seek->gop_end) {
+            seek->gop_end = pts;
+        }
+
+        /* a non-reference picture shown before the target is never needed */
+        if (!key && !(flags & MYDECODER_NAL_REF) && AV_NOPTS_VALUE != pts &&
+            pkt->duration > 0 && pts + pkt->duration <= seek->target) {
+            mydecoder_stat_add(ctx, dropped[MYDECODER_DROP_SKIPPED], 1);
+            continue;
+        }
+        ret = mydecoder_decode_frames(ctx, pkt, seek_sink, seek);
+        if (ret < 0)
+            return ret;
+    }
+}
+
+/*
+ * The GOP in the decoder can be carried forward when pts is not before its
+ * current frame and lies in the same GOP: the keyframe found for pts is
+ * the one decoded from, or pts comes before the next keyframe read.
+ */
+static s32 seek_reusable(struct MySeek *seek, s64 pos, s64 pts)
+{
+    if (!seek->valid || (seek->cur->buf[0] && pts < mydecoder_frame_pts(seek->cur)))
+        return 0;
+    if (pos >= 0 && seek->gop_started && pos == seek->gop_pos)
+        return 1;
+    return AV_NOPTS_VALUE != seek->gop_end && pts < seek->gop_end;
+}
+
+s32 mydecoder_get_frame_at(MyContext ctx, s64 pts, s32 convert, MyFrameView *view)
+{
+    struct MySeek *seek;
+    AVFrame *src, *tmp, *out;
+    s64 pos;
+    s32 ret;
+
+    memset(view, 0, sizeof(*view));
+    if (!ctx->fmt_ctx || ctx->video_stream_idx < 0 || ctx->async) {
+        mydecoder_err("Context is not open on a file or runs async\n");
+        return -1;
+    }
+    seek = seek_get(ctx);
+    if (!seek)
+        return AVERROR(ENOMEM);
+
+    pos = seek_key_pos(ctx, pts);
+    if (!seek_reusable(seek, pos, pts)) {
+        ret = seek_to(ctx, pos, pts);
+        if (ret < 0)
+            return ret;
+    }
+    seek->target = pts;
+    ret = seek_decode(ctx);
+    if (ret < 0) {
+        seek_reset(seek);
+        return ret;
+    }
+
+    /* pts before the first frame gets the first frame */
+    src = seek->cur->buf[0] ? seek->cur : seek->ahead_num ? seek->ahead[seek->ahead_head] : NULL;
+    if (!src)
+        return AVERROR_EOF;
+    tmp = av_frame_clone(src);
+    if (!tmp)
+        return AVERROR(ENOMEM);
+    out = mydecoder_output_frame(ctx, tmp, &seek->bgr_pool, convert);
+    av_frame_free(&tmp);
+    if (!out)
+        return AVERROR(ENOMEM);
+    mydecoder_fill_view(view, out);
+    return 0;
+}
+
+void mydecoder_seek_free(MyContext ctx)
+{
+    struct MySeek *seek = ctx->seek;
+    s32 i;
+
+    if (seek->map)
+        munmap(seek->map, seek->map_size);
+    av_packet_free(&seek->pkt);
+    av_frame_free(&seek->cur);
+    for (i = 0; i < SEEK_AHEAD; i++)
+        av_frame_free(&seek->ahead[i]);
+    mydecoder_pool_uninit(&seek->bgr_pool);
+    av_freep(&ctx->seek);
+}
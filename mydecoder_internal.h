@@ -0,0 +1,275 @@
+#ifndef _MYDECODER_INTERNAL_H_
+#define _MYDECODER_INTERNAL_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+#ifdef RK_PLAT
+#include "rockchip/rk_mpi.h"
+#endif
+
+#include "mydecoder.h"
+#include "mydecoder_convert.h"
+
+#define mydecoder_err(fmt, ...)  printf("[mydecoder]err: " fmt, ##__VA_ARGS__)
+#define mydecoder_info(fmt, ...) printf("[mydecoder]info: "fmt, ##__VA_ARGS__)
+#if DEBUG_LOG
+#define mydecoder_dbg(fmt, ...)  printf("[mydecoder]dbg: " fmt, ##__VA_ARGS__)
+#else
+#define mydecoder_dbg(fmt, ...)
+#endif
+
+#define MAX_BUFFER_FRAMES    16
+
+/*
+ * Buffers of one size for one resolution. The pool only grows, so the
+ * number of buffers it ever allocated is its high-water mark; a new
+ * resolution drops the old pool (outstanding buffers die with their refs).
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    AVBufferPool *pool;
+    s32 width;
+    s32 height;
+    s32 format;
+    s32 size;
+    s32 allocated;
+    s32 high_water;
+    s32 resizes;
+} MyBufferPool;
+
+#define MYDECODER_NAL_REF     1
+#define MYDECODER_NAL_RASL    2
+#define MYDECODER_NAL_KEY     4
+
+typedef struct {
+    s32 started;
+    double first_time;      /* stream time of slot 0 */
+    s64 dec_slot;           /* last 1/fps slot a packet was decoded for */
+    s64 out_slot;           /* last slot a frame was returned for */
+    s64 keys;
+    double last_key;
+    double gop;             /* seconds between the last two keyframes */
+    s32 skip_to_key;
+    s32 skip_rasl;          /* leading pictures of the GOP after a skipped one */
+    s64 packets;
+    s32 length_size;
+    s32 wait_key;           /* drop everything before the first IDR */
+} MySampleState;
+
+/*
+ * Every field has a single writer at a time (the thread that reads,
+ * decodes or converts), so relaxed load + store is enough and compiles to
+ * plain moves; atomics only keep snapshots from other threads untorn.
+ */
+typedef struct {
+    atomic_llong count;
+    atomic_llong total_ns;
+    atomic_llong max_ns;
+    atomic_llong buckets[MYDECODER_STATS_BUCKETS];
+} MyTimerState;
+
+typedef struct {
+    s32 timing;
+    atomic_llong packets;
+    atomic_llong bytes;
+    atomic_llong frames_decoded;
+    atomic_llong frames_converted;
+    atomic_llong dropped[MYDECODER_DROP_NB];
+    atomic_llong decode_errors;
+    atomic_int ring_high_water;
+    s64 open_start_ns;
+    atomic_llong open_ns;
+    atomic_llong first_frame_ns;
+    atomic_llong frame_interval_ns;
+    atomic_llong late_frames;
+    MyTimerState timers[MYDECODER_TIMER_NB];
+} MyStatsState;
+
+#define MYDECODER_LIVE_INFLIGHT    32
+
+/* Packets in the decoder, by pts, for the latency of the frames they make */
+typedef struct {
+    MyLiveConfig config;
+    s64 pts[MYDECODER_LIVE_INFLIGHT];
+    s64 in_ns[MYDECODER_LIVE_INFLIGHT];     /* 0 once its frame came out */
+    s32 next;
+    s64 last_pts;                           /* of the last frame out */
+} MyLiveState;
+
+#if MYDECODER_STATS
+#define mydecoder_stat_add(ctx, field, n) \
+    atomic_store_explicit(&(ctx)->stats.field, \
+        atomic_load_explicit(&(ctx)->stats.field, memory_order_relaxed) + (n), \
+        memory_order_relaxed)
+/* 0 when timing is off, which stop takes as nothing to record */
+#define mydecoder_timer_start(ctx) ((ctx)->stats.timing ? mydecoder_now_ns() : 0)
+#define mydecoder_timer_stop(ctx, timer, start) \
+    do { if (start) mydecoder_timer_add(ctx, timer, start); } while (0)
+#define mydecoder_stat_first_frame(ctx) \
+    do { \
+        if (!atomic_load_explicit(&(ctx)->stats.first_frame_ns, memory_order_relaxed)) \
+            atomic_store_explicit(&(ctx)->stats.first_frame_ns, \
+                mydecoder_now_ns() - (ctx)->stats.open_start_ns, memory_order_relaxed); \
+    } while (0)
+#else
+#define mydecoder_stat_add(ctx, field, n) do { } while (0)
+#define mydecoder_timer_start(ctx) 0
+#define mydecoder_timer_stop(ctx, timer, start) ((void)(start))
+#define mydecoder_stat_first_frame(ctx) do { } while (0)
+#endif
+
+/*
+ * Everything one stream needs lives here, so several streams can be
+ * decoded at the same time (one context per thread) without sharing state.
+ */
+struct MyDecoderContext {
+    AVFormatContext *fmt_ctx;
+    AVCodecContext *dec_ctx;
+    s32 video_stream_idx;
+    AVFrame *recv_frame;
+    AVFrame *map_frame;             /* DRM_PRIME frame mapped for conversion */
+    struct SwsContext *img_convert_ctx;
+    struct SwsContext *slice_sws[MYDECODER_CONVERT_THREADS_MAX];   /* one per band */
+    s32 convert_threads;
+    MyColorMatrix color_matrix;
+    MyColorRange color_range;
+    MyResizeConfig resize;
+    MySamplePolicy sample;
+    MyOutFormat out_format;
+    MyFastOpenConfig fast_open;     /* pointers are copies owned by the context */
+    s32 fast;
+    MyLiveState live;
+    MyDecodeQuality quality;
+    s32 quality_shift;              /* output size halvings still left after lowres */
+    MySampleState sample_state;
+    struct MyScaler *scaler;
+    struct MyScaler *roi_scalers[MYDECODER_ROI_MAX];
+    struct MyScaler *out_scalers[MYDECODER_OUTPUTS_MAX];
+    MyBufferPool frame_pool;
+    struct MyAsync *async;
+    struct MyPush *push;
+    struct MySeek *seek;
+    struct MyMotion *motion;
+    struct MyRecord *record;
+    s32 mmap_input;
+    struct MyMmapInput *mmap;
+    MyStatsState stats;
+    /* grow-only scratch for row and whole-frame intermediates */
+    u8 *line_buf;
+    u32 line_buf_size;
+    u8 *frame_buf;
+    u32 frame_buf_size;
+    s32 use_rkmpp;
+#ifdef RK_PLAT
+    MppCtx mpp_ctx;
+    MppApi *mpi;
+    MppPacket mpp_pkt;
+    MppBufferGroup frm_grp;
+    AVFrame *frames[MAX_BUFFER_FRAMES];
+    u32 w_idx;
+    u32 r_idx;
+#endif
+};
+
+void mydecoder_pool_init(MyBufferPool *pool);
+AVBufferRef *mydecoder_pool_get(MyBufferPool *pool, s32 width, s32 height, s32 format, s32 size);
+void mydecoder_pool_uninit(MyBufferPool *pool);
+int mydecoder_get_buffer2(AVCodecContext *avctx, AVFrame *frame, int flags);
+
+/*
+ * Keyframe index sidecar: this header, then count entries sorted by pts,
+ * in host byte order so it can be used straight from the mapping.
+ */
+typedef struct {
+    char magic[8];
+    u32 version;
+    u32 count;
+    s32 time_base_num;
+    s32 time_base_den;
+    s64 file_size;          /* of the indexed file, -1 when unknown */
+    s32 stream_index;
+    s32 reserved;
+} MyIndexHeader;
+
+typedef struct {
+    s64 pts;                /* dts when the packet had no pts */
+    s64 pos;                /* byte offset of the packet, -1 when unknown */
+} MyIndexEntry;
+
+typedef s32 (*MyFrameSink)(void *opaque, AVFrame *frame);
+typedef void (*MySliceFn)(void *arg, s32 band, s32 nb_bands);
+
+s32 mydecoder_async_stop(MyContext ctx);
+void mydecoder_push_free(MyContext ctx);
+void mydecoder_seek_free(MyContext ctx);
+void mydecoder_motion_free(MyContext ctx);
+s32 mydecoder_motion_gate(MyContext ctx, AVFrame *frame);
+void mydecoder_record_packet(MyContext ctx, const AVPacket *pkt);
+s32 mydecoder_mmap_open(MyContext ctx, const s8 *filename);
+void mydecoder_mmap_free(MyContext ctx);
+void mydecoder_fast_open_options(MyContext ctx, AVDictionary **options);
+s32 mydecoder_probe(MyContext ctx, const s8 *url);
+void mydecoder_fast_open_codec(MyContext ctx, AVCodecContext *dec_ctx);
+void mydecoder_fast_open_free(MyContext ctx);
+void mydecoder_live_options(MyContext ctx, AVDictionary **options);
+void mydecoder_live_codec(MyContext ctx, AVCodecContext *dec_ctx);
+void mydecoder_live_in(MyContext ctx, const AVPacket *pkt);
+void mydecoder_live_out(MyContext ctx, const AVFrame *frame);
+void mydecoder_quality_codec(MyContext ctx, AVCodecContext *dec_ctx);
+s32 mydecoder_time_base(MyContext ctx, AVRational *time_base);
+s32 mydecoder_index_scan(const s8 *file_name, MyIndexHeader *header, MyIndexEntry **entries);
+s32 mydecoder_seek_input(MyContext ctx, s64 pos, s64 pts);
+s64 mydecoder_frame_pts(const AVFrame *frame);
+AVFrame *mydecoder_output_frame(MyContext ctx, AVFrame *frame, MyBufferPool *bgr_pool,
+    s32 convert);
+s32 mydecoder_decode_frames(MyContext ctx, AVPacket *pkt, MyFrameSink sink, void *opaque);
+void mydecoder_frame_coeffs(MyContext ctx, const AVFrame *frame, MyYuvCoeffs *coeffs);
+s32 mydecoder_retrieve_avframe(MyContext ctx, AVFrame *avfrm, u8 *out);
+s32 mydecoder_retrieve_frame_sws(MyContext ctx, AVFrame *frame, u8 *bgr_data);
+void mydecoder_output_size(MyContext ctx, const AVFrame *frame, s32 *width, s32 *height);
+void mydecoder_repack_row(MyOutFormat format, const u8 *bgr, u8 *const data[4],
+    const s32 linesize[4], s32 y, s32 width, s32 limited);
+s32 mydecoder_out_av_format(MyOutFormat format);
+void mydecoder_out_planes(MyOutFormat format, u8 *out, s32 width, s32 height,
+    u8 *data[4], s32 linesize[4]);
+
+struct MyScaler *mydecoder_scaler_get(MyContext ctx, s32 src_width, s32 src_height,
+    s32 src_format, s32 width, s32 height);
+void mydecoder_scaler_row(struct MyScaler *scaler, u8 *const data[4], const s32 linesize[4],
+    const MyYuvCoeffs *coeffs, s32 y, u8 *dst);
+struct MyScaler *mydecoder_scaler_rect(struct MyScaler **scaler, s32 src_width, s32 src_height,
+    s32 src_format, const s32 rect[4], s32 width, s32 height, MyInterp interp);
+s32 mydecoder_scaler_source(MyContext ctx, AVFrame *frame, u8 *data[4], s32 linesize[4],
+    s32 *format);
+void mydecoder_scaler_free(struct MyScaler **scaler);
+s32 mydecoder_scaler_rows_end(const struct MyScaler *scaler, s32 y);
+#ifdef RK_PLAT
+s32 mydecoder_rkmpp_init(MyContext ctx);
+AVFrame *mydecoder_ring_peek(MyContext ctx);
+void mydecoder_ring_pop(MyContext ctx);
+#endif
+s32 mydecoder_sample_packet(MyContext ctx, const AVPacket *pkt);
+s32 mydecoder_sample_frame(MyContext ctx, s64 pts);
+void mydecoder_sample_apply(MyContext ctx);
+
+s32 mydecoder_nal_length_size(const AVCodecParameters *par);
+s32 mydecoder_nal_next(const u8 *data, s32 size, s32 length_size, s32 *pos, const u8 **nal);
+s32 mydecoder_nal_flags(s32 codec_id, const u8 *data, s32 size, s32 length_size);
+
+s32 mydecoder_slice_count(MyContext ctx, s32 rows);
+s32 mydecoder_slice_row(s32 rows, s32 band, s32 nb_bands, s32 align);
+void mydecoder_slice_run(MySliceFn fn, void *arg, s32 nb_bands);
+
+s64 mydecoder_now_ns(void);
+void mydecoder_timer_add(MyContext ctx, MyTimer timer, s64 start);
+
+MyPixFmt mydecoder_pix_fmt(s32 av_format);
+/* frame->opaque of a GBRP output frame holding RGB_PLANAR, R, G, B in memory */
+extern const u8 mydecoder_rgb_planar_tag;
+void mydecoder_fill_view(MyFrameView *view, AVFrame *ref);
+
+#endif
@@ -0,0 +1,99 @@
+#include <libavutil/mathematics.h>
+
+#include "mydecoder_internal.h"
+
+#define LIVE_DEFAULT_POLL_US    500
+
+s32 mydecoder_set_live(MyContext ctx, const MyLiveConfig *config)
+{
+    if (!config || !config->enable) {
+        memset(&ctx->live, 0, sizeof(ctx->live));
+        return 0;
+    }
+    if (config->threads < 0 || config->poll_us < 0) {
+        mydecoder_err("Invalid live mode config\n");
+        return -1;
+    }
+    memset(&ctx->live, 0, sizeof(ctx->live));
+    ctx->live.config = *config;
+    if (!ctx->live.config.poll_us)
+        ctx->live.config.poll_us = LIVE_DEFAULT_POLL_US;
+    ctx->live.last_pts = AV_NOPTS_VALUE;
+    return 0;
+}
+
+/* Packets go to the caller as they arrive instead of after probing and reordering */
+void mydecoder_live_options(MyContext ctx, AVDictionary **options)
+{
+    if (!ctx->live.config.enable)
+        return;
+    av_dict_set(options, "fflags", "nobuffer", 0);
+    av_dict_set_int(options, "max_delay", 0, 0);
+}
+
+void mydecoder_live_codec(MyContext ctx, AVCodecContext *dec_ctx)
+{
+    if (!ctx->live.config.enable)
+        return;
+    /* every frame thread holds one frame back, slice threads none */
+    dec_ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    dec_ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+    dec_ctx->thread_type = FF_THREAD_SLICE;
+    dec_ctx->thread_count = ctx->live.config.threads;
+}
+
+/*
+ * Latency of a frame is taken from its packet entering the decoder, found
+ * by pts among the last LIVE_INFLIGHT packets; packets without a pts, and
+ * frames whose packet was already forgotten, are not measured.
+ */
+void mydecoder_live_in(MyContext ctx, const AVPacket *pkt)
+{
+    MyLiveState *live = &ctx->live;
+    s64 pts;
+
+    if (!live->config.enable || !pkt)
+        return;
+    pts = AV_NOPTS_VALUE != pkt->pts ? pkt->pts : pkt->dts;
+    if (AV_NOPTS_VALUE == pts)
+        return;
+    live->pts[live->next] = pts;
+    live->in_ns[live->next] = mydecoder_now_ns();
+    live->next = (live->next + 1) % MYDECODER_LIVE_INFLIGHT;
+}
+
+void mydecoder_live_out(MyContext ctx, const AVFrame *frame)
+{
+    MyLiveState *live = &ctx->live;
+    AVRational time_base;
+    s64 pts, start = 0, latency, interval;
+    s32 i, idx;
+
+    if (!live->config.enable)
+        return;
+    pts = mydecoder_frame_pts(frame);
+    if (AV_NOPTS_VALUE == pts)
+        return;
+    /* newest first, in case a wrapped pts shows up twice */
+    for (i = 1; i <= MYDECODER_LIVE_INFLIGHT && !start; i++) {
+        idx = (live->next + MYDECODER_LIVE_INFLIGHT - i) % MYDECODER_LIVE_INFLIGHT;
+        if (live->in_ns[idx] && live->pts[idx] == pts) {
+            start = live->in_ns[idx];
+            live->in_ns[idx] = 0;
+        }
+    }
+    if (!start)
+        return;
+    latency = mydecoder_now_ns() - start;
+    mydecoder_timer_add(ctx, MYDECODER_TIMER_LATENCY, start);
+
+    /* the frame interval is the pts step from the frame before */
+    if (AV_NOPTS_VALUE != live->last_pts && pts > live->last_pts &&
+        !mydecoder_time_base(ctx, &time_base)) {
+        interval = av_rescale_q(pts - live->last_pts, time_base, av_make_q(1, 1000000000));
+        atomic_store_explicit(&ctx->stats.frame_interval_ns, interval, memory_order_relaxed);
+        if (latency > interval)
+            mydecoder_stat_add(ctx, late_frames, 1);
+    }
+    live->last_pts = pts;
+}
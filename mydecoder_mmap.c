@@ -0,0 +1,176 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libavutil/mem.h>
+
+#include "mydecoder_internal.h"
+
+#define MMAP_AVIO_BUFFER    (64 * 1024)
+#define MMAP_READAHEAD      (8 << 20)   /* hinted ahead of the read position, and kept behind it */
+
+/*
+ * Local file input from a read-only mapping instead of the file protocol.
+ * The AVIOContext is direct, so a demuxer reading a packet gets it copied
+ * straight from the mapping into the packet: one copy where read() plus
+ * the AVIO buffer make two, and no system call per read. Read-ahead is
+ * hinted a window at a time; pages well behind the read position are
+ * released from the mapping (they stay in the page cache) so a multi-GB
+ * file does not pile up in the resident set.
+ */
+struct MyMmapInput {
+    AVIOContext *pb;
+    u8 *data;
+    s64 size;
+    s64 pos;
+    s64 advised;            /* end of the range hinted so far */
+    s64 released;           /* pages before this one were dropped */
+    long page;
+};
+
+s32 mydecoder_set_mmap_input(MyContext ctx, s32 enable)
+{
+    if (ctx->fmt_ctx) {
+        mydecoder_err("mmap input must be set before open\n");
+        return -1;
+    }
+    ctx->mmap_input = !!enable;
+    return 0;
+}
+
+static void mmap_advise(struct MyMmapInput *in)
+{
+    s64 start, end;
+
+    if (in->pos + MMAP_READAHEAD / 2 > in->advised && in->advised < in->size) {
+        start = in->pos & ~(s64)(in->page - 1);
+        end = FFMIN(in->pos + MMAP_READAHEAD, in->size);
+        madvise(in->data + start, end - start, MADV_WILLNEED);
+        in->advised = end;
+    }
+    end = (in->pos - MMAP_READAHEAD) & ~(s64)(in->page - 1);
+    if (end > in->released + MMAP_READAHEAD) {
+        madvise(in->data + in->released, end - in->released, MADV_DONTNEED);
+        in->released = end;
+    }
+}
+
+static int mmap_read(void *opaque, uint8_t *buf, int size)
+{
+    struct MyMmapInput *in = (struct MyMmapInput *)opaque;
+    s64 left = in->size - in->pos;
+
+    if (left <= 0)
+        return AVERROR_EOF;
+    if (size > left)
+        size = (int)left;
+    memcpy(buf, in->data + in->pos, size);
+    in->pos += size;
+    mmap_advise(in);
+    return size;
+}
+
+static int64_t mmap_seek(void *opaque, int64_t offset, int whence)
+{
+    struct MyMmapInput *in = (struct MyMmapInput *)opaque;
+    s64 pos;
+
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return in->size;
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = in->pos + offset;
+        break;
+    case SEEK_END:
+        pos = in->size + offset;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    if (pos < 0 || pos > in->size)
+        return AVERROR(EINVAL);
+    in->pos = pos;
+    /* hint again from the new position, and forget what was dropped before it */
+    in->advised = pos;
+    if (in->released > pos)
+        in->released = pos & ~(s64)(in->page - 1);
+    mmap_advise(in);
+    return pos;
+}
+
+/*
+ * Map filename and give ctx->fmt_ctx an AVIOContext reading from it, for
+ * avformat_open_input() to use. 1 when the input is not a local file (or
+ * mmap input is off) and the normal protocols should open it.
+ */
+s32 mydecoder_mmap_open(MyContext ctx, const s8 *filename)
+{
+    struct MyMmapInput *in;
+    struct stat st;
+    u8 *buffer;
+    s32 fd;
+
+    if (!ctx->mmap_input || strstr(filename, "://"))
+        return 1;
+    if (!strncmp(filename, "file:", 5))
+        filename += 5;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return 1;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || !st.st_size) {
+        close(fd);
+        return 1;
+    }
+    in = (struct MyMmapInput *)av_mallocz(sizeof(struct MyMmapInput));
+    if (!in) {
+        close(fd);
+        return AVERROR(ENOMEM);
+    }
+    in->size = st.st_size;
+    in->page = sysconf(_SC_PAGESIZE);
+    in->data = (u8 *)mmap(NULL, in->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == in->data) {
+        mydecoder_err("Could not map %s, reading it normally\n", filename);
+        av_free(in);
+        return 1;
+    }
+    madvise(in->data, in->size, MADV_SEQUENTIAL);
+
+    buffer = (u8 *)av_malloc(MMAP_AVIO_BUFFER);
+    if (buffer)
+        in->pb = avio_alloc_context(buffer, MMAP_AVIO_BUFFER, 0, in, mmap_read, NULL, mmap_seek);
+    ctx->fmt_ctx = avformat_alloc_context();
+    if (!in->pb || !ctx->fmt_ctx) {
+        if (!in->pb)
+            av_free(buffer);
+        ctx->mmap = in;
+        mydecoder_mmap_free(ctx);
+        avformat_free_context(ctx->fmt_ctx);
+        ctx->fmt_ctx = NULL;
+        return AVERROR(ENOMEM);
+    }
+    in->pb->direct = 1;
+    ctx->fmt_ctx->pb = in->pb;
+    ctx->fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    ctx->mmap = in;
+    return 0;
+}
+
+/* After avformat_close_input(), which leaves a custom AVIOContext alone */
+void mydecoder_mmap_free(MyContext ctx)
+{
+    struct MyMmapInput *in = ctx->mmap;
+
+    if (in->pb) {
+        av_freep(&in->pb->buffer);
+        avio_context_free(&in->pb);
+    }
+    munmap(in->data, in->size);
+    av_freep(&ctx->mmap);
+}
@@ -0,0 +1,257 @@
+#include <libavutil/hwcontext.h>
+#include <libavutil/mem.h>
+
+#include "mydecoder_internal.h"
+
+#define MOTION_DEFAULT_STEP    4
+#define MOTION_MAX_STEP        257     /* step rows of 255 still fit the u16 sums */
+
+/*
+ * Change gate in front of the conversion. The luma plane is averaged over
+ * step x step boxes into a thumbnail, which is compared with the thumbnail
+ * of the last frame let through: the score is the mean absolute difference
+ * (0-255), per grid cell as well. Comparing with the last frame emitted
+ * rather than the previous one lets slow changes add up until they count.
+ */
+struct MyMotion {
+    pthread_mutex_t lock;   /* info is read from other threads */
+    MyMotionConfig config;
+    MyMotionInfo info;
+    u8 *thumb;              /* this frame's */
+    u8 *ref;                /* last emitted frame's */
+    u16 *sums;              /* one row of box sums */
+    s32 width;              /* of the thumbnail */
+    s32 height;
+    s32 has_ref;
+    s32 unchanged;          /* frames held back in a row */
+};
+
+s32 mydecoder_set_motion_gate(MyContext ctx, const MyMotionConfig *config)
+{
+    struct MyMotion *motion;
+
+    if (!config || !config->enable) {
+        if (ctx->motion)
+            mydecoder_motion_free(ctx);
+        return 0;
+    }
+    if (config->grid_cols < 0 || config->grid_rows < 0 ||
+        config->grid_cols * config->grid_rows > MYDECODER_MOTION_GRID_MAX) {
+        mydecoder_err("Invalid change grid %dx%d\n", config->grid_cols, config->grid_rows);
+        return -1;
+    }
+    if (config->step > MOTION_MAX_STEP) {
+        mydecoder_err("Invalid motion step %d, at most %d\n", config->step, MOTION_MAX_STEP);
+        return AVERROR(EINVAL);
+    }
+
+    if (!ctx->motion) {
+        motion = (struct MyMotion *)av_mallocz(sizeof(struct MyMotion));
+        if (!motion) {
+            mydecoder_err("Error allocating motion gate\n");
+            return AVERROR(ENOMEM);
+        }
+        pthread_mutex_init(&motion->lock, NULL);
+        ctx->motion = motion;
+    }
+    motion = ctx->motion;
+    pthread_mutex_lock(&motion->lock);
+    motion->config = *config;
+    if (motion->config.step <= 0)
+        motion->config.step = MOTION_DEFAULT_STEP;
+    /* the grid changes, start over from the next frame */
+    motion->has_ref = 0;
+    motion->unchanged = 0;
+    pthread_mutex_unlock(&motion->lock);
+    return 0;
+}
+
+s32 mydecoder_get_motion(MyContext ctx, MyMotionInfo *info)
+{
+    if (!ctx->motion)
+        return -1;
+    pthread_mutex_lock(&ctx->motion->lock);
+    *info = ctx->motion->info;
+    pthread_mutex_unlock(&ctx->motion->lock);
+    return 0;
+}
+
+/* Box averages of a step-row strip; the width is rounded down to whole boxes */
+static void motion_thumb_row(struct MyMotion *motion, const u8 *src, s32 stride, u8 *dst)
+{
+    s32 step = motion->config.step;
+    s32 width = motion->width * step;
+    s32 area = step * step;
+    s32 x, y;
+
+    /* vertical sums first, a plain loop over whole rows that vectorizes */
+    for (x = 0; x < width; x++)
+        motion->sums[x] = src[x];
+    for (y = 1; y < step; y++) {
+        const u8 *row = src + y * stride;
+
+        for (x = 0; x < width; x++)
+            motion->sums[x] += row[x];
+    }
+    for (x = 0; x < motion->width; x++) {
+        const u16 *box = motion->sums + x * step;
+        s32 i, sum = 0;
+
+        for (i = 0; i < step; i++)
+            sum += box[i];
+        dst[x] = (sum + area / 2) / area;
+    }
+}
+
+static s32 motion_alloc(struct MyMotion *motion, s32 width, s32 height)
+{
+    s32 step = motion->config.step;
+
+    if (motion->thumb && motion->width == width / step && motion->height == height / step)
+        return 0;
+    av_freep(&motion->thumb);
+    av_freep(&motion->ref);
+    av_freep(&motion->sums);
+    motion->width = width / step;
+    motion->height = height / step;
+    motion->has_ref = 0;
+    if (motion->width <= 0 || motion->height <= 0)
+        return -1;
+    motion->thumb = (u8 *)av_malloc(motion->width * motion->height);
+    motion->ref = (u8 *)av_malloc(motion->width * motion->height);
+    motion->sums = (u16 *)av_malloc(motion->width * step * sizeof(u16));
+    if (!motion->thumb || !motion->ref || !motion->sums) {
+        av_freep(&motion->thumb);
+        av_freep(&motion->ref);
+        av_freep(&motion->sums);
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+/*
+ * Score this thumbnail against the reference into info. Each thumbnail row
+ * is split at the grid columns so every cell is one SAD call per row.
+ */
+static void motion_score(struct MyMotion *motion, MyMotionInfo *info)
+{
+    s32 cols = motion->config.grid_cols, rows = motion->config.grid_rows;
+    s32 w = motion->width, h = motion->height;
+    unsigned long long total = 0;
+    unsigned long long cells[MYDECODER_MOTION_GRID_MAX];
+    s32 y, c, r, x0, x1, y0, y1, area;
+    u32 sad;
+
+    if (cols <= 0 || rows <= 0)
+        cols = rows = 1;
+    memset(cells, 0, sizeof(cells));
+    for (y = 0; y < h; y++) {
+        r = y * rows / h;
+        for (c = 0; c < cols; c++) {
+            x0 = c * w / cols;
+            x1 = (c + 1) * w / cols;
+            sad = mydecoder_sad(motion->thumb + y * w + x0, motion->ref + y * w + x0, x1 - x0);
+            cells[r * cols + c] += sad;
+            total += sad;
+        }
+    }
+
+    info->score = (float)total / (w * h);
+    info->grid_cols = motion->config.grid_cols > 0 && motion->config.grid_rows > 0 ? cols : 0;
+    info->grid_rows = info->grid_cols ? rows : 0;
+    for (r = 0; r < info->grid_rows; r++) {
+        y0 = r * h / rows;
+        y1 = (r + 1) * h / rows;
+        for (c = 0; c < cols; c++) {
+            x0 = c * w / cols;
+            x1 = (c + 1) * w / cols;
+            area = (x1 - x0) * (y1 - y0);
+            info->grid[r * cols + c] = area ? (float)cells[r * cols + c] / area : 0;
+        }
+    }
+}
+
+/*
+ * 1 when the frame is unchanged and should be held back, 0 when it goes
+ * on (and becomes the new reference). Frames without an 8-bit luma plane
+ * the gate understands always go on, as does the first of a size.
+ */
+s32 mydecoder_motion_gate(MyContext ctx, AVFrame *frame)
+{
+    struct MyMotion *motion = ctx->motion;
+    MyMotionConfig *config;
+    MyMotionInfo info;
+    AVFrame *src = frame;
+    s32 changed = 1, step, y, i;
+    u8 *swap;
+
+    if (!motion)
+        return 0;
+    if (AV_PIX_FMT_DRM_PRIME == frame->format) {
+        if (!ctx->map_frame)
+            ctx->map_frame = av_frame_alloc();
+        if (!ctx->map_frame || av_hwframe_map(ctx->map_frame, frame, AV_HWFRAME_MAP_READ) < 0)
+            return 0;
+        src = ctx->map_frame;
+    }
+    if (AV_PIX_FMT_YUV420P != src->format && AV_PIX_FMT_YUVJ420P != src->format &&
+        AV_PIX_FMT_NV12 != src->format && AV_PIX_FMT_GRAY8 != src->format)
+        goto end;
+
+    pthread_mutex_lock(&motion->lock);
+    config = &motion->config;
+    step = config->step;
+    if (motion_alloc(motion, src->width, src->height) < 0) {
+        pthread_mutex_unlock(&motion->lock);
+        goto end;
+    }
+    for (y = 0; y < motion->height; y++)
+        motion_thumb_row(motion, src->data[0] + y * step * src->linesize[0], src->linesize[0],
+                         motion->thumb + y * motion->width);
+
+    memset(&info, 0, sizeof(info));
+    info.pts = mydecoder_frame_pts(frame);
+    if (motion->has_ref) {
+        motion_score(motion, &info);
+        changed = info.score >= config->threshold;
+        for (i = 0; !changed && config->cell_threshold > 0 &&
+             i < info.grid_cols * info.grid_rows; i++)
+            changed = info.grid[i] >= config->cell_threshold;
+        if (!changed && config->max_unchanged > 0 && motion->unchanged >= config->max_unchanged)
+            changed = 1;
+    } else {
+        /* nothing to compare with */
+        info.score = 255;
+    }
+    info.changed = changed;
+    motion->info = info;
+
+    if (changed) {
+        swap = motion->ref;
+        motion->ref = motion->thumb;
+        motion->thumb = swap;
+        motion->has_ref = 1;
+        motion->unchanged = 0;
+    } else {
+        motion->unchanged++;
+    }
+    pthread_mutex_unlock(&motion->lock);
+    if (!changed)
+        mydecoder_stat_add(ctx, dropped[MYDECODER_DROP_UNCHANGED], 1);
+
+end:
+    if (src != frame)
+        av_frame_unref(ctx->map_frame);
+    return !changed;
+}
+
+void mydecoder_motion_free(MyContext ctx)
+{
+    struct MyMotion *motion = ctx->motion;
+
+    av_free(motion->thumb);
+    av_free(motion->ref);
+    av_free(motion->sums);
+    pthread_mutex_destroy(&motion->lock);
+    av_freep(&ctx->motion);
+}
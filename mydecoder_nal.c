@@ -0,0 +1,100 @@
+#include "mydecoder_internal.h"
+
+/*
+ * Just enough H.264/HEVC bitstream knowledge to decide about an access
+ * unit before it reaches the decoder. Packets are either Annex B (start
+ * codes, raw streams and MPEG-TS) or length prefixed (MP4/MKV, with the
+ * prefix size taken from avcC/hvcC).
+ */
+
+/* Size of the NAL length prefix, 0 for Annex B */
+s32 mydecoder_nal_length_size(const AVCodecParameters *par)
+{
+    if (!par->extradata || par->extradata_size < 7 || par->extradata[0] != 1)
+        return 0;
+    if (AV_CODEC_ID_H264 == par->codec_id)
+        return (par->extradata[4] & 3) + 1;
+    if (AV_CODEC_ID_HEVC == par->codec_id && par->extradata_size > 21)
+        return (par->extradata[21] & 3) + 1;
+    return 0;
+}
+
+/* Next NAL unit at or after *pos, returns its payload size or -1 at the end */
+s32 mydecoder_nal_next(const u8 *data, s32 size, s32 length_size, s32 *pos, const u8 **nal)
+{
+    s32 i = *pos, start, len;
+
+    if (length_size) {
+        if (i + length_size > size)
+            return -1;
+        for (len = 0; length_size--; i++)
+            len = (len << 8) | data[i];
+        if (len <= 0 || len > size - i)
+            return -1;
+        *nal = data + i;
+        *pos = i + len;
+        return len;
+    }
+
+    for (; i + 3 <= size; i++) {
+        if (!data[i] && !data[i + 1] && data[i + 2] == 1)
+            break;
+    }
+    if (i + 3 > size)
+        return -1;
+    start = i + 3;
+    for (i = start; i + 3 <= size; i++) {
+        if (!data[i] && !data[i + 1] && data[i + 2] <= 1)
+            break;
+    }
+    if (i + 3 > size)
+        i = size;
+    *nal = data + start;
+    *pos = i;
+    return i - start;
+}
+
+/*
+ * MYDECODER_NAL_REF when some slice of the access unit may be referenced
+ * by later pictures, MYDECODER_NAL_RASL for HEVC leading pictures that
+ * need the previous GOP, MYDECODER_NAL_KEY for IDR/IRAP pictures. Unknown
+ * codecs count as reference.
+ */
+s32 mydecoder_nal_flags(s32 codec_id, const u8 *data, s32 size, s32 length_size)
+{
+    const u8 *nal;
+    s32 pos = 0, len, type, flags = 0, slices = 0;
+
+    if (AV_CODEC_ID_H264 != codec_id && AV_CODEC_ID_HEVC != codec_id)
+        return MYDECODER_NAL_REF;
+
+    while ((len = mydecoder_nal_next(data, size, length_size, &pos, &nal)) >= 0) {
+        if (len < 2)
+            continue;
+        if (AV_CODEC_ID_H264 == codec_id) {
+            type = nal[0] & 0x1f;
+            if (type != 1 && type != 5)
+                continue;
+            slices++;
+            if (nal[0] & 0x60)
+                flags |= MYDECODER_NAL_REF;
+            if (type == 5)
+                flags |= MYDECODER_NAL_KEY;
+        } else {
+            type = (nal[0] >> 1) & 0x3f;
+            if (type > 21)
+                continue;
+            slices++;
+            /* sub-layer non-reference pictures have even types up to 14 */
+            if (type > 14 || (type & 1))
+                flags |= MYDECODER_NAL_REF;
+            if (type == 8 || type == 9)
+                flags |= MYDECODER_NAL_RASL;
+            if (type >= 16)
+                flags |= MYDECODER_NAL_KEY;
+        }
+    }
+
+    /* nothing recognisable, do not risk dropping it */
+    return slices ? flags : MYDECODER_NAL_REF;
+}
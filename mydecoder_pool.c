@@ -0,0 +1,112 @@
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/version.h>
+
+#include "mydecoder_internal.h"
+
+/* Line and buffer alignment, enough for every SIMD path in avcodec and ours */
+#define POOL_ALIGN    64
+
+#if LIBAVUTIL_VERSION_MAJOR < 57
+typedef int pool_size_t;
+#else
+typedef size_t pool_size_t;
+#endif
+
+void mydecoder_pool_init(MyBufferPool *pool)
+{
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+}
+
+/* Called by AVBufferPool, with its lock held, only when it has no free buffer */
+static AVBufferRef *mydecoder_pool_alloc(void *opaque, pool_size_t size)
+{
+    MyBufferPool *pool = (MyBufferPool *)opaque;
+    AVBufferRef *buf = av_buffer_alloc(size);
+
+    if (buf) {
+        pool->allocated++;
+        if (pool->allocated > pool->high_water)
+            pool->high_water = pool->allocated;
+        mydecoder_dbg("pool %dx%d: %d buffers of %d bytes\n",
+                      pool->width, pool->height, pool->allocated, pool->size);
+    }
+    return buf;
+}
+
+AVBufferRef *mydecoder_pool_get(MyBufferPool *pool, s32 width, s32 height, s32 format, s32 size)
+{
+    AVBufferRef *buf = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->pool || pool->width != width || pool->height != height ||
+        pool->format != format || pool->size != size) {
+        if (pool->pool) {
+            av_buffer_pool_uninit(&pool->pool);
+            pool->resizes++;
+        }
+        pool->width = width;
+        pool->height = height;
+        pool->format = format;
+        pool->size = size;
+        pool->allocated = 0;
+        pool->pool = av_buffer_pool_init2(size, pool, mydecoder_pool_alloc, NULL);
+    }
+    if (pool->pool)
+        buf = av_buffer_pool_get(pool->pool);
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!buf)
+        mydecoder_err("Error allocating %d byte frame buffer\n", size);
+    return buf;
+}
+
+void mydecoder_pool_uninit(MyBufferPool *pool)
+{
+    av_buffer_pool_uninit(&pool->pool);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+/*
+ * avcodec get_buffer2 callback: decoded pictures come out of the context
+ * pool, one buffer per picture, with 64 byte aligned planes and lines.
+ */
+int mydecoder_get_buffer2(AVCodecContext *avctx, AVFrame *frame, int flags)
+{
+    MyContext ctx = (MyContext)avctx->opaque;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    s32 linesize_align[AV_NUM_DATA_POINTERS];
+    s32 linesize[4];
+    u8 *data[4];
+    s32 w = frame->width;
+    s32 h = frame->height;
+    s32 size, i;
+    u8 *base;
+
+    if (!(avctx->codec->capabilities & AV_CODEC_CAP_DR1) || avctx->hw_frames_ctx ||
+        !desc || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL))
+        return avcodec_default_get_buffer2(avctx, frame, flags);
+
+    avcodec_align_dimensions2(avctx, &w, &h, linesize_align);
+    if (av_image_fill_linesizes(linesize, frame->format, w) < 0)
+        return avcodec_default_get_buffer2(avctx, frame, flags);
+    for (i = 0; i < 4; i++)
+        linesize[i] = FFALIGN(linesize[i], POOL_ALIGN);
+    size = av_image_fill_pointers(data, frame->format, h, NULL, linesize);
+    if (size < 0)
+        return size;
+
+    frame->buf[0] = mydecoder_pool_get(&ctx->frame_pool, frame->width, frame->height,
+                                       frame->format, size + 16 + 2 * POOL_ALIGN);
+    if (!frame->buf[0])
+        return AVERROR(ENOMEM);
+
+    base = (u8 *)FFALIGN((uintptr_t)frame->buf[0]->data, POOL_ALIGN);
+    av_image_fill_pointers(frame->data, frame->format, h, base, linesize);
+    for (i = 0; i < 4; i++)
+        frame->linesize[i] = linesize[i];
+    frame->extended_data = frame->data;
+
+    return 0;
+}
@@ -0,0 +1,210 @@
+#include <stdio.h>
+
+#include <libavutil/mem.h>
+
+#include "mydecoder_internal.h"
+
+#define FAST_PROBESIZE      32768
+#define FAST_ANALYZE_US     500000
+
+s32 mydecoder_set_fast_open(MyContext ctx, const MyFastOpenConfig *config)
+{
+    const MyStreamParams *params = &config->params;
+
+    if (params->extradata_size < 0 || (params->extradata_size && !params->extradata)) {
+        mydecoder_err("Invalid extradata\n");
+        return -1;
+    }
+    mydecoder_fast_open_free(ctx);
+    ctx->fast_open = *config;
+    ctx->fast_open.cache_dir = NULL;
+    ctx->fast_open.params.extradata = NULL;
+    ctx->fast_open.params.extradata_size = 0;
+    if (config->cache_dir)
+        ctx->fast_open.cache_dir = av_strdup(config->cache_dir);
+    if (params->extradata_size) {
+        u8 *extradata = (u8 *)av_mallocz(params->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+
+        if (extradata) {
+            memcpy(extradata, params->extradata, params->extradata_size);
+            ctx->fast_open.params.extradata = extradata;
+            ctx->fast_open.params.extradata_size = params->extradata_size;
+        }
+    }
+    if ((config->cache_dir && !ctx->fast_open.cache_dir) ||
+        (params->extradata_size && !ctx->fast_open.params.extradata)) {
+        mydecoder_fast_open_free(ctx);
+        return AVERROR(ENOMEM);
+    }
+    ctx->fast = 1;
+    return 0;
+}
+
+void mydecoder_fast_open_free(MyContext ctx)
+{
+    av_freep(&ctx->fast_open.cache_dir);
+    av_freep(&ctx->fast_open.params.extradata);
+    ctx->fast_open.params.extradata_size = 0;
+    ctx->fast = 0;
+}
+
+/* Caps on what avformat_open_input and find_stream_info read */
+void mydecoder_fast_open_options(MyContext ctx, AVDictionary **options)
+{
+    if (!ctx->fast)
+        return;
+    av_dict_set_int(options, "probesize",
+                    ctx->fast_open.probesize > 0 ? ctx->fast_open.probesize : FAST_PROBESIZE, 0);
+    av_dict_set_int(options, "analyzeduration",
+                    ctx->fast_open.analyze_us > 0 ? ctx->fast_open.analyze_us : FAST_ANALYZE_US, 0);
+}
+
+void mydecoder_fast_open_codec(MyContext ctx, AVCodecContext *dec_ctx)
+{
+    if (!ctx->fast || !ctx->fast_open.low_delay)
+        return;
+    /* frame threads hold back one frame per thread */
+    dec_ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    dec_ctx->thread_type = FF_THREAD_SLICE;
+}
+
+/* One file per URL, named by its FNV-1a hash */
+static void cache_path(MyContext ctx, const s8 *url, char *path, s32 size)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+
+    for (; *url; url++)
+        hash = (hash ^ (u8)*url) * 1099511628211ULL;
+    snprintf(path, size, "%s/%016llx.params", ctx->fast_open.cache_dir, hash);
+}
+
+/*
+ * A text line "codec_id width height pix_fmt extradata_size" and the
+ * extradata in hex on the next one.
+ */
+static s32 cache_load(MyContext ctx, const s8 *url, MyStreamParams *params, u8 **extradata)
+{
+    char path[1024];
+    FILE *f;
+    s32 i, byte;
+
+    if (!ctx->fast_open.cache_dir)
+        return -1;
+    cache_path(ctx, url, path, sizeof(path));
+    f = fopen(path, "r");
+    if (!f)
+        return -1;
+    memset(params, 0, sizeof(*params));
+    if (fscanf(f, "%d %d %d %d %d", &params->codec_id, &params->width, &params->height,
+               &params->pix_fmt, &params->extradata_size) != 5 ||
+        params->extradata_size < 0 || params->extradata_size > (1 << 20)) {
+        fclose(f);
+        return -1;
+    }
+    *extradata = (u8 *)av_mallocz(params->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!*extradata) {
+        fclose(f);
+        return -1;
+    }
+    for (i = 0; i < params->extradata_size; i++) {
+        if (fscanf(f, "%2x", &byte) != 1) {
+            av_freep(extradata);
+            fclose(f);
+            return -1;
+        }
+        (*extradata)[i] = byte;
+    }
+    params->extradata = *extradata;
+    fclose(f);
+    return 0;
+}
+
+static void cache_save(MyContext ctx, const s8 *url, const AVCodecParameters *par)
+{
+    char path[1024], tmp[1040];
+    FILE *f;
+    s32 i;
+
+    if (!ctx->fast_open.cache_dir)
+        return;
+    cache_path(ctx, url, path, sizeof(path));
+    /* renamed into place, so a reader never sees half a file */
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    f = fopen(tmp, "w");
+    if (!f) {
+        mydecoder_err("Could not write %s\n", tmp);
+        return;
+    }
+    fprintf(f, "%d %d %d %d %d\n", par->codec_id, par->width, par->height, par->format,
+            par->extradata_size);
+    for (i = 0; i < par->extradata_size; i++)
+        fprintf(f, "%02x", par->extradata[i]);
+    fprintf(f, "\n");
+    if (fclose(f) || rename(tmp, path))
+        remove(tmp);
+}
+
+static s32 video_stream(AVFormatContext *fmt_ctx)
+{
+    s32 i;
+
+    for (i = 0; i < (s32)fmt_ctx->nb_streams; i++) {
+        if (AVMEDIA_TYPE_VIDEO == fmt_ctx->streams[i]->codecpar->codec_type)
+            return i;
+    }
+    return -1;
+}
+
+/* Fill in what the demuxer did not find in its header */
+static s32 apply_params(AVCodecParameters *par, const MyStreamParams *params)
+{
+    if (AV_CODEC_ID_NONE == par->codec_id)
+        par->codec_id = params->codec_id;
+    else if (params->codec_id && par->codec_id != (enum AVCodecID)params->codec_id)
+        return -1;
+    if (!par->width || !par->height) {
+        par->width = params->width;
+        par->height = params->height;
+    }
+    if (par->format < 0 && params->pix_fmt >= 0)
+        par->format = params->pix_fmt;
+    if (!par->extradata_size && params->extradata_size) {
+        par->extradata = (u8 *)av_mallocz(params->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (!par->extradata)
+            return AVERROR(ENOMEM);
+        memcpy(par->extradata, params->extradata, params->extradata_size);
+        par->extradata_size = params->extradata_size;
+    }
+    return 0;
+}
+
+/*
+ * Stream parameters after avformat_open_input: probed as before without
+ * fast open, probed within the caps otherwise (and cached for the next
+ * time), or taken from the caller or the cache when probing is skipped.
+ */
+s32 mydecoder_probe(MyContext ctx, const s8 *url)
+{
+    AVFormatContext *fmt_ctx = ctx->fmt_ctx;
+    MyStreamParams params;
+    u8 *extradata = NULL;
+    s32 idx, ret = -1;
+
+    if (ctx->fast && ctx->fast_open.skip_probe && (idx = video_stream(fmt_ctx)) >= 0) {
+        AVCodecParameters *par = fmt_ctx->streams[idx]->codecpar;
+
+        params = ctx->fast_open.params;
+        if (params.codec_id || !cache_load(ctx, url, &params, &extradata))
+            ret = apply_params(par, &params);
+        av_free(extradata);
+        if (!ret && AV_CODEC_ID_NONE != par->codec_id && par->width && par->height) {
+            mydecoder_info("stream parameters given, not probing\n");
+            return 0;
+        }
+    }
+
+    ret = avformat_find_stream_info(fmt_ctx, NULL);
+    if (ctx->fast && ret >= 0 && (idx = video_stream(fmt_ctx)) >= 0)
+        cache_save(ctx, url, fmt_ctx->streams[idx]->codecpar);
+    return ret;
+}
@@ -0,0 +1,260 @@
+#include <libavutil/mem.h>
+
+#include "mydecoder_internal.h"
+
+#define PUSH_DEFAULT_TIME_BASE    90000
+
+/*
+ * Elementary stream input. Without a demuxer the bytes go through the
+ * codec's parser to be cut into access units, or straight to the decoder
+ * when the caller already frames them; rkmpp splits the stream itself.
+ * Frames come out through the same sink as the scheduler's.
+ */
+struct MyPush {
+    MyPushConfig config;
+    AVCodecParserContext *parser;
+    AVPacket *pkt;
+    MyBufferPool bgr_pool;
+};
+
+s32 mydecoder_time_base(MyContext ctx, AVRational *time_base)
+{
+    if (ctx->fmt_ctx && ctx->video_stream_idx >= 0) {
+        *time_base = ctx->fmt_ctx->streams[ctx->video_stream_idx]->time_base;
+        return 0;
+    }
+    if (ctx->push) {
+        time_base->num = ctx->push->config.time_base_num;
+        time_base->den = ctx->push->config.time_base_den;
+        return 0;
+    }
+    return -1;
+}
+
+s32 mydecoder_open_push(MyContext ctx, s8 *codec_name, const MyPushConfig *config)
+{
+    const AVCodec *codec;
+    struct MyPush *push;
+    s32 ret;
+
+    if (ctx->fmt_ctx || ctx->push || !config->callback) {
+        mydecoder_err("Context is already open or no callback given\n");
+        return -1;
+    }
+
+    ctx->stats.open_start_ns = mydecoder_now_ns();
+    push = (struct MyPush *)av_mallocz(sizeof(struct MyPush));
+    if (!push) {
+        mydecoder_err("Error allocating push input\n");
+        return AVERROR(ENOMEM);
+    }
+    push->config = *config;
+    if (config->time_base_num <= 0 || config->time_base_den <= 0) {
+        push->config.time_base_num = 1;
+        push->config.time_base_den = PUSH_DEFAULT_TIME_BASE;
+    }
+    mydecoder_pool_init(&push->bgr_pool);
+    ctx->push = push;
+    push->pkt = av_packet_alloc();
+    if (!push->pkt) {
+        mydecoder_err("Error allocating packet\n");
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+#ifdef RK_PLAT
+    if (!strcmp(codec_name, "rkmpp")) {
+        /* MPP_DEC_SET_PARSER_SPLIT_MODE takes the stream in any chunks */
+        ctx->use_rkmpp = 1;
+        mydecoder_sample_apply(ctx);
+        return mydecoder_rkmpp_init(ctx);
+    }
+#endif
+
+    codec = avcodec_find_decoder_by_name(codec_name);
+    if (!codec) {
+        mydecoder_err("Codec not found codec\n");
+        ret = -1;
+        goto fail;
+    }
+    ctx->dec_ctx = avcodec_alloc_context3(codec);
+    if (!ctx->dec_ctx) {
+        mydecoder_err("Could not allocate video codec context\n");
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    ctx->dec_ctx->opaque = ctx;
+    ctx->dec_ctx->get_buffer2 = mydecoder_get_buffer2;
+    ctx->dec_ctx->pkt_timebase = av_make_q(push->config.time_base_num,
+                                           push->config.time_base_den);
+    mydecoder_live_codec(ctx, ctx->dec_ctx);
+    mydecoder_quality_codec(ctx, ctx->dec_ctx);
+    if (avcodec_open2(ctx->dec_ctx, codec, NULL) < 0) {
+        mydecoder_err("Could not open codec\n");
+        ret = -1;
+        goto fail;
+    }
+
+    if (!config->framed) {
+        push->parser = av_parser_init(codec->id);
+        if (!push->parser) {
+            mydecoder_err("No parser for %s\n", codec_name);
+            ret = -1;
+            goto fail;
+        }
+    }
+    mydecoder_sample_apply(ctx);
+    return 0;
+
+fail:
+    /* back to closed, so the context can be opened again */
+    avcodec_free_context(&ctx->dec_ctx);
+    mydecoder_push_free(ctx);
+    return ret;
+}
+
+static s32 push_sink(void *opaque, AVFrame *frame)
+{
+    MyContext ctx = (MyContext)opaque;
+    struct MyPush *push = ctx->push;
+    MyFrameView view;
+    AVFrame *out;
+
+    if (mydecoder_motion_gate(ctx, frame))
+        return 0;
+    out = mydecoder_output_frame(ctx, frame, &push->bgr_pool, push->config.convert);
+    if (!out)
+        return 0;
+    mydecoder_fill_view(&view, out);
+    push->config.callback(push->config.opaque, &view);
+    return 0;
+}
+
+static void push_release(void *opaque, u8 *data)
+{
+    struct MyPush *push = (struct MyPush *)opaque;
+
+    push->config.release(push->config.opaque, data);
+}
+
+/*
+ * One access unit (or MPP chunk) to the decoder, key < 0 to look for an
+ * IDR in it. With *borrow the packet references data itself; *borrow is
+ * cleared when that failed and the data was copied after all.
+ */
+static s32 push_packet(MyContext ctx, const u8 *data, s32 size, s64 pts, s32 key, s32 *borrow)
+{
+    struct MyPush *push = ctx->push;
+    AVPacket *pkt = push->pkt;
+    s32 ret;
+
+    av_packet_unref(pkt);
+    if (borrow && *borrow) {
+        pkt->buf = av_buffer_create((u8 *)data, size + MYDECODER_PUSH_PADDING,
+                                    push_release, push, AV_BUFFER_FLAG_READONLY);
+        *borrow = !!pkt->buf;
+    }
+    /* without buf the packet is not refcounted and the decoder copies it */
+    pkt->data = (u8 *)data;
+    pkt->size = size;
+    pkt->pts = pts;
+    if (key < 0) {
+        s32 codec_id = ctx->dec_ctx ? ctx->dec_ctx->codec_id : AV_CODEC_ID_H264;
+
+        key = !!(mydecoder_nal_flags(codec_id, data, size, 0) & MYDECODER_NAL_KEY);
+    }
+    if (key)
+        pkt->flags |= AV_PKT_FLAG_KEY;
+
+    ret = mydecoder_decode_frames(ctx, pkt, push_sink, ctx);
+    av_packet_unref(pkt);
+    return ret;
+}
+
+static s32 push_flush(MyContext ctx)
+{
+    struct MyPush *push = ctx->push;
+    u8 *out;
+    s32 out_size;
+
+    if (push->parser) {
+        av_parser_parse2(push->parser, ctx->dec_ctx, &out, &out_size, NULL, 0,
+                         AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+        if (out_size)
+            push_packet(ctx, out, out_size, push->parser->pts, push->parser->key_frame == 1, NULL);
+    }
+    mydecoder_decode_frames(ctx, NULL, push_sink, ctx);
+    push->config.callback(push->config.opaque, NULL);
+
+    /* ready for the next stream, e.g. after the source reconnects */
+#ifdef RK_PLAT
+    if (ctx->use_rkmpp) {
+        ctx->mpi->reset(ctx->mpp_ctx);
+        return 0;
+    }
+#endif
+    avcodec_flush_buffers(ctx->dec_ctx);
+    return 0;
+}
+
+s32 mydecoder_push_data(MyContext ctx, const u8 *data, s32 size, s64 pts)
+{
+    struct MyPush *push = ctx->push;
+    const u8 *buf = data;
+    u8 *out;
+    s32 out_size, len, ret = 0;
+
+    if (!push) {
+        mydecoder_err("Context is not open for push input\n");
+        return -1;
+    }
+    if (!data || size <= 0)
+        return push_flush(ctx);
+
+    mydecoder_stat_add(ctx, packets, 1);
+    mydecoder_stat_add(ctx, bytes, size);
+
+    if (!push->parser) {
+        s32 borrow = push->config.release && !ctx->use_rkmpp;
+
+        ret = push_packet(ctx, data, size, pts, -1, &borrow);
+        /* released with the last reference instead */
+        if (borrow)
+            return ret;
+    } else {
+        while (size > 0) {
+            len = av_parser_parse2(push->parser, ctx->dec_ctx, &out, &out_size, data, size,
+                                   pts, pts, 0);
+            if (len < 0) {
+                mydecoder_err("Error parsing pushed data\n");
+                ret = len;
+                break;
+            }
+            data += len;
+            size -= len;
+            /* the pts belongs to the access unit that starts in this push */
+            pts = AV_NOPTS_VALUE;
+            if (out_size) {
+                ret = push_packet(ctx, out, out_size, push->parser->pts,
+                                  push->parser->key_frame == 1, NULL);
+                if (ret < 0)
+                    break;
+            }
+        }
+    }
+
+    /* everything the decoder keeps has been copied by now */
+    if (push->config.release)
+        push->config.release(push->config.opaque, buf);
+    return ret;
+}
+
+void mydecoder_push_free(MyContext ctx)
+{
+    struct MyPush *push = ctx->push;
+
+    av_parser_close(push->parser);
+    av_packet_free(&push->pkt);
+    mydecoder_pool_uninit(&push->bgr_pool);
+    av_freep(&ctx->push);
+}
@@ -0,0 +1,41 @@
+#include "mydecoder_internal.h"
+
+s32 mydecoder_set_decode_quality(MyContext ctx, MyDecodeQuality quality)
+{
+    if (ctx->fmt_ctx || ctx->dec_ctx) {
+        mydecoder_err("Decode quality must be set before open\n");
+        return -1;
+    }
+    if (quality < MYDECODER_QUALITY_FULL || quality > MYDECODER_QUALITY_FASTEST) {
+        mydecoder_err("Invalid decode quality %d\n", quality);
+        return -1;
+    }
+    ctx->quality = quality;
+    /* lowres, when the decoder has it, takes this over at open */
+    ctx->quality_shift = MYDECODER_QUALITY_FASTEST == quality;
+    return 0;
+}
+
+/*
+ * Non-reference frames are what the cheap knobs are for: nothing is
+ * predicted from them, so a blocky one is never copied into the frames
+ * after it. Skipping the loop filter on reference frames too (FASTER)
+ * lets blocking drift until the next keyframe.
+ */
+void mydecoder_quality_codec(MyContext ctx, AVCodecContext *dec_ctx)
+{
+    if (ctx->quality >= MYDECODER_QUALITY_FAST) {
+        dec_ctx->skip_loop_filter = AVDISCARD_NONREF;
+        dec_ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+    }
+    if (ctx->quality >= MYDECODER_QUALITY_FASTER) {
+        dec_ctx->skip_loop_filter = AVDISCARD_ALL;
+        dec_ctx->skip_idct = AVDISCARD_NONREF;
+    }
+    if (ctx->quality >= MYDECODER_QUALITY_FASTEST && dec_ctx->codec &&
+        dec_ctx->codec->max_lowres > 0) {
+        /* the decoder outputs half size frames, retrieve_frame keeps them */
+        dec_ctx->lowres = 1;
+        ctx->quality_shift = 0;
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef _MYDECODER_QUEUE_H_
+#define _MYDECODER_QUEUE_H_
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include <libavutil/mem.h>
+
+#include "mydecoder.h"
+
+/*
+ * Bounded single-producer single-consumer ring of pointers. Lock-free:
+ * head is only written by the consumer and tail only by the producer,
+ * each on its own cache line.
+ */
+typedef struct {
+    void **slots;
+    u32 mask;
+    atomic_uint head __attribute__((aligned(64)));
+    atomic_uint tail __attribute__((aligned(64)));
+} MySpscQueue;
+
+static inline s32 mydecoder_queue_init(MySpscQueue *q, u32 depth)
+{
+    u32 size = 1;
+
+    while (size < depth)
+        size <<= 1;
+    q->slots = (void **)av_calloc(size, sizeof(void *));
+    if (!q->slots)
+        return -1;
+    q->mask = size - 1;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    return 0;
+}
+
+static inline void mydecoder_queue_uninit(MySpscQueue *q)
+{
+    av_freep(&q->slots);
+}
+
+/* Producer side: -1 when full */
+static inline s32 mydecoder_queue_push(MySpscQueue *q, void *item)
+{
+    u32 tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    u32 head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+    if (tail - head > q->mask)
+        return -1;
+    q->slots[tail & q->mask] = item;
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+/* Consumer side: -1 when empty */
+static inline s32 mydecoder_queue_pop(MySpscQueue *q, void **item)
+{
+    u32 head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    u32 tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+    if (head == tail)
+        return -1;
+    *item = q->slots[head & q->mask];
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return 0;
+}
+
+/* Approximate, for statistics */
+static inline u32 mydecoder_queue_count(MySpscQueue *q)
+{
+    return atomic_load_explicit(&q->tail, memory_order_relaxed) -
+           atomic_load_explicit(&q->head, memory_order_relaxed);
+}
+
+/* Wait step for a stage whose queue is full or empty: spin, yield, then sleep */
+static inline void mydecoder_backoff(u32 *spins)
+{
+    if (*spins < 16) {
+        (*spins)++;
+    } else if (*spins < 64) {
+        (*spins)++;
+        sched_yield();
+    } else {
+        usleep(200);
+    }
+}
+
+#endif
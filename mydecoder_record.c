@@ -0,0 +1,316 @@
+#include <stdio.h>
+
+#include <libavutil/mathematics.h>
+#include <libavutil/mem.h>
+
+#include "mydecoder_internal.h"
+#include "mydecoder_queue.h"
+
+#define RECORD_QUEUE_DEPTH      1024
+#define RECORD_DEFAULT_KB       8192
+
+/*
+ * Packets read for decoding are also muxed into segment files by a writer
+ * thread. The reading thread only clones the packet into a bounded queue;
+ * when the writer falls behind (a slow or stalled disk) packets are dropped
+ * instead, up to the next video keyframe, so a gap never leaves a segment
+ * with frames that reference missing ones. Segments start on keyframes.
+ */
+struct MyRecord {
+    MyRecordConfig config;          /* path is a copy owned by the recorder */
+    pthread_t thread;
+    atomic_int stop;
+    MySpscQueue queue;
+    atomic_llong queued_bytes;
+    s64 max_bytes;
+    s32 wait_key;                   /* reader side: drop until a video keyframe */
+    /* input streams, -1 in map for the ones not recorded */
+    s32 nb_streams;
+    s32 *map;
+    AVCodecParameters **par;
+    AVRational *time_base;
+    s32 video_idx;
+    /* writer side */
+    AVFormatContext *oc;
+    s64 segment_start;              /* video pts the segment started at */
+    s32 segment;
+    atomic_llong segments;
+    atomic_llong packets;
+    atomic_llong bytes;
+    atomic_llong dropped;
+};
+
+static const char *record_format_names[] = { "mp4", "mpegts" };
+static const char *record_format_exts[] = { "mp4", "ts" };
+
+static void record_close_segment(struct MyRecord *rec)
+{
+    if (!rec->oc)
+        return;
+    if (av_write_trailer(rec->oc) < 0)
+        mydecoder_err("Error finishing recording segment %d\n", rec->segment - 1);
+    avio_closep(&rec->oc->pb);
+    avformat_free_context(rec->oc);
+    rec->oc = NULL;
+}
+
+static s32 record_open_segment(struct MyRecord *rec)
+{
+    MyRecordFormat format = rec->config.format;
+    AVDictionary *options = NULL;
+    AVStream *st;
+    char path[1024];
+    s32 i, ret;
+
+    snprintf(path, sizeof(path), "%s_%05d.%s", rec->config.path, rec->segment,
+             record_format_exts[format]);
+    ret = avformat_alloc_output_context2(&rec->oc, NULL, record_format_names[format], path);
+    if (ret < 0)
+        return ret;
+    for (i = 0; i < rec->nb_streams; i++) {
+        if (rec->map[i] < 0)
+            continue;
+        st = avformat_new_stream(rec->oc, NULL);
+        if (!st || avcodec_parameters_copy(st->codecpar, rec->par[i]) < 0) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+        /* the tag of the source container may mean nothing in this one */
+        st->codecpar->codec_tag = 0;
+        st->time_base = rec->time_base[i];
+    }
+    ret = avio_open(&rec->oc->pb, path, AVIO_FLAG_WRITE);
+    if (ret < 0) {
+        mydecoder_err("Could not open %s\n", path);
+        goto fail;
+    }
+    /* fragments on keyframes, so a segment cut short by a crash still plays */
+    if (MYDECODER_RECORD_MP4 == format)
+        av_dict_set(&options, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+    ret = avformat_write_header(rec->oc, &options);
+    av_dict_free(&options);
+    if (ret < 0) {
+        mydecoder_err("Could not write the header of %s\n", path);
+        avio_closep(&rec->oc->pb);
+        goto fail;
+    }
+    rec->segment++;
+    atomic_fetch_add(&rec->segments, 1);
+    return 0;
+
+fail:
+    avformat_free_context(rec->oc);
+    rec->oc = NULL;
+    return ret;
+}
+
+static void record_write(struct MyRecord *rec, AVPacket *pkt)
+{
+    s32 in = pkt->stream_index;
+    s32 key = in == rec->video_idx && (pkt->flags & AV_PKT_FLAG_KEY);
+    s64 pts = AV_NOPTS_VALUE != pkt->pts ? pkt->pts : pkt->dts;
+    s32 size = pkt->size;
+
+    if (key && AV_NOPTS_VALUE != pts) {
+        /* a new segment on the first keyframe past its length */
+        if (rec->oc && rec->config.segment_sec > 0 &&
+            av_rescale_q(pts - rec->segment_start, rec->time_base[in], av_make_q(1, 1)) >=
+            rec->config.segment_sec)
+            record_close_segment(rec);
+        if (!rec->oc) {
+            if (record_open_segment(rec) < 0) {
+                atomic_fetch_add(&rec->dropped, 1);
+                return;
+            }
+            rec->segment_start = pts;
+        }
+    }
+    if (!rec->oc) {
+        /* after a failed segment, until the next keyframe */
+        atomic_fetch_add(&rec->dropped, 1);
+        return;
+    }
+
+    pkt->stream_index = rec->map[in];
+    av_packet_rescale_ts(pkt, rec->time_base[in], rec->oc->streams[pkt->stream_index]->time_base);
+    pkt->pos = -1;
+    if (av_interleaved_write_frame(rec->oc, pkt) < 0) {
+        mydecoder_err("Error writing recording segment %d\n", rec->segment - 1);
+        record_close_segment(rec);
+        atomic_fetch_add(&rec->dropped, 1);
+        return;
+    }
+    atomic_fetch_add(&rec->packets, 1);
+    atomic_fetch_add(&rec->bytes, size);
+}
+
+static void *record_thread(void *arg)
+{
+    struct MyRecord *rec = (struct MyRecord *)arg;
+    AVPacket *pkt;
+    u32 spins = 0;
+    s32 stopping = 0;
+
+    while (1) {
+        if (mydecoder_queue_pop(&rec->queue, (void **)&pkt) < 0) {
+            if (stopping)
+                break;
+            /*
+             * The reader may have pushed its last packets between the
+             * failed pop and stop: every push came before stop was set,
+             * so one more empty pop after seeing it means all are written.
+             */
+            if (atomic_load(&rec->stop)) {
+                stopping = 1;
+                continue;
+            }
+            mydecoder_backoff(&spins);
+            continue;
+        }
+        spins = 0;
+        atomic_fetch_sub(&rec->queued_bytes, pkt->size);
+        record_write(rec, pkt);
+        av_packet_free(&pkt);
+    }
+    record_close_segment(rec);
+    return NULL;
+}
+
+static void record_free(struct MyRecord *rec)
+{
+    AVPacket *pkt;
+    s32 i;
+
+    if (rec->par) {
+        for (i = 0; i < rec->nb_streams; i++)
+            avcodec_parameters_free(&rec->par[i]);
+    }
+    av_free(rec->par);
+    av_free(rec->map);
+    av_free(rec->time_base);
+    av_free((void *)rec->config.path);
+    /* queued but never written, e.g. when the writer thread did not start */
+    if (rec->queue.slots) {
+        while (!mydecoder_queue_pop(&rec->queue, (void **)&pkt))
+            av_packet_free(&pkt);
+    }
+    mydecoder_queue_uninit(&rec->queue);
+    av_free(rec);
+}
+
+s32 mydecoder_record_start(MyContext ctx, const MyRecordConfig *config)
+{
+    AVFormatContext *fmt_ctx = ctx->fmt_ctx;
+    struct MyRecord *rec;
+    s32 i, type, nb = 0;
+
+    if (!fmt_ctx || ctx->record || !config->path ||
+        config->format < MYDECODER_RECORD_MP4 || config->format > MYDECODER_RECORD_MPEGTS ||
+        config->segment_sec < 0 || config->max_buffer_kb < 0) {
+        mydecoder_err("Context is not open from a file, already recording or bad config\n");
+        return -1;
+    }
+
+    rec = (struct MyRecord *)av_mallocz(sizeof(struct MyRecord));
+    if (!rec)
+        return AVERROR(ENOMEM);
+    rec->config = *config;
+    rec->config.path = av_strdup(config->path);
+    rec->nb_streams = fmt_ctx->nb_streams;
+    rec->map = (s32 *)av_calloc(rec->nb_streams, sizeof(s32));
+    rec->par = (AVCodecParameters **)av_calloc(rec->nb_streams, sizeof(AVCodecParameters *));
+    rec->time_base = (AVRational *)av_calloc(rec->nb_streams, sizeof(AVRational));
+    if (!rec->config.path || !rec->map || !rec->par || !rec->time_base ||
+        mydecoder_queue_init(&rec->queue, RECORD_QUEUE_DEPTH) < 0)
+        goto fail;
+
+    /* video and audio only, data streams rarely survive a change of container */
+    for (i = 0; i < rec->nb_streams; i++) {
+        type = fmt_ctx->streams[i]->codecpar->codec_type;
+        rec->map[i] = -1;
+        if (AVMEDIA_TYPE_VIDEO != type && AVMEDIA_TYPE_AUDIO != type)
+            continue;
+        if (AVMEDIA_TYPE_VIDEO == type && i != ctx->video_stream_idx)
+            continue;
+        rec->par[i] = avcodec_parameters_alloc();
+        if (!rec->par[i] || avcodec_parameters_copy(rec->par[i], fmt_ctx->streams[i]->codecpar) < 0)
+            goto fail;
+        rec->time_base[i] = fmt_ctx->streams[i]->time_base;
+        rec->map[i] = nb++;
+    }
+    rec->video_idx = ctx->video_stream_idx;
+    rec->max_bytes = (config->max_buffer_kb ? config->max_buffer_kb : RECORD_DEFAULT_KB) * 1024LL;
+    rec->wait_key = 1;
+    atomic_init(&rec->stop, 0);
+
+    if (pthread_create(&rec->thread, NULL, record_thread, rec)) {
+        mydecoder_err("Could not start recording thread\n");
+        goto fail;
+    }
+    ctx->record = rec;
+    return 0;
+
+fail:
+    record_free(rec);
+    return AVERROR(ENOMEM);
+}
+
+/* Reader side, right after av_read_frame(); never waits for the writer */
+void mydecoder_record_packet(MyContext ctx, const AVPacket *pkt)
+{
+    struct MyRecord *rec = ctx->record;
+    AVPacket *copy;
+
+    if (!rec || pkt->stream_index >= rec->nb_streams || rec->map[pkt->stream_index] < 0)
+        return;
+    if (rec->wait_key) {
+        if (pkt->stream_index != rec->video_idx || !(pkt->flags & AV_PKT_FLAG_KEY)) {
+            atomic_fetch_add(&rec->dropped, 1);
+            return;
+        }
+        rec->wait_key = 0;
+    }
+    if (atomic_load_explicit(&rec->queued_bytes, memory_order_relaxed) + pkt->size >
+        rec->max_bytes || !(copy = av_packet_clone(pkt))) {
+        rec->wait_key = 1;
+        atomic_fetch_add(&rec->dropped, 1);
+        return;
+    }
+    atomic_fetch_add(&rec->queued_bytes, copy->size);
+    if (mydecoder_queue_push(&rec->queue, copy) < 0) {
+        atomic_fetch_sub(&rec->queued_bytes, copy->size);
+        av_packet_free(&copy);
+        rec->wait_key = 1;
+        atomic_fetch_add(&rec->dropped, 1);
+    }
+}
+
+s32 mydecoder_record_stop(MyContext ctx, MyRecordStats *stats)
+{
+    struct MyRecord *rec = ctx->record;
+
+    if (!rec)
+        return -1;
+    /* the writer drains what is queued and finishes the segment */
+    atomic_store(&rec->stop, 1);
+    pthread_join(rec->thread, NULL);
+    if (stats)
+        mydecoder_get_record_stats(ctx, stats);
+    ctx->record = NULL;
+    record_free(rec);
+    return 0;
+}
+
+s32 mydecoder_get_record_stats(MyContext ctx, MyRecordStats *stats)
+{
+    struct MyRecord *rec = ctx->record;
+
+    if (!rec)
+        return -1;
+    stats->segments = atomic_load(&rec->segments);
+    stats->packets = atomic_load(&rec->packets);
+    stats->bytes = atomic_load(&rec->bytes);
+    stats->dropped = atomic_load(&rec->dropped);
+    stats->buffered_kb = (s32)(atomic_load(&rec->queued_bytes) / 1024);
+    return 0;
+}
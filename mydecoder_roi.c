@@ -0,0 +1,131 @@
+#include <libavutil/hwcontext.h>
+#include <libavutil/mem.h>
+
+#include "mydecoder_internal.h"
+
+/*
+ * Every region gets a scaler of its own, so regions are independent and
+ * run in parallel: the scalers are set up on the calling thread, then
+ * each band of the slice pool converts a run of whole regions.
+ */
+typedef struct {
+    MyContext ctx;
+    const MyRoi *rois;
+    s32 num;
+    u8 *data[4];
+    s32 linesize[4];
+    MyYuvCoeffs coeffs;
+    u8 **out;               /* start of every region in the output */
+} MyRoiJob;
+
+static void roi_band(void *arg, s32 band, s32 nb)
+{
+    MyRoiJob *job = (MyRoiJob *)arg;
+    s32 first = mydecoder_slice_row(job->num, band, nb, 1);
+    s32 last = mydecoder_slice_row(job->num, band + 1, nb, 1);
+    const MyRoi *roi;
+    s32 i, y;
+
+    for (i = first; i < last; i++) {
+        roi = &job->rois[i];
+        if (!job->ctx->roi_scalers[i]) {
+            /* nothing of the frame in it */
+            memset(job->out[i], 0, roi->out_width * roi->out_height * 3);
+            continue;
+        }
+        for (y = 0; y < roi->out_height; y++)
+            mydecoder_scaler_row(job->ctx->roi_scalers[i], job->data, job->linesize,
+                                 &job->coeffs, y, job->out[i] + y * roi->out_width * 3);
+    }
+}
+
+/* The region clipped to the frame, on whole chroma samples; 0 when nothing is left */
+static s32 roi_rect(const MyRoi *roi, const AVFrame *frame, s32 rect[4])
+{
+    s32 x0 = FFMAX(roi->x, 0) & ~1, y0 = FFMAX(roi->y, 0) & ~1;
+    s32 x1 = FFMIN(roi->x + roi->width, frame->width);
+    s32 y1 = FFMIN(roi->y + roi->height, frame->height);
+
+    rect[0] = x0;
+    rect[1] = y0;
+    rect[2] = x1 - x0;
+    rect[3] = y1 - y0;
+    return rect[2] > 0 && rect[3] > 0;
+}
+
+static s32 retrieve_rois(MyContext ctx, AVFrame *frame, const MyRoi *rois, s32 num, u8 *out)
+{
+    u8 *starts[MYDECODER_ROI_MAX];
+    MyRoiJob job;
+    s32 rect[4], format, i, ret;
+
+    ret = mydecoder_scaler_source(ctx, frame, job.data, job.linesize, &format);
+    if (ret < 0)
+        return ret;
+    for (i = 0; i < num; i++) {
+        starts[i] = out;
+        out += rois[i].out_width * rois[i].out_height * 3;
+        if (!roi_rect(&rois[i], frame, rect)) {
+            mydecoder_scaler_free(&ctx->roi_scalers[i]);
+            continue;
+        }
+        if (!mydecoder_scaler_rect(&ctx->roi_scalers[i], frame->width, frame->height, format,
+                                   rect, rois[i].out_width, rois[i].out_height,
+                                   ctx->resize.interp))
+            return AVERROR(ENOMEM);
+    }
+
+    job.ctx = ctx;
+    job.rois = rois;
+    job.num = num;
+    job.out = starts;
+    mydecoder_frame_coeffs(ctx, frame, &job.coeffs);
+    mydecoder_slice_run(roi_band, &job, FFMIN(num, FFMAX(ctx->convert_threads, 1)));
+    return num;
+}
+
+s32 mydecoder_retrieve_rois(MyContext ctx, MyFrame frame, const MyRoi *rois, s32 num, u8 *out)
+{
+    AVFrame *avfrm = (AVFrame *)frame;
+    s64 start;
+    s32 i, ret;
+
+    if (num <= 0 || num > MYDECODER_ROI_MAX)
+        return AVERROR(EINVAL);
+    for (i = 0; i < num; i++) {
+        if (rois[i].out_width <= 0 || rois[i].out_height <= 0)
+            return AVERROR(EINVAL);
+    }
+
+#ifdef RK_PLAT
+    if (ctx->use_rkmpp)
+        avfrm = mydecoder_ring_peek(ctx);
+#endif
+    if (!avfrm)
+        return -1;
+    if (AV_PIX_FMT_DRM_PRIME == avfrm->format) {
+        if (!ctx->map_frame)
+            ctx->map_frame = av_frame_alloc();
+        if (!ctx->map_frame || av_hwframe_map(ctx->map_frame, avfrm, AV_HWFRAME_MAP_READ) < 0) {
+            mydecoder_err("Could not map DRM_PRIME frame\n");
+            ret = AVERROR(ENOSYS);
+            goto end;
+        }
+        avfrm = ctx->map_frame;
+    }
+
+    start = mydecoder_timer_start(ctx);
+    ret = retrieve_rois(ctx, avfrm, rois, num, out);
+    mydecoder_timer_stop(ctx, MYDECODER_TIMER_CONVERT, start);
+    if (ret >= 0)
+        mydecoder_stat_add(ctx, frames_converted, 1);
+    if (ctx->map_frame)
+        av_frame_unref(ctx->map_frame);
+
+end:
+#ifdef RK_PLAT
+    if (ctx->use_rkmpp)
+        mydecoder_ring_pop(ctx);
+#endif
+    return ret;
+}
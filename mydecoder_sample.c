@@ -0,0 +1,170 @@
+#include <math.h>
+
+#include "mydecoder_internal.h"
+
+#define SAMPLE_DEFAULT_FPS    25.0
+
+/*
+ * Temporal subsampling. Time is cut into 1/target_fps slots; on the way in
+ * the first packet (decode order) of each slot is decoded, on the way out
+ * the first frame (display order) of each slot is returned. A packet that
+ * no slot needs is dropped when nothing refers to it, and a reference
+ * packet is dropped together with the rest of its GOP when the next
+ * wanted slot starts after the next keyframe is due.
+ */
+
+static double stream_fps(MyContext ctx)
+{
+    AVStream *st;
+
+    if (!ctx->fmt_ctx || ctx->video_stream_idx < 0)
+        return SAMPLE_DEFAULT_FPS;
+    st = ctx->fmt_ctx->streams[ctx->video_stream_idx];
+    if (st->avg_frame_rate.num && st->avg_frame_rate.den)
+        return av_q2d(st->avg_frame_rate);
+    if (st->r_frame_rate.num && st->r_frame_rate.den)
+        return av_q2d(st->r_frame_rate);
+    return SAMPLE_DEFAULT_FPS;
+}
+
+/* Seconds of stream time, from the timestamp or else the position in the stream */
+static double sample_time(MyContext ctx, s64 ts, s64 index)
+{
+    AVRational time_base;
+
+    if (AV_NOPTS_VALUE == ts || mydecoder_time_base(ctx, &time_base) < 0)
+        return index / stream_fps(ctx);
+    return ts * av_q2d(time_base);
+}
+
+static s64 sample_slot(MySampleState *state, double t, double fps)
+{
+    if (!state->started) {
+        state->started = 1;
+        state->first_time = t;
+    }
+    return (s64)floor((t - state->first_time) * fps + 1e-6);
+}
+
+/* Reset the state and tell the decoder what it may skip on its own */
+void mydecoder_sample_apply(MyContext ctx)
+{
+    MySampleState *state = &ctx->sample_state;
+
+    memset(state, 0, sizeof(*state));
+    state->dec_slot = -1;
+    state->out_slot = -1;
+    state->wait_key = ctx->fast && !atomic_load(&ctx->stats.first_frame_ns);
+    if (ctx->fmt_ctx && ctx->video_stream_idx >= 0)
+        state->length_size = mydecoder_nal_length_size(
+                ctx->fmt_ctx->streams[ctx->video_stream_idx]->codecpar);
+
+    if (!ctx->dec_ctx)
+        return;
+    if (MYDECODER_SAMPLE_KEYFRAME == ctx->sample.mode)
+        ctx->dec_ctx->skip_frame = AVDISCARD_NONKEY;
+    else if (MYDECODER_SAMPLE_NONREF == ctx->sample.mode)
+        ctx->dec_ctx->skip_frame = AVDISCARD_NONREF;
+    else
+        ctx->dec_ctx->skip_frame = AVDISCARD_DEFAULT;
+}
+
+s32 mydecoder_set_sampling(MyContext ctx, const MySamplePolicy *policy)
+{
+    if (MYDECODER_SAMPLE_FPS == policy->mode && policy->target_fps <= 0) {
+        mydecoder_err("Invalid target fps %f\n", policy->target_fps);
+        return -1;
+    }
+    ctx->sample = *policy;
+    mydecoder_sample_apply(ctx);
+    return 0;
+}
+
+static s32 sample_codec_id(MyContext ctx)
+{
+    if (!ctx->fmt_ctx || ctx->video_stream_idx < 0) {
+        /* pushed input; rkmpp only does H.264 */
+        if (ctx->dec_ctx)
+            return ctx->dec_ctx->codec_id;
+        return ctx->use_rkmpp ? AV_CODEC_ID_H264 : AV_CODEC_ID_NONE;
+    }
+    return ctx->fmt_ctx->streams[ctx->video_stream_idx]->codecpar->codec_id;
+}
+
+/*
+ * Whether pkt has to go to the decoder. Dropping is done here as well for
+ * keyframe/nonref, since wrappers like h264_v4l2m2m and rkmpp ignore
+ * skip_frame. After a fast open nothing passes before the first IDR.
+ * Flush packets always pass.
+ */
+s32 mydecoder_sample_packet(MyContext ctx, const AVPacket *pkt)
+{
+    MySampleState *state = &ctx->sample_state;
+    s32 key, flags;
+    double t, next;
+    s64 slot;
+
+    if (!pkt || !pkt->data || !pkt->size)
+        return 1;
+
+    key = !!(pkt->flags & AV_PKT_FLAG_KEY);
+    if (state->wait_key) {
+        /* not every demuxer flags keyframes of a live stream */
+        if (!key && !(mydecoder_nal_flags(sample_codec_id(ctx), pkt->data, pkt->size,
+                                          state->length_size) & MYDECODER_NAL_KEY))
+            return 0;
+        state->wait_key = 0;
+    }
+    if (MYDECODER_SAMPLE_ALL == ctx->sample.mode)
+        return 1;
+    if (MYDECODER_SAMPLE_KEYFRAME == ctx->sample.mode)
+        return key;
+
+    flags = mydecoder_nal_flags(sample_codec_id(ctx), pkt->data, pkt->size, state->length_size);
+    if (MYDECODER_SAMPLE_NONREF == ctx->sample.mode)
+        return !!(flags & MYDECODER_NAL_REF);
+
+    t = sample_time(ctx, AV_NOPTS_VALUE != pkt->pts ? pkt->pts : pkt->dts, state->packets++);
+    if (key) {
+        if (state->keys++ && t > state->last_key)
+            state->gop = t - state->last_key;
+        state->last_key = t;
+        state->skip_rasl = state->skip_to_key;
+        state->skip_to_key = 0;
+    }
+    if (state->skip_to_key || (state->skip_rasl && (flags & MYDECODER_NAL_RASL)))
+        return 0;
+
+    slot = sample_slot(state, t, ctx->sample.target_fps);
+    if (slot > state->dec_slot) {
+        state->dec_slot = slot;
+        return 1;
+    }
+    if (!(flags & MYDECODER_NAL_REF))
+        return 0;
+
+    /* the chain can only be cut when nothing before the next keyframe is wanted */
+    next = state->first_time + (state->dec_slot + 1) / ctx->sample.target_fps;
+    if (state->gop > 0 && next >= state->last_key + state->gop) {
+        state->skip_to_key = 1;
+        return 0;
+    }
+    return 1;
+}
+
+/* Whether a decoded frame with this pts is returned to the caller */
+s32 mydecoder_sample_frame(MyContext ctx, s64 pts)
+{
+    MySampleState *state = &ctx->sample_state;
+    s64 slot;
+
+    /* without timestamps the packet side alone has to do */
+    if (MYDECODER_SAMPLE_FPS != ctx->sample.mode || AV_NOPTS_VALUE == pts)
+        return 1;
+
+    slot = sample_slot(state, sample_time(ctx, pts, 0), ctx->sample.target_fps);
+    if (slot <= state->out_slot)
+        return 0;
+    state->out_slot = slot;
+    return 1;
+}
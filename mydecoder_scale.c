@@ -0,0 +1,535 @@
+#include <math.h>
+#include <string.h>
+
+#include <libavutil/mem.h>
+
+#include "mydecoder_internal.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MYDECODER_NEON   1
+#endif
+
+#define FILTER_BITS    14
+#define MID_BITS       7    /* vertical weights, and fraction bits of mid */
+#define WIDE_BITS      14   /* vertical weights of area filters, summed in 32 bits */
+
+/*
+ * Separable resampling, one output row at a time: a vertical pass blends
+ * the source rows of one plane into mid with Q7 weights, which keeps it in
+ * 16 bits, and a Q14 horizontal pass filters mid down to the output width. Luma and chroma are scaled on their own planes
+ * and the result goes through the 4:2:0 row kernel, so only a few lines of
+ * the output resolution are ever held. Area filters can have dozens of
+ * taps, too many for Q7 weights, so their vertical pass sums Q14 weights
+ * in 32 bits and rounds into mid.
+ */
+typedef struct {
+    s32 n;              /* outputs */
+    s32 taps;
+    s32 *start;         /* first source index of every output */
+    s16 *coeffs;        /* n x taps, zero padded, sum 1 << bits, none negative */
+    s32 bits;
+} MyFilter;
+
+struct MyScaler {
+    s32 src_width;
+    s32 src_height;
+    s32 src_format;
+    s32 width;
+    s32 height;
+    MyResizeConfig config;
+    s32 sx, sy, sw, sh;     /* source rectangle, luma samples */
+    s32 dx, dy, dw, dh;     /* where it lands in the output */
+    MyFilter luma_h;
+    MyFilter luma_v;
+    MyFilter chroma_h;
+    MyFilter chroma_v;
+    u16 *mid;
+    u32 *wide;              /* vertical sums of WIDE_BITS filters */
+    const u8 *near;         /* source row standing in for mid, single tap vertical */
+    u8 *y_line;
+    u8 *u_line;
+    u8 *v_line;
+    s32 chroma_row;         /* chroma output row held in u_line/v_line */
+};
+
+static void filter_free(MyFilter *f)
+{
+    av_freep(&f->start);
+    av_freep(&f->coeffs);
+}
+
+/* Map src_n samples starting at offset onto dst_n outputs */
+static s32 filter_init(MyFilter *f, s32 offset, s32 src_n, s32 dst_n, MyInterp interp, s32 bits)
+{
+    double scale = (double)src_n / dst_n;
+    double *w, *frac;
+    s32 i, k;
+
+    if (MYDECODER_INTERP_AREA == interp && scale <= 1.0)
+        interp = MYDECODER_INTERP_BILINEAR;
+    if (MYDECODER_INTERP_NEAREST == interp)
+        f->taps = 1;
+    else if (MYDECODER_INTERP_BILINEAR == interp)
+        f->taps = 2;
+    else
+        f->taps = (s32)ceil(scale) + 1;
+    if (f->taps > src_n)
+        f->taps = src_n;
+
+    f->n = dst_n;
+    f->bits = bits;
+    f->start = (s32 *)av_malloc(dst_n * sizeof(s32));
+    f->coeffs = (s16 *)av_mallocz(dst_n * f->taps * sizeof(s16));
+    w = (double *)av_malloc(2 * (f->taps + 1) * sizeof(double));
+    if (!f->start || !f->coeffs || !w) {
+        av_free(w);
+        return AVERROR(ENOMEM);
+    }
+    frac = w + f->taps + 1;
+
+    for (i = 0; i < dst_n; i++) {
+        s32 first, count, shift, sum = 0, big;
+        s16 *c;
+
+        if (MYDECODER_INTERP_NEAREST == interp) {
+            first = FFMIN((s32)((i + 0.5) * scale), src_n - 1);
+            count = 1;
+            w[0] = 1.0;
+        } else if (MYDECODER_INTERP_BILINEAR == interp) {
+            double center = FFMAX((i + 0.5) * scale - 0.5, 0.0);
+
+            first = (s32)center;
+            count = first + 1 < src_n ? 2 : 1;
+            w[1] = center - first;
+            w[0] = 1.0 - w[1];
+            if (count == 1)
+                w[0] = 1.0;
+        } else {
+            double lo = i * scale, hi = (i + 1) * scale;
+
+            first = (s32)lo;
+            count = FFMIN((s32)ceil(hi), src_n) - first;
+            if (count > f->taps)
+                count = f->taps;
+            for (k = 0; k < count; k++)
+                w[k] = (FFMIN(hi, first + k + 1.0) - FFMAX(lo, (double)(first + k))) / scale;
+        }
+
+        /* keep all taps inside the source, the weights move along */
+        shift = FFMAX(first + f->taps - src_n, 0);
+        f->start[i] = offset + first - shift;
+        c = f->coeffs + i * f->taps + shift;
+        /*
+         * Rounded down, then the units left go to the largest remainders,
+         * one each: the sum is exact and no weight is pushed below zero,
+         * however many small taps there are.
+         */
+        for (k = 0; k < count; k++) {
+            c[k] = (s16)floor(w[k] * (1 << bits));
+            frac[k] = w[k] * (1 << bits) - c[k];
+            sum += c[k];
+        }
+        for (; sum < (1 << bits); sum++) {
+            for (big = 0, k = 1; k < count; k++) {
+                if (frac[k] > frac[big])
+                    big = k;
+            }
+            c[big]++;
+            frac[big] -= 1.0;
+        }
+        for (; sum > (1 << bits); sum--) {
+            for (big = 0, k = 1; k < count; k++) {
+                if (c[k] > c[big])
+                    big = k;
+            }
+            c[big]--;
+        }
+    }
+
+    av_free(w);
+    return 0;
+}
+
+/* mid[x] (+)= w * row[x] */
+static void blend_row(u16 *mid, const u8 *row, s32 w, s32 count, s32 add)
+{
+    s32 x = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i wv = _mm_set1_epi16(w);
+
+    for (; x + 16 <= count; x += 16) {
+        __m128i r = _mm_loadu_si128((const __m128i *)(row + x));
+        __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(r, zero), wv);
+        __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(r, zero), wv);
+
+        if (add) {
+            lo = _mm_add_epi16(lo, _mm_loadu_si128((const __m128i *)(mid + x)));
+            hi = _mm_add_epi16(hi, _mm_loadu_si128((const __m128i *)(mid + x + 8)));
+        }
+        _mm_storeu_si128((__m128i *)(mid + x), lo);
+        _mm_storeu_si128((__m128i *)(mid + x + 8), hi);
+    }
+#elif defined(MYDECODER_NEON)
+    const uint8x8_t wv = vdup_n_u8(w);
+
+    for (; x + 16 <= count; x += 16) {
+        uint8x16_t r = vld1q_u8(row + x);
+        uint16x8_t lo, hi;
+
+        if (add) {
+            lo = vmlal_u8(vld1q_u16(mid + x), vget_low_u8(r), wv);
+            hi = vmlal_u8(vld1q_u16(mid + x + 8), vget_high_u8(r), wv);
+        } else {
+            lo = vmull_u8(vget_low_u8(r), wv);
+            hi = vmull_u8(vget_high_u8(r), wv);
+        }
+        vst1q_u16(mid + x, lo);
+        vst1q_u16(mid + x + 8, hi);
+    }
+#endif
+    if (add) {
+        for (; x < count; x++)
+            mid[x] += w * row[x];
+    } else {
+        for (; x < count; x++)
+            mid[x] = w * row[x];
+    }
+}
+
+/* Source rows of output row j blended over count samples from x0 */
+static void scale_vertical(struct MyScaler *s, const MyFilter *f, const u8 *src, s32 stride,
+    s32 j, s32 x0, s32 count)
+{
+    const s16 *w = f->coeffs + j * f->taps;
+    const u8 *row = src + f->start[j] * stride + x0;
+    s32 k, x, first = 1;
+
+    s->near = NULL;
+    if (f->taps == 1) {
+        /* nothing to blend, the horizontal pass reads the row itself */
+        s->near = src + f->start[j] * stride;
+        return;
+    }
+    if (WIDE_BITS == f->bits) {
+        u32 *acc = s->wide + x0;
+
+        memset(acc, 0, count * sizeof(u32));
+        for (k = 0; k < f->taps; k++) {
+            const u8 *r = row + k * stride;
+
+            if (!w[k])
+                continue;
+            for (x = 0; x < count; x++)
+                acc[x] += w[k] * r[x];
+        }
+        for (x = 0; x < count; x++)
+            s->mid[x0 + x] = (acc[x] + (1 << (WIDE_BITS - MID_BITS - 1))) >>
+                             (WIDE_BITS - MID_BITS);
+        return;
+    }
+    /* Q7 weights sum to 128, so mid never exceeds 255 << 7 */
+    for (k = 0; k < f->taps; k++) {
+        if (!w[k])
+            continue;
+        blend_row(s->mid + x0, row + k * stride, w[k], count, !first);
+        first = 0;
+    }
+}
+
+static void scale_horizontal(const struct MyScaler *s, const MyFilter *f, s32 in_step,
+    s32 in_off, u8 *dst, s32 out_step)
+{
+    s32 i, k;
+
+    if (s->near) {
+        const u8 *row = s->near + in_off;
+
+        for (i = 0; i < f->n; i++) {
+            const u8 *r = row + f->start[i] * in_step;
+            const s16 *w = f->coeffs + i * f->taps;
+            s32 sum = 1 << (FILTER_BITS - 1);
+
+            if (f->taps == 1) {
+                dst[i * out_step] = r[0];
+                continue;
+            }
+            for (k = 0; k < f->taps; k++)
+                sum += w[k] * r[k * in_step];
+            dst[i * out_step] = sum >> FILTER_BITS;
+        }
+        return;
+    }
+
+    if (f->taps == 2) {
+        for (i = 0; i < f->n; i++) {
+            const u16 *m = s->mid + in_off + f->start[i] * in_step;
+            const s16 *w = f->coeffs + i * 2;
+
+            dst[i * out_step] = (w[0] * m[0] + w[1] * m[in_step] +
+                                 (1 << (FILTER_BITS + MID_BITS - 1))) >> (FILTER_BITS + MID_BITS);
+        }
+        return;
+    }
+    for (i = 0; i < f->n; i++) {
+        const u16 *m = s->mid + in_off + f->start[i] * in_step;
+        const s16 *w = f->coeffs + i * f->taps;
+        s32 sum = 1 << (FILTER_BITS + MID_BITS - 1);
+
+        for (k = 0; k < f->taps; k++)
+            sum += w[k] * m[k * in_step];
+        dst[i * out_step] = sum >> (FILTER_BITS + MID_BITS);
+    }
+}
+
+static void fill_pad(u8 *dst, s32 count, const u8 *pad)
+{
+    s32 i;
+
+    for (i = 0; i < count; i++) {
+        dst[3 * i + 0] = pad[0];
+        dst[3 * i + 1] = pad[1];
+        dst[3 * i + 2] = pad[2];
+    }
+}
+
+static void scaler_geometry(struct MyScaler *s)
+{
+    s64 w = s->src_width, h = s->src_height;
+    s64 ow = s->width, oh = s->height;
+
+    s->sx = 0;
+    s->sy = 0;
+    s->sw = w;
+    s->sh = h;
+    s->dx = 0;
+    s->dy = 0;
+    s->dw = ow;
+    s->dh = oh;
+
+    if (MYDECODER_FIT_LETTERBOX == s->config.fit) {
+        if (ow * h > oh * w) {
+            s->dw = FFMAX((s32)((w * oh + h / 2) / h), 1);
+            s->dx = (ow - s->dw) / 2;
+        } else {
+            s->dh = FFMAX((s32)((h * ow + w / 2) / w), 1);
+            s->dy = (oh - s->dh) / 2;
+        }
+    } else if (MYDECODER_FIT_CROP == s->config.fit) {
+        /* even offsets keep the chroma rectangle on whole samples */
+        if (ow * h > oh * w) {
+            s->sh = FFMAX((s32)((w * oh + ow / 2) / ow), 1);
+            s->sy = ((h - s->sh) / 2) & ~1;
+        } else {
+            s->sw = FFMAX((s32)((h * ow + oh / 2) / oh), 1);
+            s->sx = ((w - s->sw) / 2) & ~1;
+        }
+    }
+}
+
+void mydecoder_scaler_free(struct MyScaler **scaler)
+{
+    struct MyScaler *s = *scaler;
+
+    if (!s)
+        return;
+    filter_free(&s->luma_h);
+    filter_free(&s->luma_v);
+    filter_free(&s->chroma_h);
+    filter_free(&s->chroma_v);
+    av_free(s->mid);
+    av_free(s->wide);
+    av_free(s->y_line);
+    av_free(s->u_line);
+    av_free(s->v_line);
+    av_freep(scaler);
+}
+
+/* rect, when given, is the source rectangle instead of the one config->fit picks */
+static struct MyScaler *scaler_alloc(s32 src_width, s32 src_height, s32 src_format,
+    s32 width, s32 height, const MyResizeConfig *config, const s32 rect[4])
+{
+    struct MyScaler *s = (struct MyScaler *)av_mallocz(sizeof(struct MyScaler));
+    s32 ret, row = src_width * 3 + 16;
+    s32 vbits = MYDECODER_INTERP_AREA == config->interp ? WIDE_BITS : MID_BITS;
+
+    if (!s)
+        return NULL;
+    s->src_width = src_width;
+    s->src_height = src_height;
+    s->src_format = src_format;
+    s->width = width;
+    s->height = height;
+    s->config = *config;
+    scaler_geometry(s);
+    if (rect) {
+        s->sx = rect[0];
+        s->sy = rect[1];
+        s->sw = rect[2];
+        s->sh = rect[3];
+    }
+
+    ret = filter_init(&s->luma_h, s->sx, s->sw, s->dw, config->interp, FILTER_BITS);
+    if (ret >= 0)
+        ret = filter_init(&s->luma_v, s->sy, s->sh, s->dh, config->interp, vbits);
+    if (ret >= 0 && AV_PIX_FMT_BGR24 != src_format) {
+        ret = filter_init(&s->chroma_h, s->sx / 2, (s->sw + 1) / 2, (s->dw + 1) / 2,
+                          config->interp, FILTER_BITS);
+        if (ret >= 0)
+            ret = filter_init(&s->chroma_v, s->sy / 2, (s->sh + 1) / 2, (s->dh + 1) / 2,
+                              config->interp, vbits);
+    }
+
+    s->mid = (u16 *)av_malloc(row * sizeof(u16));
+    if (WIDE_BITS == vbits)
+        s->wide = (u32 *)av_malloc(row * sizeof(u32));
+    s->y_line = (u8 *)av_malloc(s->dw + 64);
+    s->u_line = (u8 *)av_malloc(s->dw / 2 + 64);
+    s->v_line = (u8 *)av_malloc(s->dw / 2 + 64);
+    if (ret < 0 || !s->mid || (WIDE_BITS == vbits && !s->wide) || !s->y_line || !s->u_line || !s->v_line) {
+        mydecoder_err("Error allocating scaler\n");
+        mydecoder_scaler_free(&s);
+        return NULL;
+    }
+    return s;
+}
+
+/*
+ * Scaler of the context for this source and output, rebuilt when any of
+ * them changes. Call once per frame before its rows.
+ */
+struct MyScaler *mydecoder_scaler_get(MyContext ctx, s32 src_width, s32 src_height,
+    s32 src_format, s32 width, s32 height)
+{
+    struct MyScaler *s = ctx->scaler;
+
+    if (!s || s->src_width != src_width || s->src_height != src_height ||
+        s->src_format != src_format || s->width != width || s->height != height ||
+        memcmp(&s->config, &ctx->resize, sizeof(MyResizeConfig))) {
+        mydecoder_scaler_free(&ctx->scaler);
+        ctx->scaler = s = scaler_alloc(src_width, src_height, src_format, width, height,
+                                       &ctx->resize, NULL);
+        if (!s)
+            return NULL;
+    }
+    s->chroma_row = -1;
+    return s;
+}
+
+/*
+ * Scaler from rect (x, y, width, height in luma samples, x and y even) of
+ * the source to a whole width x height output, kept in *scaler and rebuilt
+ * when anything changes. For regions of a frame rather than all of it.
+ */
+struct MyScaler *mydecoder_scaler_rect(struct MyScaler **scaler, s32 src_width, s32 src_height,
+    s32 src_format, const s32 rect[4], s32 width, s32 height, MyInterp interp)
+{
+    MyResizeConfig config = { width, height, MYDECODER_FIT_STRETCH, interp, { 0, 0, 0 } };
+    struct MyScaler *s = *scaler;
+
+    if (!s || s->src_width != src_width || s->src_height != src_height ||
+        s->src_format != src_format || s->width != width || s->height != height ||
+        s->config.interp != interp || s->sx != rect[0] || s->sy != rect[1] ||
+        s->sw != rect[2] || s->sh != rect[3]) {
+        mydecoder_scaler_free(scaler);
+        *scaler = s = scaler_alloc(src_width, src_height, src_format, width, height, &config,
+                                   rect);
+        if (!s)
+            return NULL;
+    }
+    s->chroma_row = -1;
+    return s;
+}
+
+/*
+ * Source rows (in luma rows) that output row y reads all lie before this
+ * one; 0 for a padding row, which reads none.
+ */
+s32 mydecoder_scaler_rows_end(const struct MyScaler *s, s32 y)
+{
+    s32 j = y - s->dy, end;
+
+    if (j < 0 || j >= s->dh)
+        return 0;
+    end = s->luma_v.start[j] + s->luma_v.taps;
+    if (AV_PIX_FMT_BGR24 != s->src_format)
+        end = FFMAX(end, 2 * (s->chroma_v.start[j >> 1] + s->chroma_v.taps));
+    return FFMIN(end, s->src_height);
+}
+
+/* Output row y as BGR24; data/linesize are NV12, I420 or BGR24 planes */
+void mydecoder_scaler_row(struct MyScaler *s, u8 *const data[4], const s32 linesize[4],
+    const MyYuvCoeffs *coeffs, s32 y, u8 *dst)
+{
+    u8 *out = dst + s->dx * 3;
+    s32 c, j = y - s->dy;
+
+    if (j < 0 || j >= s->dh) {
+        fill_pad(dst, s->width, s->config.pad);
+        return;
+    }
+    fill_pad(dst, s->dx, s->config.pad);
+    fill_pad(out + s->dw * 3, s->width - s->dx - s->dw, s->config.pad);
+
+    if (AV_PIX_FMT_BGR24 == s->src_format) {
+        scale_vertical(s, &s->luma_v, data[0], linesize[0], j, s->sx * 3, s->sw * 3);
+        for (c = 0; c < 3; c++)
+            scale_horizontal(s, &s->luma_h, 3, c, out + c, 3);
+        return;
+    }
+
+    scale_vertical(s, &s->luma_v, data[0], linesize[0], j, s->sx, s->sw);
+    scale_horizontal(s, &s->luma_h, 1, 0, s->y_line, 1);
+
+    if (s->chroma_row != j >> 1) {
+        s32 cx = s->sx / 2, cw = (s->sw + 1) / 2;
+
+        s->chroma_row = j >> 1;
+        if (AV_PIX_FMT_NV12 == s->src_format) {
+            scale_vertical(s, &s->chroma_v, data[1], linesize[1], s->chroma_row, cx * 2, cw * 2);
+            scale_horizontal(s, &s->chroma_h, 2, 0, s->u_line, 1);
+            scale_horizontal(s, &s->chroma_h, 2, 1, s->v_line, 1);
+        } else {
+            scale_vertical(s, &s->chroma_v, data[1], linesize[1], s->chroma_row, cx, cw);
+            scale_horizontal(s, &s->chroma_h, 1, 0, s->u_line, 1);
+            scale_vertical(s, &s->chroma_v, data[2], linesize[2], s->chroma_row, cx, cw);
+            scale_horizontal(s, &s->chroma_h, 1, 0, s->v_line, 1);
+        }
+    }
+    mydecoder_i420_row_bgr24(s->y_line, s->u_line, s->v_line, out, s->dw, coeffs);
+}
+
+/*
+ * Planes the scaler can read for frame: NV12/I420 as they are, anything
+ * else converted to BGR24 at its own size in the context's frame buffer.
+ */
+s32 mydecoder_scaler_source(MyContext ctx, AVFrame *frame, u8 *data[4], s32 linesize[4],
+    s32 *format)
+{
+    s32 i;
+
+    if (AV_PIX_FMT_NV12 == frame->format || AV_PIX_FMT_YUV420P == frame->format ||
+        AV_PIX_FMT_YUVJ420P == frame->format) {
+        for (i = 0; i < 4; i++) {
+            data[i] = frame->data[i];
+            linesize[i] = frame->linesize[i];
+        }
+        *format = AV_PIX_FMT_NV12 == frame->format ? AV_PIX_FMT_NV12 : AV_PIX_FMT_YUV420P;
+        return 0;
+    }
+
+    av_fast_malloc(&ctx->frame_buf, &ctx->frame_buf_size, frame->width * frame->height * 3);
+    if (!ctx->frame_buf)
+        return AVERROR(ENOMEM);
+    mydecoder_retrieve_frame_sws(ctx, frame, ctx->frame_buf);
+    memset(data, 0, 4 * sizeof(u8 *));
+    memset(linesize, 0, 4 * sizeof(s32));
+    data[0] = ctx->frame_buf;
+    linesize[0] = frame->width * 3;
+    *format = AV_PIX_FMT_BGR24;
+    return 0;
+}
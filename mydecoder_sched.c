@@ -0,0 +1,501 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mydecoder_internal.h"
+#include "mydecoder_queue.h"
+
+#define SCHED_DEFAULT_QUANTUM    8
+#define SCHED_RETRY_NS           (2 * 1000 * 1000)  /* live source had nothing to read */
+#define SCHED_WEIGHT_UNIT        1024
+
+enum {
+    STREAM_QUEUED = 0,
+    STREAM_RUNNING,
+    STREAM_DONE,
+};
+
+/*
+ * Every worker owns a run queue of streams. A turn reads and decodes up to
+ * quantum packets of one stream, after which the stream goes back to the
+ * queue of the worker that ran it, so its decoder state stays in that
+ * core's caches. Within a queue the highest priority wins, then the lowest
+ * virtual runtime (busy time divided by weight). A worker with nothing to
+ * run takes a stream from the queue of a busy one.
+ */
+typedef struct {
+    MyContext ctx;
+    MyStreamConfig config;
+    atomic_int priority;
+    atomic_int weight;
+    AVPacket *pkt;
+    MyBufferPool bgr_pool;
+    struct MySchedWorker *worker;
+    s64 vruntime;
+    s64 not_before;
+    s32 fmt_flags;
+    s32 eof;
+    atomic_int state;
+    atomic_int removing;
+} MySchedStream;
+
+typedef struct MySchedWorker {
+    struct MyScheduler *sched;
+    pthread_t thread;
+    s32 index;
+    s32 core;
+    pthread_mutex_t lock;
+    MySchedStream **runq;
+    s32 count;
+    s32 capacity;
+    atomic_int busy;
+    atomic_llong turns;
+    atomic_llong steals;
+    atomic_llong packets;
+    atomic_llong frames;
+    atomic_llong busy_ns;
+} MySchedWorker;
+
+struct MyScheduler {
+    MySchedConfig config;
+    MySchedWorker *workers;
+    s32 nb_workers;
+    s32 quantum;
+    s64 start_ns;
+    atomic_int stop;
+    pthread_mutex_t lock;
+    MySchedStream **streams;
+    s32 nb_streams;
+};
+
+static s64 sched_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Caller holds w->lock */
+static s32 runq_push(MySchedWorker *w, MySchedStream *s)
+{
+    if (w->count == w->capacity) {
+        s32 capacity = w->capacity ? w->capacity * 2 : 16;
+        MySchedStream **runq = (MySchedStream **)av_realloc(w->runq, capacity * sizeof(*runq));
+
+        if (!runq)
+            return AVERROR(ENOMEM);
+        w->runq = runq;
+        w->capacity = capacity;
+    }
+    w->runq[w->count++] = s;
+    return 0;
+}
+
+static s32 runq_length(MySchedWorker *w)
+{
+    s32 count;
+
+    pthread_mutex_lock(&w->lock);
+    count = w->count;
+    pthread_mutex_unlock(&w->lock);
+    return count;
+}
+
+/* Best runnable stream of the queue, taken out of it; caller holds w->lock */
+static MySchedStream *runq_take(MySchedWorker *w, s64 now)
+{
+    MySchedStream *best = NULL;
+    s32 i = 0, at = -1;
+
+    while (i < w->count) {
+        MySchedStream *s = w->runq[i];
+
+        if (atomic_load(&s->removing)) {
+            w->runq[i] = w->runq[--w->count];
+            atomic_store(&s->state, STREAM_DONE);
+            continue;
+        }
+        if (s->not_before <= now &&
+            (!best || atomic_load(&s->priority) > atomic_load(&best->priority) ||
+             (atomic_load(&s->priority) == atomic_load(&best->priority) &&
+              s->vruntime < best->vruntime))) {
+            best = s;
+            at = i;
+        }
+        i++;
+    }
+    if (best)
+        w->runq[at] = w->runq[--w->count];
+    return best;
+}
+
+static MySchedStream *sched_steal(MySchedWorker *w, s64 now)
+{
+    struct MyScheduler *sched = w->sched;
+    MySchedStream *s = NULL;
+    s32 i;
+
+    for (i = 1; i < sched->nb_workers && !s; i++) {
+        MySchedWorker *victim = &sched->workers[(w->index + i) % sched->nb_workers];
+
+        /* an idle worker gets to its own queue soon enough */
+        if (!atomic_load(&victim->busy) || pthread_mutex_trylock(&victim->lock))
+            continue;
+        s = runq_take(victim, now);
+        pthread_mutex_unlock(&victim->lock);
+    }
+    if (s)
+        atomic_fetch_add(&w->steals, 1);
+    return s;
+}
+
+static s32 sched_sink(void *opaque, AVFrame *frame)
+{
+    MySchedStream *s = (MySchedStream *)opaque;
+    MyFrameView view;
+    AVFrame *out;
+
+    if (mydecoder_motion_gate(s->ctx, frame))
+        return 0;
+    out = mydecoder_output_frame(s->ctx, frame, &s->bgr_pool, s->config.convert);
+    if (!out)
+        return 0;
+    atomic_fetch_add(&s->worker->frames, 1);
+    mydecoder_fill_view(&view, out);
+    s->config.callback(s->config.opaque, &view);
+    return 0;
+}
+
+static void sched_turn(MySchedWorker *w, MySchedStream *s)
+{
+    MyContext ctx = s->ctx;
+    s32 i, ret;
+    s64 start;
+
+    s->worker = w;
+    for (i = 0; i < w->sched->quantum; i++) {
+        av_packet_unref(s->pkt);
+        start = mydecoder_timer_start(ctx);
+        ret = av_read_frame(ctx->fmt_ctx, s->pkt);
+        mydecoder_timer_stop(ctx, MYDECODER_TIMER_READ, start);
+        if (ret == AVERROR(EAGAIN)) {
+            s->not_before = sched_now() + SCHED_RETRY_NS;
+            break;
+        }
+        if (ret < 0) {
+            if (ret != AVERROR_EOF)
+                mydecoder_err("Error reading packet: %d\n", ret);
+            mydecoder_decode_frames(ctx, NULL, sched_sink, s);
+            s->config.callback(s->config.opaque, NULL);
+            s->eof = 1;
+            break;
+        }
+        mydecoder_record_packet(ctx, s->pkt);
+        if (s->pkt->stream_index != ctx->video_stream_idx)
+            continue;
+        atomic_fetch_add(&w->packets, 1);
+        mydecoder_stat_add(ctx, packets, 1);
+        mydecoder_stat_add(ctx, bytes, s->pkt->size);
+        mydecoder_decode_frames(ctx, s->pkt, sched_sink, s);
+    }
+    av_packet_unref(s->pkt);
+}
+
+static void sched_pin(MySchedWorker *w)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(w->core, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+        mydecoder_err("Could not pin worker %d to core %d\n", w->index, w->core);
+}
+
+static void *sched_worker(void *arg)
+{
+    MySchedWorker *w = (MySchedWorker *)arg;
+    struct MyScheduler *sched = w->sched;
+    MySchedStream *s;
+    s64 start, end;
+    u32 spins = 0;
+    s32 ret;
+
+    if (sched->config.pin)
+        sched_pin(w);
+
+    while (!atomic_load(&sched->stop)) {
+        start = sched_now();
+        pthread_mutex_lock(&w->lock);
+        s = runq_take(w, start);
+        pthread_mutex_unlock(&w->lock);
+        if (!s)
+            s = sched_steal(w, start);
+        if (!s) {
+            mydecoder_backoff(&spins);
+            continue;
+        }
+        spins = 0;
+
+        atomic_store(&s->state, STREAM_RUNNING);
+        atomic_store(&w->busy, 1);
+        sched_turn(w, s);
+        atomic_store(&w->busy, 0);
+        end = sched_now();
+
+        atomic_fetch_add(&w->busy_ns, end - start);
+        atomic_fetch_add(&w->turns, 1);
+        s->vruntime += (end - start) * SCHED_WEIGHT_UNIT / FFMAX(atomic_load(&s->weight), 1);
+
+        if (s->eof || atomic_load(&s->removing)) {
+            atomic_store(&s->state, STREAM_DONE);
+            continue;
+        }
+        atomic_store(&s->state, STREAM_QUEUED);
+        pthread_mutex_lock(&w->lock);
+        ret = runq_push(w, s);
+        pthread_mutex_unlock(&w->lock);
+        if (ret < 0) {
+            /* in no queue any more, so remove must not wait for a worker */
+            mydecoder_err("Could not requeue stream, it stops here\n");
+            atomic_store(&s->state, STREAM_DONE);
+        }
+    }
+    return NULL;
+}
+
+/* The CPUs this process may run on, in order; workers are pinned round them */
+static s32 sched_cpus(s32 *cpus, s32 max)
+{
+    cpu_set_t set;
+    s32 i, n = 0;
+
+    if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+        n = FFMIN(FFMAX(sysconf(_SC_NPROCESSORS_ONLN), 1), max);
+        for (i = 0; i < n; i++)
+            cpus[i] = i;
+        return n;
+    }
+    for (i = 0; i < CPU_SETSIZE && n < max; i++) {
+        if (CPU_ISSET(i, &set))
+            cpus[n++] = i;
+    }
+    return n;
+}
+
+MySched mydecoder_sched_create(const MySchedConfig *config)
+{
+    struct MyScheduler *sched;
+    s32 cpus[CPU_SETSIZE];
+    s32 i, cores = sched_cpus(cpus, CPU_SETSIZE);
+
+    sched = (struct MyScheduler *)av_mallocz(sizeof(struct MyScheduler));
+    if (!sched) {
+        mydecoder_err("Error allocating scheduler\n");
+        return NULL;
+    }
+    sched->config = *config;
+    sched->nb_workers = config->workers > 0 ? config->workers : FFMAX(cores, 1);
+    sched->quantum = config->quantum > 0 ? config->quantum : SCHED_DEFAULT_QUANTUM;
+    sched->start_ns = sched_now();
+    atomic_init(&sched->stop, 0);
+    pthread_mutex_init(&sched->lock, NULL);
+
+    sched->workers = (MySchedWorker *)av_calloc(sched->nb_workers, sizeof(MySchedWorker));
+    if (!sched->workers) {
+        mydecoder_err("Error allocating scheduler\n");
+        av_free(sched);
+        return NULL;
+    }
+    for (i = 0; i < sched->nb_workers; i++) {
+        MySchedWorker *w = &sched->workers[i];
+
+        w->sched = sched;
+        w->index = i;
+        w->core = cores > 0 ? cpus[i % cores] : 0;
+        pthread_mutex_init(&w->lock, NULL);
+        if (pthread_create(&w->thread, NULL, sched_worker, w)) {
+            mydecoder_err("Could not start scheduler worker %d\n", i);
+            pthread_mutex_destroy(&w->lock);
+            /* destroy stops and joins the ones that did start */
+            sched->nb_workers = i;
+            mydecoder_sched_destroy(sched);
+            return NULL;
+        }
+    }
+    mydecoder_info("scheduler: %d workers%s\n", sched->nb_workers, config->pin ? ", pinned" : "");
+    return sched;
+}
+
+static MySchedStream *sched_find(struct MyScheduler *sched, MyContext ctx, s32 *index)
+{
+    s32 i;
+
+    for (i = 0; i < sched->nb_streams; i++) {
+        if (sched->streams[i]->ctx == ctx) {
+            if (index)
+                *index = i;
+            return sched->streams[i];
+        }
+    }
+    return NULL;
+}
+
+static void sched_stream_free(MySchedStream *s)
+{
+    s->ctx->fmt_ctx->flags = s->fmt_flags;
+    av_packet_free(&s->pkt);
+    mydecoder_pool_uninit(&s->bgr_pool);
+    av_free(s);
+}
+
+s32 mydecoder_sched_add(MySched sched, MyContext ctx, const MyStreamConfig *config)
+{
+    MySchedStream *s, **streams;
+    MySchedWorker *w;
+    s32 i, n, count, ret;
+
+    if (!ctx->fmt_ctx || ctx->async || !config->callback) {
+        mydecoder_err("Stream is not open, runs async or has no callback\n");
+        return -1;
+    }
+
+    s = (MySchedStream *)av_mallocz(sizeof(MySchedStream));
+    if (!s || !(s->pkt = av_packet_alloc())) {
+        mydecoder_err("Error allocating stream\n");
+        av_free(s);
+        return AVERROR(ENOMEM);
+    }
+    s->ctx = ctx;
+    s->config = *config;
+    atomic_init(&s->priority, config->priority);
+    atomic_init(&s->weight, config->weight > 0 ? config->weight : 1);
+    atomic_init(&s->state, STREAM_QUEUED);
+    atomic_init(&s->removing, 0);
+    mydecoder_pool_init(&s->bgr_pool);
+    /* a live source without data must not hold a worker */
+    s->fmt_flags = ctx->fmt_ctx->flags;
+    ctx->fmt_ctx->flags |= AVFMT_FLAG_NONBLOCK;
+
+    pthread_mutex_lock(&sched->lock);
+    if (sched_find(sched, ctx, NULL)) {
+        pthread_mutex_unlock(&sched->lock);
+        mydecoder_err("Stream already scheduled\n");
+        sched_stream_free(s);
+        return -1;
+    }
+    streams = (MySchedStream **)av_realloc(sched->streams,
+                                           (sched->nb_streams + 1) * sizeof(*streams));
+    if (!streams) {
+        pthread_mutex_unlock(&sched->lock);
+        sched_stream_free(s);
+        return AVERROR(ENOMEM);
+    }
+    sched->streams = streams;
+    sched->streams[sched->nb_streams++] = s;
+    pthread_mutex_unlock(&sched->lock);
+
+    /* the shortest queue, starting level with what already runs there */
+    w = &sched->workers[0];
+    count = runq_length(w);
+    for (i = 1; i < sched->nb_workers; i++) {
+        n = runq_length(&sched->workers[i]);
+        if (n < count) {
+            w = &sched->workers[i];
+            count = n;
+        }
+    }
+    pthread_mutex_lock(&w->lock);
+    for (i = 0; i < w->count; i++) {
+        if (!i || w->runq[i]->vruntime < s->vruntime)
+            s->vruntime = w->runq[i]->vruntime;
+    }
+    ret = runq_push(w, s);
+    pthread_mutex_unlock(&w->lock);
+    if (ret < 0)
+        atomic_store(&s->state, STREAM_DONE);
+    return ret;
+}
+
+s32 mydecoder_sched_set_priority(MySched sched, MyContext ctx, s32 priority, s32 weight)
+{
+    MySchedStream *s;
+
+    pthread_mutex_lock(&sched->lock);
+    s = sched_find(sched, ctx, NULL);
+    if (s) {
+        atomic_store(&s->priority, priority);
+        atomic_store(&s->weight, weight > 0 ? weight : 1);
+    }
+    pthread_mutex_unlock(&sched->lock);
+    return s ? 0 : -1;
+}
+
+s32 mydecoder_sched_remove(MySched sched, MyContext ctx)
+{
+    MySchedStream *s;
+    u32 spins = 0;
+    s32 index;
+
+    pthread_mutex_lock(&sched->lock);
+    s = sched_find(sched, ctx, &index);
+    if (s)
+        sched->streams[index] = sched->streams[--sched->nb_streams];
+    pthread_mutex_unlock(&sched->lock);
+    if (!s)
+        return -1;
+
+    /* the worker that holds it lets go after the current turn */
+    atomic_store(&s->removing, 1);
+    while (atomic_load(&s->state) != STREAM_DONE)
+        mydecoder_backoff(&spins);
+    sched_stream_free(s);
+    return 0;
+}
+
+s32 mydecoder_sched_workers(MySched sched)
+{
+    return sched->nb_workers;
+}
+
+s32 mydecoder_sched_worker_stats(MySched sched, s32 worker, MyWorkerStats *stats)
+{
+    MySchedWorker *w;
+    s64 elapsed = sched_now() - sched->start_ns;
+
+    if (worker < 0 || worker >= sched->nb_workers)
+        return -1;
+    w = &sched->workers[worker];
+
+    pthread_mutex_lock(&w->lock);
+    stats->streams = w->count;
+    pthread_mutex_unlock(&w->lock);
+    stats->core = sched->config.pin ? w->core : -1;
+    stats->turns = atomic_load(&w->turns);
+    stats->steals = atomic_load(&w->steals);
+    stats->packets = atomic_load(&w->packets);
+    stats->frames = atomic_load(&w->frames);
+    stats->busy_us = atomic_load(&w->busy_ns) / 1000;
+    stats->utilization = elapsed > 0 ? (double)atomic_load(&w->busy_ns) / elapsed : 0;
+    return 0;
+}
+
+void mydecoder_sched_destroy(MySched sched)
+{
+    s32 i;
+
+    atomic_store(&sched->stop, 1);
+    for (i = 0; i < sched->nb_workers; i++) {
+        pthread_join(sched->workers[i].thread, NULL);
+        pthread_mutex_destroy(&sched->workers[i].lock);
+        av_free(sched->workers[i].runq);
+    }
+    for (i = 0; i < sched->nb_streams; i++)
+        sched_stream_free(sched->streams[i]);
+    av_free(sched->streams);
+    av_free(sched->workers);
+    pthread_mutex_destroy(&sched->lock);
+    av_free(sched);
+}
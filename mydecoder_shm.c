@@ -0,0 +1,510 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+
+#include "mydecoder_internal.h"
+
+#define SHM_MAGIC             "MYDSHM1"
+#define SHM_VERSION           1
+#define SHM_DEFAULT_SLOTS     8
+#define SHM_DEFAULT_READERS   8
+#define SHM_ALIGN             64
+
+/*
+ * Frame n lives in slot n % slots, whose seq is 2n + 1 while the publisher
+ * writes it and 2n + 2 once it is complete. A reader announces the frame
+ * it reads in its cursor's hold before checking seq, and the publisher
+ * marks a slot odd before checking the holds, so with sequentially
+ * consistent atomics one of them always sees the other: the publisher
+ * then keeps the slot (PROTECT), or the reader finds it gone. Readers
+ * sleep on a futex word the publisher bumps for every frame. Everything
+ * is in host byte order, for processes on the same machine.
+ */
+typedef struct {
+    char magic[8];
+    u32 version;
+    u32 slots;
+    u32 slot_size;
+    u32 readers;
+    u32 data_offset;        /* of slot 0's picture */
+    s32 policy;
+    atomic_llong published; /* frames in the ring so far, the next frame's number */
+    atomic_llong dropped;   /* by the publisher */
+    atomic_int wake;        /* futex word */
+    atomic_int closed;
+} MyShmHeader;
+
+typedef struct {
+    atomic_llong seq;
+    s64 pts;
+    s32 width;
+    s32 height;
+    s32 format;             /* MyPixFmt */
+    s32 av_format;
+    s32 offset[4];          /* of the planes in the slot, -1 for none */
+    s32 linesize[4];
+} MyShmSlot;
+
+typedef struct {
+    atomic_int pid;         /* 0 while the cursor is free */
+    atomic_llong next;      /* frame to read next */
+    atomic_llong hold;      /* frame being read, -1 for none */
+    atomic_llong dropped;
+} MyShmCursor;
+
+struct MyShmRing {
+    s8 *name;
+    u8 *map;
+    size_t map_size;
+    s32 writer;
+    MyShmHeader *header;
+    MyShmSlot *slots;
+    MyShmCursor *cursors;
+    MyShmCursor *cursor;    /* a reader's own */
+};
+
+static size_t shm_align(size_t size)
+{
+    return (size + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1);
+}
+
+static void shm_layout(struct MyShmRing *shm)
+{
+    MyShmHeader *h = (MyShmHeader *)shm->map;
+
+    shm->header = h;
+    shm->slots = (MyShmSlot *)(shm->map + shm_align(sizeof(MyShmHeader)));
+    shm->cursors = (MyShmCursor *)((u8 *)shm->slots + shm_align(h->slots * sizeof(MyShmSlot)));
+}
+
+static u8 *shm_slot_data(struct MyShmRing *shm, s64 n)
+{
+    MyShmHeader *h = shm->header;
+
+    return shm->map + h->data_offset + (n % h->slots) * h->slot_size;
+}
+
+static void shm_free(struct MyShmRing *shm)
+{
+    if (shm->map)
+        munmap(shm->map, shm->map_size);
+    av_free(shm->name);
+    av_free(shm);
+}
+
+MyShm mydecoder_shm_create(const s8 *name, const MyShmConfig *config)
+{
+    struct MyShmRing *shm;
+    MyShmHeader *h;
+    u32 slots = config->slots > 0 ? config->slots : SHM_DEFAULT_SLOTS;
+    u32 readers = config->readers > 0 ? config->readers : SHM_DEFAULT_READERS;
+    size_t meta, slot_size;
+    s32 fd;
+    u32 i;
+
+    if (config->slot_size <= 0) {
+        mydecoder_err("No slot size given\n");
+        return NULL;
+    }
+    shm = (struct MyShmRing *)av_mallocz(sizeof(struct MyShmRing));
+    if (!shm)
+        return NULL;
+    shm->name = av_strdup(name);
+    shm->writer = 1;
+    slot_size = shm_align(config->slot_size);
+    meta = shm_align(sizeof(MyShmHeader)) + shm_align(slots * sizeof(MyShmSlot)) +
+           shm_align(readers * sizeof(MyShmCursor));
+    shm->map_size = meta + slots * slot_size;
+
+    /* a ring left behind by a publisher that died is replaced */
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 || ftruncate(fd, shm->map_size) < 0) {
+        mydecoder_err("Could not create shared memory %s: %s\n", name, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+            shm_unlink(name);
+        }
+        shm_free(shm);
+        return NULL;
+    }
+    shm->map = (u8 *)mmap(NULL, shm->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == shm->map) {
+        mydecoder_err("Could not map shared memory %s\n", name);
+        shm->map = NULL;
+        shm_unlink(name);
+        shm_free(shm);
+        return NULL;
+    }
+
+    /* ftruncate zero fills, so cursors start free */
+    h = (MyShmHeader *)shm->map;
+    h->version = SHM_VERSION;
+    h->slots = slots;
+    h->slot_size = slot_size;
+    h->readers = readers;
+    h->data_offset = meta;
+    h->policy = config->policy;
+    shm_layout(shm);
+    for (i = 0; i < readers; i++)
+        atomic_init(&shm->cursors[i].hold, -1);
+    /* readers check the magic last */
+    atomic_thread_fence(memory_order_release);
+    memcpy(h->magic, SHM_MAGIC, sizeof(h->magic));
+    return shm;
+}
+
+/* Whether a live reader holds the frame that is in slot n % slots before n */
+static s32 shm_slot_held(struct MyShmRing *shm, s64 n)
+{
+    MyShmCursor *c;
+    s64 hold;
+    s32 pid;
+    u32 i;
+
+    for (i = 0; i < shm->header->readers; i++) {
+        c = &shm->cursors[i];
+        pid = atomic_load(&c->pid);
+        hold = atomic_load(&c->hold);
+        if (!pid || hold < 0 || hold >= n || hold % shm->header->slots != n % shm->header->slots)
+            continue;
+        /* a reader that died while reading gives its slot back */
+        if (kill(pid, 0) < 0 && ESRCH == errno) {
+            atomic_store(&c->hold, -1);
+            atomic_compare_exchange_strong(&c->pid, &pid, 0);
+            continue;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* Claim the next slot, NULL when the policy keeps it for a reader */
+static u8 *shm_begin(struct MyShmRing *shm, s64 *n)
+{
+    MyShmHeader *h = shm->header;
+    MyShmSlot *slot;
+    long long prev;
+
+    *n = atomic_load(&h->published);
+    slot = &shm->slots[*n % h->slots];
+    prev = atomic_load(&slot->seq);
+    atomic_store(&slot->seq, 2 * *n + 1);
+    if (MYDECODER_SHM_PROTECT == h->policy && shm_slot_held(shm, *n)) {
+        atomic_store(&slot->seq, prev);
+        atomic_fetch_add(&h->dropped, 1);
+        return NULL;
+    }
+    return shm_slot_data(shm, *n);
+}
+
+static void shm_commit(struct MyShmRing *shm, s64 n)
+{
+    MyShmHeader *h = shm->header;
+
+    atomic_store(&shm->slots[n % h->slots].seq, 2 * n + 2);
+    atomic_store(&h->published, n + 1);
+    atomic_fetch_add(&h->wake, 1);
+    syscall(SYS_futex, &h->wake, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+/* Slot metadata from view-ordered planes that all lie in the slot */
+static void shm_describe(MyShmSlot *slot, const u8 *base, u8 *const data[4],
+    const s32 linesize[4], s32 width, s32 height, MyPixFmt format, s32 av_format, s64 pts)
+{
+    s32 i;
+
+    for (i = 0; i < 4; i++) {
+        slot->offset[i] = data[i] ? (s32)(data[i] - base) : -1;
+        slot->linesize[i] = data[i] ? linesize[i] : 0;
+    }
+    slot->width = width;
+    slot->height = height;
+    slot->format = format;
+    slot->av_format = av_format;
+    slot->pts = pts;
+}
+
+s32 mydecoder_shm_publish(MyContext ctx, MyShm shm, MyFrame frame)
+{
+    AVFrame *avfrm = (AVFrame *)frame;
+    MyOutFormat out_format = ctx->out_format;
+    u8 *base, *data[4];
+    s32 linesize[4];
+    s32 width, height, ret;
+    MyPixFmt format;
+    s64 n;
+
+#ifdef RK_PLAT
+    if (ctx->use_rkmpp) {
+        avfrm = mydecoder_ring_peek(ctx);
+        if (!avfrm)
+            return -1;
+    }
+#endif
+    mydecoder_output_size(ctx, avfrm, &width, &height);
+    if (mydecoder_output_buffer_size(out_format, width, height) > (s32)shm->header->slot_size) {
+        mydecoder_err("%dx%d frame does not fit a %u byte slot\n", width, height,
+                      shm->header->slot_size);
+        ret = AVERROR(ENOSPC);
+        goto end;
+    }
+    if (mydecoder_motion_gate(ctx, avfrm)) {
+        ret = MYDECODER_UNCHANGED;
+        goto end;
+    }
+    base = shm_begin(shm, &n);
+    if (!base) {
+        ret = 1;
+        goto end;
+    }
+    ret = mydecoder_retrieve_avframe(ctx, avfrm, base);
+    mydecoder_out_planes(out_format, base, width, height, data, linesize);
+    format = MYDECODER_OUT_RGB_PLANAR == out_format ? MYDECODER_PIX_FMT_RGB_PLANAR :
+             mydecoder_pix_fmt(mydecoder_out_av_format(out_format));
+    /*
+     * A failed conversion still takes its number, since the slot's old
+     * picture is gone, but is described as empty: 0x0 without planes,
+     * which readers skip.
+     */
+    if (ret < 0) {
+        memset(data, 0, sizeof(data));
+        width = height = 0;
+    }
+    shm_describe(&shm->slots[n % shm->header->slots], base, data, linesize, width, height,
+                 format, mydecoder_out_av_format(out_format), avfrm->pts);
+    shm_commit(shm, n);
+
+end:
+#ifdef RK_PLAT
+    if (ctx->use_rkmpp)
+        mydecoder_ring_pop(ctx);
+#endif
+    return ret;
+}
+
+s32 mydecoder_shm_write(MyShm shm, const MyFrameView *view)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(view->av_format);
+    s32 bytes[4], rows[4], size = 0, shift, i;
+    u8 *base, *data[4];
+    s64 n;
+
+    if (!desc || av_image_fill_linesizes(bytes, view->av_format, view->width) < 0)
+        return AVERROR(EINVAL);
+    for (i = 0; i < 4; i++) {
+        shift = (1 == i || 2 == i) && !(desc->flags & AV_PIX_FMT_FLAG_RGB) ?
+                desc->log2_chroma_h : 0;
+        rows[i] = view->data[i] ? -(-view->height >> shift) : 0;
+        size += bytes[i] * rows[i];
+    }
+    if (size > (s32)shm->header->slot_size) {
+        mydecoder_err("%dx%d frame does not fit a %u byte slot\n", view->width, view->height,
+                      shm->header->slot_size);
+        return AVERROR(ENOSPC);
+    }
+
+    base = shm_begin(shm, &n);
+    if (!base)
+        return 1;
+    /* planes keep the view's order, tightly packed */
+    data[0] = base;
+    for (i = 0; i < 4; i++) {
+        if (i)
+            data[i] = rows[i] ? data[i - 1] + bytes[i - 1] * rows[i - 1] : NULL;
+        if (rows[i])
+            av_image_copy_plane(data[i], bytes[i], view->data[i], view->linesize[i], bytes[i],
+                                rows[i]);
+    }
+    shm_describe(&shm->slots[n % shm->header->slots], base, data, bytes, view->width,
+                 view->height, view->format, view->av_format, view->pts);
+    shm_commit(shm, n);
+    return 0;
+}
+
+void mydecoder_shm_destroy(MyShm shm)
+{
+    if (!shm)
+        return;
+    atomic_store(&shm->header->closed, 1);
+    atomic_fetch_add(&shm->header->wake, 1);
+    syscall(SYS_futex, &shm->header->wake, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+    shm_unlink(shm->name);
+    shm_free(shm);
+}
+
+MyShm mydecoder_shm_open(const s8 *name)
+{
+    struct MyShmRing *shm;
+    MyShmHeader header;
+    struct stat st;
+    s32 fd, pid, free_pid;
+    u32 i;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        mydecoder_err("Could not open shared memory %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    shm = (struct MyShmRing *)av_mallocz(sizeof(struct MyShmRing));
+    if (!shm || fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(MyShmHeader)) {
+        close(fd);
+        av_free(shm);
+        return NULL;
+    }
+    shm->name = av_strdup(name);
+    shm->map_size = st.st_size;
+    shm->map = (u8 *)mmap(NULL, shm->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == shm->map) {
+        shm->map = NULL;
+        shm_free(shm);
+        return NULL;
+    }
+
+    memcpy(&header, shm->map, sizeof(header.magic) + sizeof(header.version));
+    if (memcmp(header.magic, SHM_MAGIC, sizeof(header.magic)) || SHM_VERSION != header.version) {
+        mydecoder_err("%s is not a frame ring\n", name);
+        shm_free(shm);
+        return NULL;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    shm_layout(shm);
+
+    /* a free cursor, else one of a reader that died without closing */
+    pid = getpid();
+    for (i = 0; !shm->cursor && i < 2 * shm->header->readers; i++) {
+        MyShmCursor *c = &shm->cursors[i % shm->header->readers];
+
+        free_pid = atomic_load(&c->pid);
+        if (free_pid && (i < shm->header->readers || kill(free_pid, 0) == 0 || ESRCH != errno))
+            continue;
+        if (atomic_compare_exchange_strong(&c->pid, &free_pid, pid))
+            shm->cursor = c;
+    }
+    if (!shm->cursor) {
+        mydecoder_err("All %u readers of %s are taken\n", shm->header->readers, name);
+        shm_free(shm);
+        return NULL;
+    }
+    /* new frames only */
+    atomic_store(&shm->cursor->hold, -1);
+    atomic_store(&shm->cursor->dropped, 0);
+    atomic_store(&shm->cursor->next, atomic_load(&shm->header->published));
+    return shm;
+}
+
+static s32 shm_wait(struct MyShmRing *shm, s32 wake, s32 timeout_ms)
+{
+    struct timespec ts;
+
+    if (timeout_ms < 0)
+        return syscall(SYS_futex, &shm->header->wake, FUTEX_WAIT, wake, NULL, NULL, 0);
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    return syscall(SYS_futex, &shm->header->wake, FUTEX_WAIT, wake, &ts, NULL, 0);
+}
+
+s32 mydecoder_shm_read(MyShm shm, MyFrameView *view, s32 timeout_ms)
+{
+    MyShmHeader *h = shm->header;
+    MyShmCursor *c = shm->cursor;
+    MyShmSlot *slot;
+    s64 n, published;
+    long long seq;
+    u8 *base;
+    s32 offset[4], wake, i;
+
+    atomic_store(&c->hold, -1);
+    while (1) {
+        wake = atomic_load(&h->wake);
+        n = atomic_load(&c->next);
+        published = atomic_load(&h->published);
+        if (n >= published) {
+            if (atomic_load(&h->closed))
+                return AVERROR_EOF;
+            /* a timeout is all a futex wait reports that matters here */
+            if (shm_wait(shm, wake, timeout_ms) < 0 && ETIMEDOUT == errno)
+                return AVERROR(EAGAIN);
+            continue;
+        }
+        /* more than a ring behind: skip to the oldest frame still there */
+        if (published - n > h->slots) {
+            atomic_fetch_add(&c->dropped, published - h->slots - n);
+            n = published - h->slots;
+        }
+
+        atomic_store(&c->hold, n);
+        slot = &shm->slots[n % h->slots];
+        seq = atomic_load(&slot->seq);
+        if (seq == 2 * n + 2) {
+            /* a seqlock: the copy counts only if seq is unchanged after it */
+            for (i = 0; i < 4; i++) {
+                offset[i] = slot->offset[i];
+                view->linesize[i] = slot->linesize[i];
+            }
+            view->width = slot->width;
+            view->height = slot->height;
+            view->format = (MyPixFmt)slot->format;
+            view->av_format = slot->av_format;
+            view->pts = slot->pts;
+            atomic_thread_fence(memory_order_acquire);
+            /* an empty slot is a frame the publisher failed to convert */
+            if (atomic_load(&slot->seq) == seq && view->width > 0)
+                break;
+        }
+        /* overwritten since published was read, or empty; take the next one */
+        atomic_store(&c->hold, -1);
+        atomic_fetch_add(&c->dropped, 1);
+        atomic_store(&c->next, n + 1);
+    }
+
+    base = shm_slot_data(shm, n);
+    for (i = 0; i < 4; i++)
+        view->data[i] = offset[i] >= 0 ? base + offset[i] : NULL;
+    view->priv = NULL;
+    atomic_store(&c->next, n + 1);
+    return 0;
+}
+
+s32 mydecoder_shm_done(MyShm shm)
+{
+    MyShmCursor *c = shm->cursor;
+    s64 n = atomic_load(&c->hold);
+    s32 ret = 0;
+
+    if (n < 0)
+        return 0;
+    if (atomic_load(&shm->slots[n % shm->header->slots].seq) != 2 * n + 2)
+        ret = AVERROR(ESTALE);
+    atomic_store(&c->hold, -1);
+    return ret;
+}
+
+s64 mydecoder_shm_dropped(MyShm shm)
+{
+    if (shm->writer)
+        return atomic_load(&shm->header->dropped);
+    return atomic_load(&shm->cursor->dropped);
+}
+
+void mydecoder_shm_close(MyShm shm)
+{
+    if (!shm)
+        return;
+    atomic_store(&shm->cursor->hold, -1);
+    atomic_store(&shm->cursor->pid, 0);
+    shm_free(shm);
+}
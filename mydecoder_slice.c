@@ -0,0 +1,169 @@
+#include <pthread.h>
+
+#include "mydecoder_internal.h"
+
+#define SLICE_MIN_ROWS    64     /* below that a band is not worth a hand-off */
+
+/*
+ * Horizontal bands of one conversion run on a worker pool shared by all
+ * contexts. The pool only grows, to the largest thread count any context
+ * asked for, and its threads live as long as the process. The calling
+ * thread takes bands as well, so a context asking for n threads uses n - 1
+ * workers, and a busy pool just means the caller does more of the bands.
+ */
+typedef struct MySliceJob {
+    MySliceFn fn;
+    void *arg;
+    s32 nb;
+    s32 next;               /* first band not taken */
+    s32 finished;
+    pthread_cond_t done;
+    struct MySliceJob *link;
+} MySliceJob;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    MySliceJob *head;       /* jobs with bands left, oldest first */
+    MySliceJob *tail;
+    s32 nb_threads;
+} slice_pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0 };
+
+/* Everything below runs under the pool lock */
+static void slice_unlink(MySliceJob *job)
+{
+    MySliceJob **p = &slice_pool.head, *prev = NULL;
+
+    while (*p != job) {
+        prev = *p;
+        p = &(*p)->link;
+    }
+    *p = job->link;
+    if (slice_pool.tail == job)
+        slice_pool.tail = prev;
+}
+
+/* Next band of job; the job leaves the list with its last band */
+static s32 slice_next(MySliceJob *job)
+{
+    s32 band = job->next++;
+
+    if (job->next == job->nb)
+        slice_unlink(job);
+    return band;
+}
+
+static void slice_finish(MySliceJob *job)
+{
+    if (++job->finished == job->nb)
+        pthread_cond_signal(&job->done);
+}
+
+static void *slice_worker(void *arg)
+{
+    MySliceJob *job;
+    s32 band;
+
+    (void)arg;
+    pthread_mutex_lock(&slice_pool.lock);
+    while (1) {
+        job = slice_pool.head;
+        if (!job) {
+            pthread_cond_wait(&slice_pool.cond, &slice_pool.lock);
+            continue;
+        }
+        band = slice_next(job);
+        pthread_mutex_unlock(&slice_pool.lock);
+        job->fn(job->arg, band, job->nb);
+        pthread_mutex_lock(&slice_pool.lock);
+        slice_finish(job);
+    }
+    return NULL;
+}
+
+static void slice_pool_grow(s32 nb_threads)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    pthread_mutex_lock(&slice_pool.lock);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    while (slice_pool.nb_threads < nb_threads) {
+        if (pthread_create(&thread, &attr, slice_worker, NULL)) {
+            mydecoder_err("Could not start conversion thread\n");
+            break;
+        }
+        slice_pool.nb_threads++;
+    }
+    pthread_attr_destroy(&attr);
+    pthread_mutex_unlock(&slice_pool.lock);
+}
+
+s32 mydecoder_set_convert_threads(MyContext ctx, s32 threads)
+{
+    if (threads < 0 || threads > MYDECODER_CONVERT_THREADS_MAX) {
+        mydecoder_err("Invalid conversion thread count %d\n", threads);
+        return -1;
+    }
+    ctx->convert_threads = threads;
+    if (threads > 1)
+        slice_pool_grow(threads - 1);
+    return 0;
+}
+
+s32 mydecoder_slice_count(MyContext ctx, s32 rows)
+{
+    s32 nb = ctx->convert_threads;
+
+    if (nb > rows / SLICE_MIN_ROWS)
+        nb = rows / SLICE_MIN_ROWS;
+    return nb > 1 ? nb : 1;
+}
+
+/* First row of a band, a multiple of align so chroma rows are not split */
+s32 mydecoder_slice_row(s32 rows, s32 band, s32 nb_bands, s32 align)
+{
+    if (band >= nb_bands)
+        return rows;
+    return (s32)((long long)rows * band / nb_bands) & ~(align - 1);
+}
+
+void mydecoder_slice_run(MySliceFn fn, void *arg, s32 nb_bands)
+{
+    MySliceJob job;
+    s32 band;
+
+    if (nb_bands <= 1) {
+        fn(arg, 0, 1);
+        return;
+    }
+    job.fn = fn;
+    job.arg = arg;
+    job.nb = nb_bands;
+    job.next = 0;
+    job.finished = 0;
+    job.link = NULL;
+    pthread_cond_init(&job.done, NULL);
+
+    pthread_mutex_lock(&slice_pool.lock);
+    if (slice_pool.tail)
+        slice_pool.tail->link = &job;
+    else
+        slice_pool.head = &job;
+    slice_pool.tail = &job;
+    pthread_cond_broadcast(&slice_pool.cond);
+
+    /* help with our own bands, then wait for the ones workers took */
+    while (job.next < job.nb) {
+        band = slice_next(&job);
+        pthread_mutex_unlock(&slice_pool.lock);
+        fn(arg, band, nb_bands);
+        pthread_mutex_lock(&slice_pool.lock);
+        slice_finish(&job);
+    }
+    while (job.finished < job.nb)
+        pthread_cond_wait(&job.done, &slice_pool.lock);
+    pthread_mutex_unlock(&slice_pool.lock);
+    pthread_cond_destroy(&job.done);
+}
@@ -0,0 +1,216 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "mydecoder_internal.h"
+
+static const char *timer_names[MYDECODER_TIMER_NB] = {
+    "read", "send", "receive", "convert", "latency",
+};
+
+static const char *drop_names[MYDECODER_DROP_NB] = {
+    "skipped", "sampled", "overrun", "corrupt", "unchanged", "convert",
+};
+
+#define stat_load(v)    atomic_load_explicit(&(v), memory_order_relaxed)
+
+s64 mydecoder_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void mydecoder_timer_add(MyContext ctx, MyTimer timer, s64 start)
+{
+    MyTimerState *t = &ctx->stats.timers[timer];
+    s64 ns = mydecoder_now_ns() - start;
+    unsigned long long us = ns / 1000;
+    s32 bucket = us ? 64 - __builtin_clzll(us) : 0;
+
+    if (bucket >= MYDECODER_STATS_BUCKETS)
+        bucket = MYDECODER_STATS_BUCKETS - 1;
+    atomic_store_explicit(&t->count, stat_load(t->count) + 1, memory_order_relaxed);
+    atomic_store_explicit(&t->total_ns, stat_load(t->total_ns) + ns, memory_order_relaxed);
+    if (ns > stat_load(t->max_ns))
+        atomic_store_explicit(&t->max_ns, ns, memory_order_relaxed);
+    atomic_store_explicit(&t->buckets[bucket], stat_load(t->buckets[bucket]) + 1,
+                          memory_order_relaxed);
+}
+
+s32 mydecoder_set_stats(MyContext ctx, s32 timing)
+{
+#if MYDECODER_STATS
+    ctx->stats.timing = !!timing;
+    return 0;
+#else
+    mydecoder_err("Built without MYDECODER_STATS\n");
+    return -1;
+#endif
+}
+
+s32 mydecoder_get_stats(MyContext ctx, MyStats *stats)
+{
+    MyStatsState *s = &ctx->stats;
+    s32 i, j;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->packets = stat_load(s->packets);
+    stats->bytes = stat_load(s->bytes);
+    stats->frames_decoded = stat_load(s->frames_decoded);
+    stats->frames_converted = stat_load(s->frames_converted);
+    stats->decode_errors = stat_load(s->decode_errors);
+    stats->open_us = stat_load(s->open_ns) / 1000;
+    stats->first_frame_us = stat_load(s->first_frame_ns) / 1000;
+    stats->frame_interval_us = stat_load(s->frame_interval_ns) / 1000;
+    stats->late_frames = stat_load(s->late_frames);
+    for (i = 0; i < MYDECODER_DROP_NB; i++)
+        stats->dropped[i] = stat_load(s->dropped[i]);
+    for (i = 0; i < MYDECODER_TIMER_NB; i++) {
+        MyTimerState *t = &s->timers[i];
+
+        stats->timers[i].count = stat_load(t->count);
+        stats->timers[i].total_ns = stat_load(t->total_ns);
+        stats->timers[i].max_ns = stat_load(t->max_ns);
+        for (j = 0; j < MYDECODER_STATS_BUCKETS; j++)
+            stats->timers[i].buckets[j] = stat_load(t->buckets[j]);
+    }
+
+#ifdef RK_PLAT
+    if (ctx->use_rkmpp) {
+        /* the ring drops its oldest frame instead of filling up completely */
+        stats->ring_size = MAX_BUFFER_FRAMES - 1;
+        stats->ring_frames = (ctx->w_idx + MAX_BUFFER_FRAMES - ctx->r_idx) % MAX_BUFFER_FRAMES;
+        stats->ring_high_water = stat_load(s->ring_high_water);
+    }
+#endif
+    return 0;
+}
+
+/* snprintf that keeps counting once buf is full */
+typedef struct {
+    char *buf;
+    s32 size;
+    s32 len;
+} MyDump;
+
+static void dump_printf(MyDump *d, const char *fmt, ...)
+{
+    va_list args;
+    s32 ret;
+
+    va_start(args, fmt);
+    ret = vsnprintf(d->len < d->size ? d->buf + d->len : NULL,
+                    d->len < d->size ? d->size - d->len : 0, fmt, args);
+    va_end(args);
+    if (ret > 0)
+        d->len += ret;
+}
+
+static void dump_prometheus(MyDump *d, const MyStats *stats, const char *label)
+{
+    char l[128], lc[136];
+    s32 i, j;
+
+    if (label) {
+        snprintf(l, sizeof(l), "{stream=\"%s\"}", label);
+        snprintf(lc, sizeof(lc), "stream=\"%s\",", label);
+    } else {
+        l[0] = lc[0] = 0;
+    }
+
+    dump_printf(d, "# TYPE mydecoder_packets_total counter\nmydecoder_packets_total%s %lld\n",
+                l, stats->packets);
+    dump_printf(d, "# TYPE mydecoder_bytes_total counter\nmydecoder_bytes_total%s %lld\n",
+                l, stats->bytes);
+    dump_printf(d, "# TYPE mydecoder_frames_decoded_total counter\n"
+                "mydecoder_frames_decoded_total%s %lld\n", l, stats->frames_decoded);
+    dump_printf(d, "# TYPE mydecoder_frames_converted_total counter\n"
+                "mydecoder_frames_converted_total%s %lld\n", l, stats->frames_converted);
+    dump_printf(d, "# TYPE mydecoder_frames_dropped_total counter\n");
+    for (i = 0; i < MYDECODER_DROP_NB; i++)
+        dump_printf(d, "mydecoder_frames_dropped_total{%sreason=\"%s\"} %lld\n",
+                    lc, drop_names[i], stats->dropped[i]);
+    dump_printf(d, "# TYPE mydecoder_decode_errors_total counter\n"
+                "mydecoder_decode_errors_total%s %lld\n", l, stats->decode_errors);
+    dump_printf(d, "# TYPE mydecoder_open_seconds gauge\nmydecoder_open_seconds%s %.6f\n",
+                l, stats->open_us * 1e-6);
+    dump_printf(d, "# TYPE mydecoder_first_frame_seconds gauge\n"
+                "mydecoder_first_frame_seconds%s %.6f\n", l, stats->first_frame_us * 1e-6);
+    dump_printf(d, "# TYPE mydecoder_ring_frames gauge\nmydecoder_ring_frames%s %d\n",
+                l, stats->ring_frames);
+    dump_printf(d, "# TYPE mydecoder_ring_high_water gauge\nmydecoder_ring_high_water%s %d\n",
+                l, stats->ring_high_water);
+    dump_printf(d, "# TYPE mydecoder_frame_interval_seconds gauge\n"
+                "mydecoder_frame_interval_seconds%s %.6f\n", l, stats->frame_interval_us * 1e-6);
+    dump_printf(d, "# TYPE mydecoder_late_frames_total counter\n"
+                "mydecoder_late_frames_total%s %lld\n", l, stats->late_frames);
+
+    dump_printf(d, "# TYPE mydecoder_stage_seconds histogram\n");
+    for (i = 0; i < MYDECODER_TIMER_NB; i++) {
+        const MyTimerStats *t = &stats->timers[i];
+        s64 cumulative = 0;
+
+        for (j = 0; j < MYDECODER_STATS_BUCKETS - 1; j++) {
+            cumulative += t->buckets[j];
+            dump_printf(d, "mydecoder_stage_seconds_bucket{%sstage=\"%s\",le=\"%g\"} %lld\n",
+                        lc, timer_names[i], (1 << j) * 1e-6, cumulative);
+        }
+        dump_printf(d, "mydecoder_stage_seconds_bucket{%sstage=\"%s\",le=\"+Inf\"} %lld\n",
+                    lc, timer_names[i], t->count);
+        dump_printf(d, "mydecoder_stage_seconds_sum{%sstage=\"%s\"} %.9f\n",
+                    lc, timer_names[i], t->total_ns * 1e-9);
+        dump_printf(d, "mydecoder_stage_seconds_count{%sstage=\"%s\"} %lld\n",
+                    lc, timer_names[i], t->count);
+    }
+    dump_printf(d, "# TYPE mydecoder_stage_max_seconds gauge\n");
+    for (i = 0; i < MYDECODER_TIMER_NB; i++)
+        dump_printf(d, "mydecoder_stage_max_seconds{%sstage=\"%s\"} %.9f\n",
+                    lc, timer_names[i], stats->timers[i].max_ns * 1e-9);
+}
+
+static void dump_json(MyDump *d, const MyStats *stats, const char *label)
+{
+    s32 i, j;
+
+    dump_printf(d, "{");
+    if (label)
+        dump_printf(d, "\"stream\":\"%s\",", label);
+    dump_printf(d, "\"packets\":%lld,\"bytes\":%lld,\"frames_decoded\":%lld,"
+                "\"frames_converted\":%lld,\"decode_errors\":%lld,\"dropped\":{",
+                stats->packets, stats->bytes, stats->frames_decoded,
+                stats->frames_converted, stats->decode_errors);
+    for (i = 0; i < MYDECODER_DROP_NB; i++)
+        dump_printf(d, "%s\"%s\":%lld", i ? "," : "", drop_names[i], stats->dropped[i]);
+    dump_printf(d, "},\"open_us\":%lld,\"first_frame_us\":%lld",
+                stats->open_us, stats->first_frame_us);
+    dump_printf(d, ",\"frame_interval_us\":%lld,\"late_frames\":%lld",
+                stats->frame_interval_us, stats->late_frames);
+    dump_printf(d, ",\"ring\":{\"frames\":%d,\"size\":%d,\"high_water\":%d},\"timers\":{",
+                stats->ring_frames, stats->ring_size, stats->ring_high_water);
+    for (i = 0; i < MYDECODER_TIMER_NB; i++) {
+        const MyTimerStats *t = &stats->timers[i];
+
+        dump_printf(d, "%s\"%s\":{\"count\":%lld,\"total_ns\":%lld,\"max_ns\":%lld,\"buckets_us\":[",
+                    i ? "," : "", timer_names[i], t->count, t->total_ns, t->max_ns);
+        for (j = 0; j < MYDECODER_STATS_BUCKETS; j++)
+            dump_printf(d, "%s%lld", j ? "," : "", t->buckets[j]);
+        dump_printf(d, "]}");
+    }
+    dump_printf(d, "}}\n");
+}
+
+s32 mydecoder_stats_dump(const MyStats *stats, MyStatsFormat format, const char *label,
+    char *buf, s32 size)
+{
+    MyDump d = { buf, buf ? size : 0, 0 };
+
+    if (d.size > 0)
+        buf[0] = 0;
+    if (MYDECODER_STATS_JSON == format)
+        dump_json(&d, stats, label);
+    else
+        dump_prometheus(&d, stats, label);
+    return d.len;
+}
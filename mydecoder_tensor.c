@@ -0,0 +1,268 @@
+#include <libavutil/hwcontext.h>
+#include <libavutil/mem.h>
+
+#include "mydecoder_internal.h"
+
+/*
+ * Frames are converted one row at a time into a BGR24 line that stays in
+ * cache, and the line is scattered straight into the tensor with the
+ * channel order, normalisation and element type applied on the way.
+ */
+typedef struct {
+    s32 src[3];         /* byte of a BGR24 pixel feeding output channel c */
+    float scale[3];
+    float bias[3];
+} MyTensorMap;
+
+/* Where one decoded frame's rows come from */
+typedef struct {
+    AVFrame *frame;
+    MyYuvCoeffs coeffs;
+    const u8 *bgr;      /* whole frame already in BGR24, other formats */
+    struct MyScaler *scaler;
+    u8 *data[4];
+    s32 linesize[4];
+} MyTensorSrc;
+
+static s32 tensor_elem_size(MyTensorDtype dtype)
+{
+    if (MYDECODER_DTYPE_F32 == dtype)
+        return 4;
+    if (MYDECODER_DTYPE_F16 == dtype)
+        return 2;
+    return 1;
+}
+
+static void tensor_map_init(MyTensorMap *map, const MyTensorDesc *desc)
+{
+    s32 c;
+
+    for (c = 0; c < 3; c++) {
+        float std = desc->std[c] != 0 ? desc->std[c] : 1.0f;
+
+        map->src[c] = MYDECODER_ORDER_RGB == desc->order ? 2 - c : c;
+        map->scale[c] = 1.0f / std;
+        map->bias[c] = -desc->mean[c] / std;
+    }
+}
+
+static s32 tensor_src_init(MyContext ctx, MyTensorSrc *src, AVFrame *frame,
+    const MyTensorDesc *desc)
+{
+    s32 format, ret;
+
+    src->frame = frame;
+    src->bgr = NULL;
+    src->scaler = NULL;
+    mydecoder_frame_coeffs(ctx, frame, &src->coeffs);
+
+    if (frame->width != desc->width || frame->height != desc->height) {
+        ret = mydecoder_scaler_source(ctx, frame, src->data, src->linesize, &format);
+        if (ret < 0)
+            return ret;
+        src->scaler = mydecoder_scaler_get(ctx, frame->width, frame->height, format,
+                                           desc->width, desc->height);
+        return src->scaler ? 0 : AVERROR(ENOMEM);
+    }
+
+    if (AV_PIX_FMT_NV12 == frame->format || AV_PIX_FMT_YUV420P == frame->format ||
+        AV_PIX_FMT_YUVJ420P == frame->format)
+        return 0;
+
+    av_fast_malloc(&ctx->frame_buf, &ctx->frame_buf_size, frame->width * frame->height * 3);
+    if (!ctx->frame_buf)
+        return AVERROR(ENOMEM);
+    mydecoder_retrieve_frame_sws(ctx, frame, ctx->frame_buf);
+    src->bgr = ctx->frame_buf;
+    return 0;
+}
+
+/* BGR24 row y of the tensor image, converted into line unless it exists already */
+static const u8 *tensor_src_row(const MyTensorSrc *src, s32 y, u8 *line)
+{
+    const AVFrame *f = src->frame;
+
+    if (src->scaler) {
+        mydecoder_scaler_row(src->scaler, src->data, src->linesize, &src->coeffs, y, line);
+        return line;
+    }
+    if (src->bgr)
+        return src->bgr + y * f->width * 3;
+
+    if (AV_PIX_FMT_NV12 == f->format) {
+        mydecoder_nv12_row_bgr24(f->data[0] + y * f->linesize[0],
+                                 f->data[1] + (y >> 1) * f->linesize[1],
+                                 line, f->width, &src->coeffs);
+    } else {
+        mydecoder_i420_row_bgr24(f->data[0] + y * f->linesize[0],
+                                 f->data[1] + (y >> 1) * f->linesize[1],
+                                 f->data[2] + (y >> 1) * f->linesize[2],
+                                 line, f->width, &src->coeffs);
+    }
+    return line;
+}
+
+static void row_u8(const MyTensorMap *map, MyTensorLayout layout, const u8 *bgr,
+    s32 width, u8 *dst, size_t plane)
+{
+    s32 x, c;
+
+    if (MYDECODER_LAYOUT_NHWC == layout) {
+        for (x = 0; x < width; x++) {
+            dst[3 * x + 0] = bgr[3 * x + map->src[0]];
+            dst[3 * x + 1] = bgr[3 * x + map->src[1]];
+            dst[3 * x + 2] = bgr[3 * x + map->src[2]];
+        }
+        return;
+    }
+    for (c = 0; c < 3; c++) {
+        const u8 *s = bgr + map->src[c];
+        u8 *d = dst + c * plane;
+
+        for (x = 0; x < width; x++)
+            d[x] = s[3 * x];
+    }
+}
+
+static void row_f32(const MyTensorMap *map, MyTensorLayout layout, const u8 *bgr,
+    s32 width, float *dst, size_t plane)
+{
+    s32 x, c;
+
+    if (MYDECODER_LAYOUT_NHWC == layout) {
+        for (x = 0; x < width; x++) {
+            dst[3 * x + 0] = bgr[3 * x + map->src[0]] * map->scale[0] + map->bias[0];
+            dst[3 * x + 1] = bgr[3 * x + map->src[1]] * map->scale[1] + map->bias[1];
+            dst[3 * x + 2] = bgr[3 * x + map->src[2]] * map->scale[2] + map->bias[2];
+        }
+        return;
+    }
+    for (c = 0; c < 3; c++) {
+        const u8 *s = bgr + map->src[c];
+        float *d = dst + c * plane;
+        float scale = map->scale[c];
+        float bias = map->bias[c];
+
+        for (x = 0; x < width; x++)
+            d[x] = s[3 * x] * scale + bias;
+    }
+}
+
+/* Through a float row in tmp, laid out like the destination row */
+static void row_f16(const MyTensorMap *map, MyTensorLayout layout, const u8 *bgr,
+    s32 width, u16 *dst, size_t plane, float *tmp)
+{
+    s32 c;
+
+    if (MYDECODER_LAYOUT_NHWC == layout) {
+        row_f32(map, layout, bgr, width, tmp, 0);
+        mydecoder_float_to_half(dst, tmp, width * 3);
+        return;
+    }
+    row_f32(map, layout, bgr, width, tmp, width);
+    for (c = 0; c < 3; c++)
+        mydecoder_float_to_half(dst + c * plane, tmp + c * width, width);
+}
+
+static void tensor_write_frame(const MyTensorDesc *desc, const MyTensorMap *map,
+    const MyTensorSrc *src, u8 *base, u8 *line, float *tmp)
+{
+    size_t plane = (size_t)desc->width * desc->height;
+    s32 elem = tensor_elem_size(desc->dtype);
+    s32 direct = MYDECODER_DTYPE_U8 == desc->dtype && MYDECODER_LAYOUT_NHWC == desc->layout &&
+                 MYDECODER_ORDER_BGR == desc->order && !src->bgr;
+    s32 y;
+
+    for (y = 0; y < desc->height; y++) {
+        size_t offset = MYDECODER_LAYOUT_NHWC == desc->layout ?
+                        (size_t)y * desc->width * 3 : (size_t)y * desc->width;
+        u8 *dst = base + offset * elem;
+        const u8 *bgr;
+
+        if (direct) {
+            /* packed BGR24 is the tensor row itself */
+            tensor_src_row(src, y, dst);
+            continue;
+        }
+
+        bgr = tensor_src_row(src, y, line);
+        if (MYDECODER_DTYPE_U8 == desc->dtype)
+            row_u8(map, desc->layout, bgr, desc->width, dst, plane);
+        else if (MYDECODER_DTYPE_F32 == desc->dtype)
+            row_f32(map, desc->layout, bgr, desc->width, (float *)dst, plane);
+        else
+            row_f16(map, desc->layout, bgr, desc->width, (u16 *)dst, plane, tmp);
+    }
+}
+
+/* The next frame of the batch, mapped to memory when it lives in a dma-buf */
+static AVFrame *tensor_frame(MyContext ctx, MyFrame *frames, s32 i, AVFrame *mapped)
+{
+    AVFrame *frame;
+
+#ifdef RK_PLAT
+    if (ctx->use_rkmpp)
+        frame = mydecoder_ring_peek(ctx);
+    else
+#endif
+    frame = (AVFrame *)frames[i];
+
+    if (frame && AV_PIX_FMT_DRM_PRIME == frame->format) {
+        if (av_hwframe_map(mapped, frame, AV_HWFRAME_MAP_READ) < 0) {
+            mydecoder_err("Error mapping frame\n");
+            return NULL;
+        }
+        return mapped;
+    }
+    return frame;
+}
+
+s32 mydecoder_retrieve_batch(MyContext ctx, MyFrame *frames, s32 num,
+    const MyTensorDesc *desc, void *tensor)
+{
+    size_t frame_elems = (size_t)desc->width * desc->height * 3;
+    s32 elem = tensor_elem_size(desc->dtype);
+    MyTensorMap map;
+    MyTensorSrc src;
+    AVFrame *mapped, *frame;
+    s32 i, ret = 0;
+    s64 start;
+
+    if (num <= 0 || desc->width <= 0 || desc->height <= 0)
+        return AVERROR(EINVAL);
+
+    /* BGR24 line plus a float row for the f16 path */
+    av_fast_malloc(&ctx->line_buf, &ctx->line_buf_size, desc->width * (3 + 3 * sizeof(float)) + 64);
+    mapped = av_frame_alloc();
+    if (!ctx->line_buf || !mapped) {
+        mydecoder_err("Error allocating tensor scratch\n");
+        av_frame_free(&mapped);
+        return AVERROR(ENOMEM);
+    }
+    tensor_map_init(&map, desc);
+
+    for (i = 0; i < num; i++) {
+        frame = tensor_frame(ctx, frames, i, mapped);
+        if (!frame)
+            break;
+        start = mydecoder_timer_start(ctx);
+        ret = tensor_src_init(ctx, &src, frame, desc);
+        if (ret < 0)
+            break;
+        tensor_write_frame(desc, &map, &src, (u8 *)tensor + i * frame_elems * elem,
+                           ctx->line_buf, (float *)FFALIGN((uintptr_t)ctx->line_buf + desc->width * 3, 32));
+        mydecoder_timer_stop(ctx, MYDECODER_TIMER_CONVERT, start);
+        mydecoder_stat_add(ctx, frames_converted, 1);
+        av_frame_unref(mapped);
+#ifdef RK_PLAT
+        if (ctx->use_rkmpp)
+            mydecoder_ring_pop(ctx);
+#endif
+    }
+
+    av_frame_unref(mapped);
+    av_frame_free(&mapped);
+    if (ret < 0)
+        return ret;
+    return i;
+}
@@ -0,0 +1,30 @@
+#!/bin/sh
+# Generate synthetic clips for mydecoder_bench with ffmpeg's test sources,
+# so no sample media has to be checked in.
+# Usage: ./gen_clips.sh [out_dir] [seconds]
+
+OUT=${1:-clips}
+DURATION=${2:-10}
+
+set -e
+mkdir -p "$OUT"
+
+gen() {
+    name=$1
+    size=$2
+    shift 2
+    echo "$OUT/$name"
+    ffmpeg -loglevel error -y -f lavfi -i "testsrc2=size=$size:rate=25" -t "$DURATION" \
+        -pix_fmt yuv420p -g 50 "$@" "$OUT/$name"
+}
+
+# H.264 in MP4 (length prefixed) and as a raw Annex B stream, with B-frames
+gen h264_1080p.mp4 1920x1080 -c:v libx264 -preset veryfast -bf 2
+gen h264_1080p.h264 1920x1080 -c:v libx264 -preset veryfast -bf 2
+gen h264_720p.mp4 1280x720 -c:v libx264 -preset veryfast -bf 2
+# Baseline profile, what most cameras send
+gen h264_1080p_baseline.mp4 1920x1080 -c:v libx264 -preset veryfast -profile:v baseline
+# HEVC in MP4 and MPEG-TS
+gen hevc_1080p.mp4 1920x1080 -c:v libx265 -preset veryfast -tag:v hvc1 -x265-params log-level=error
+gen hevc_1080p.ts 1920x1080 -c:v libx265 -preset veryfast -x265-params log-level=error
+gen h264_4k.mp4 3840x2160 -c:v libx264 -preset veryfast -bf 2
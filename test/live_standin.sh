@@ -0,0 +1,17 @@
+#!/bin/sh
+# Serve a clip in real time as a stand-in for a camera, to measure
+# time to first frame with mydecoder_bench -F against a live source.
+# Usage: ./live_standin.sh clip [url]
+#   url defaults to udp://127.0.0.1:5000 (MPEG-TS). An rtsp:// url needs an
+#   RTSP server listening there, e.g. mediamtx.
+# Then: ./mydecoder_bench -F -k /tmp/params -n 50 -r 5 udp://127.0.0.1:5000
+
+CLIP=${1:?clip}
+URL=${2:-udp://127.0.0.1:5000}
+
+case "$URL" in
+rtsp://*) FORMAT=rtsp ;;
+*) FORMAT=mpegts ;;
+esac
+
+exec ffmpeg -loglevel error -re -stream_loop -1 -i "$CLIP" -c copy -an -f "$FORMAT" "$URL"
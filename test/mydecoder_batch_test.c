@@ -0,0 +1,151 @@
+#include <libavutil/avutil.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../mydecoder.h"
+
+/*
+ * Checks GOP-sharded batch decoding against decoding the file in one
+ * piece: the same frames, in the same order, with the same pixels. The
+ * reference is the async pipeline on a single context, which drains the
+ * decoder at the end just like every shard does.
+ */
+
+typedef struct {
+    s64 pts;
+    unsigned long long hash;
+} FrameSum;
+
+typedef struct {
+    FrameSum *sums;
+    s32 count;
+    s32 capacity;
+} FrameList;
+
+static s64 now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static unsigned long long hash_rows(unsigned long long hash, const u8 *data, s32 linesize,
+    s32 width, s32 height)
+{
+    s32 x, y;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++)
+            hash = (hash ^ data[y * linesize + x]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void list_add(FrameList *list, const MyFrameView *view)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    s32 w = view->width, h = view->height;
+
+    if (MYDECODER_PIX_FMT_BGR24 == view->format) {
+        hash = hash_rows(hash, view->data[0], view->linesize[0], w * 3, h);
+    } else if (MYDECODER_PIX_FMT_NV12 == view->format) {
+        hash = hash_rows(hash, view->data[0], view->linesize[0], w, h);
+        hash = hash_rows(hash, view->data[1], view->linesize[1], w, h / 2);
+    } else if (MYDECODER_PIX_FMT_I420 == view->format) {
+        hash = hash_rows(hash, view->data[0], view->linesize[0], w, h);
+        hash = hash_rows(hash, view->data[1], view->linesize[1], w / 2, h / 2);
+        hash = hash_rows(hash, view->data[2], view->linesize[2], w / 2, h / 2);
+    }
+
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 1024;
+        list->sums = (FrameSum *)realloc(list->sums, list->capacity * sizeof(FrameSum));
+        if (!list->sums) {
+            printf("Error allocating frame list\n");
+            exit(1);
+        }
+    }
+    list->sums[list->count].pts = view->pts;
+    list->sums[list->count].hash = hash;
+    list->count++;
+}
+
+static void batch_callback(void *opaque, MyFrameView *view)
+{
+    if (!view)
+        return;
+    list_add((FrameList *)opaque, view);
+    mydecoder_frame_view_release(view);
+}
+
+static s32 decode_reference(const char *file, char *decoder, FrameList *list)
+{
+    MyAsyncConfig config = { 0, 0, NULL, NULL };
+    MyContext ctx = mydecoder_context_alloc();
+    MyFrameView view;
+    s32 frame_num, ret;
+
+    if (!ctx || mydecoder_open(ctx, file, decoder, &frame_num) < 0 ||
+        mydecoder_async_start(ctx, &config) < 0) {
+        printf("Could not decode %s with %s\n", file, decoder);
+        return -1;
+    }
+    while ((ret = mydecoder_async_poll(ctx, &view, -1)) == 0) {
+        list_add(list, &view);
+        mydecoder_frame_view_release(&view);
+    }
+    mydecoder_close(ctx, NULL, NULL);
+    return ret == AVERROR_EOF ? 0 : ret;
+}
+
+int main(int argc, char *argv[])
+{
+    char *decoder = argc > 2 ? argv[2] : "h264";
+    MyBatchConfig config = { argc > 3 ? atoi(argv[3]) : 0, 0, 0, 0, batch_callback, NULL };
+    FrameList ref = { NULL, 0, 0 }, batch = { NULL, 0, 0 };
+    MyContext ctx;
+    s64 t0, t1, t2;
+    s32 i, mismatch = 0, ret;
+
+    if (argc < 2) {
+        printf("Usage: %s video_file [decoder_name] [workers]\n", argv[0]);
+        return 1;
+    }
+
+    t0 = now_ns();
+    if (decode_reference(argv[1], decoder, &ref) < 0)
+        return 1;
+    t1 = now_ns();
+    ctx = mydecoder_context_alloc();
+    config.opaque = &batch;
+    ret = mydecoder_batch_decode(ctx, argv[1], decoder, &config);
+    t2 = now_ns();
+    mydecoder_close(ctx, NULL, NULL);
+    if (ret < 0) {
+        printf("Batch decoding failed: %d\n", ret);
+        return 1;
+    }
+
+    for (i = 0; i < ref.count && i < batch.count; i++) {
+        if (ref.sums[i].pts != batch.sums[i].pts || ref.sums[i].hash != batch.sums[i].hash) {
+            if (!mismatch)
+                printf("first mismatch at frame %d: pts %lld / %lld\n", i,
+                       ref.sums[i].pts, batch.sums[i].pts);
+            mismatch++;
+        }
+    }
+    printf("sequential: %d frames %.1f fps    batch: %d frames %.1f fps\n",
+           ref.count, ref.count * 1e9 / (t1 - t0), batch.count, batch.count * 1e9 / (t2 - t1));
+    if (mismatch || ref.count != batch.count) {
+        printf("FAIL: %d frames differ\n", mismatch + abs(ref.count - batch.count));
+        return 1;
+    }
+    printf("OK\n");
+    free(ref.sums);
+    free(batch.sums);
+    return 0;
+}
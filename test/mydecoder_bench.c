@@ -0,0 +1,733 @@
+#include <libavutil/avutil.h>
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../mydecoder.h"
+
+/*
+ * Decode benchmark. Every stream runs the synchronous API on its own
+ * thread and times each stage per call: demux (get_packet), decode and
+ * output (retrieve_frame, frame_view_get or retrieve_batch), plus open and
+ * time to first frame once per stream. A configuration is run warm-up
+ * times untimed, then repeats times, and the stage latencies of all timed
+ * runs go into one p50/p99/max summary.
+ *
+ * With -Q the first stream count is run at every decode quality level
+ * instead, and the PSNR of each level's retrieved pictures against full
+ * quality decoding makes a quality versus speed table.
+ */
+
+#define MAX_SWEEP       16
+
+typedef enum {
+    OUTPUT_NONE = 0,
+    OUTPUT_BGR,
+    OUTPUT_VIEW,
+    OUTPUT_TENSOR,
+} OutputMode;
+
+enum {
+    STAGE_DEMUX = 0,
+    STAGE_DECODE,
+    STAGE_OUTPUT,
+    STAGE_OPEN,
+    STAGE_FIRST_FRAME,
+    STAGE_NB,
+};
+
+static const char *stage_names[STAGE_NB] = { "demux", "decode", "output", "open", "first_frame" };
+static const char *output_names[] = { "none", "bgr", "view", "tensor" };
+static const char *quality_names[] = { "full", "fast", "faster", "fastest" };
+
+typedef struct {
+    const char *file;
+    char *decoder;
+    OutputMode output;
+    s32 width;          /* output size, 0 for the frame size */
+    s32 height;
+    s32 frames;         /* per stream and run, 0 for the whole clip */
+    s32 warmup;
+    s32 repeats;
+    s32 sweep[MAX_SWEEP];
+    s32 nb_sweep;
+    const char *json;
+    s32 fast;           /* bounded probing, first frame at the first IDR */
+    s32 low_delay;
+    const char *cache_dir;  /* skip probing with cached parameters */
+    s32 convert_threads;
+    s32 live;
+    s32 mmap;           /* read the file through a memory mapping */
+    MyDecodeQuality quality;
+    s32 quality_table;  /* every quality level instead of the stream sweep */
+} BenchConfig;
+
+typedef struct {
+    s64 *v;
+    s32 count;
+    s32 capacity;
+} Samples;
+
+typedef struct {
+    const BenchConfig *config;
+    pthread_t thread;
+    Samples stages[STAGE_NB];
+    s32 frames;
+    MyStats stats;
+    s32 ret;
+} Stream;
+
+typedef struct {
+    s32 streams;
+    double fps[64];     /* per timed run, all streams together */
+    s32 runs;
+    s64 frames;
+    Samples stages[STAGE_NB];
+    s64 latency_frames;     /* live mode */
+    s64 latency_ns;
+    s64 latency_max_ns;
+    s64 late_frames;
+    s64 frame_interval_us;
+    s64 minor_faults;       /* whole process, all timed runs */
+    s64 major_faults;
+    MyDecodeQuality quality;
+    double psnr;            /* retrieved BGR24, against full quality; 0 when not measured */
+} SweepResult;
+
+static s64 now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void samples_add(Samples *s, s64 ns)
+{
+    if (s->count == s->capacity) {
+        s64 *v;
+
+        s->capacity = s->capacity ? s->capacity * 2 : 4096;
+        v = (s64 *)realloc(s->v, s->capacity * sizeof(*v));
+        if (!v) {
+            printf("Error allocating samples\n");
+            exit(1);
+        }
+        s->v = v;
+    }
+    s->v[s->count++] = ns;
+}
+
+static void samples_merge(Samples *dst, const Samples *src)
+{
+    s32 i;
+
+    for (i = 0; i < src->count; i++)
+        samples_add(dst, src->v[i]);
+}
+
+static s32 cmp_s64(const void *a, const void *b)
+{
+    s64 x = *(const s64 *)a, y = *(const s64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static s64 percentile(const Samples *s, double q)
+{
+    if (!s->count)
+        return 0;
+    return s->v[(s32)((s->count - 1) * q + 0.5)];
+}
+
+/* A retrieved picture, grown as the stream needs */
+typedef struct {
+    u8 *data;
+    s32 size;
+    s32 width;
+    s32 height;
+} BenchPicture;
+
+/* Sizes pic for what retrieve_frame writes of frame */
+static s32 picture_fit(MyContext ctx, MyFrame frame, BenchPicture *pic)
+{
+    s32 size;
+
+    if (mydecoder_get_output_size(ctx, frame, &pic->width, &pic->height) < 0)
+        return -1;
+    size = mydecoder_output_buffer_size(MYDECODER_OUT_BGR24, pic->width, pic->height);
+    if (size > pic->size) {
+        free(pic->data);
+        pic->data = malloc(size);
+        pic->size = pic->data ? size : 0;
+        if (!pic->data)
+            return -1;
+    }
+    return 0;
+}
+
+static s32 picture_retrieve(MyContext ctx, MyFrame frame, BenchPicture *pic)
+{
+    if (picture_fit(ctx, frame, pic) < 0)
+        return -1;
+    return mydecoder_retrieve_frame(ctx, frame, pic->data);
+}
+
+static void *stream_run(void *arg)
+{
+    Stream *st = (Stream *)arg;
+    const BenchConfig *config = st->config;
+    MyContext ctx;
+    MyPacket packet;
+    MyFrame frame;
+    MyFrameView view;
+    MyTensorDesc desc = { MYDECODER_LAYOUT_NCHW, MYDECODER_DTYPE_F32, MYDECODER_ORDER_RGB,
+                          config->width, config->height, { 0, 0, 0 }, { 255, 255, 255 } };
+    MyResizeConfig resize = { config->width, config->height, MYDECODER_FIT_STRETCH,
+                              MYDECODER_INTERP_BILINEAR, { 0, 0, 0 } };
+    MyFastOpenConfig fast;
+    MyLiveConfig live = { config->live, 0, 0 };
+    MyStats *stats = &st->stats;
+    s32 frame_num = 0, packet_size, got_frame, ret;
+    BenchPicture bgr = { NULL, 0, 0, 0 };
+    u8 *out = NULL;
+    s64 t0, t1;
+
+    packet = mydecoder_packet_alloc();
+    frame = mydecoder_frame_alloc();
+    ctx = mydecoder_context_alloc();
+    if (!packet || !frame || !ctx) {
+        st->ret = -1;
+        return NULL;
+    }
+    if (config->fast) {
+        memset(&fast, 0, sizeof(fast));
+        fast.skip_probe = !!config->cache_dir;
+        fast.low_delay = config->low_delay;
+        fast.cache_dir = config->cache_dir;
+        fast.params.pix_fmt = -1;
+        mydecoder_set_fast_open(ctx, &fast);
+    }
+    mydecoder_set_live(ctx, &live);
+    mydecoder_set_mmap_input(ctx, config->mmap);
+    mydecoder_set_decode_quality(ctx, config->quality);
+    if (mydecoder_open(ctx, config->file, config->decoder, &frame_num) < 0) {
+        printf("Could not open %s with %s\n", config->file, config->decoder);
+        st->ret = -1;
+        mydecoder_close(ctx, frame, packet);
+        return NULL;
+    }
+    if (config->width && OUTPUT_BGR == config->output)
+        mydecoder_set_resize(ctx, &resize);
+    mydecoder_set_convert_threads(ctx, config->convert_threads);
+
+    /* f32 tensor; BGR24 pictures are sized per frame */
+    if (OUTPUT_TENSOR == config->output) {
+        size_t size = (size_t)config->width * config->height * 3 * sizeof(float);
+
+        out = (u8 *)malloc(size);
+        if (!out) {
+            printf("Error allocating output buffer\n");
+            st->ret = -1;
+            mydecoder_close(ctx, frame, packet);
+            return NULL;
+        }
+    }
+
+    while (!config->frames || st->frames < config->frames) {
+        t0 = now_ns();
+        ret = mydecoder_get_packet(ctx, &packet, &packet_size);
+        t1 = now_ns();
+        if (ret == AVERROR(EAGAIN))
+            continue;
+        if (ret < 0)
+            break;
+        samples_add(&st->stages[STAGE_DEMUX], t1 - t0);
+        if (!packet_size)
+            continue;
+
+        got_frame = 0;
+        t0 = now_ns();
+        mydecoder_decode(ctx, packet, frame, &got_frame);
+        t1 = now_ns();
+        samples_add(&st->stages[STAGE_DECODE], t1 - t0);
+
+        while (got_frame) {
+            /* growing the buffer is not part of the output stage */
+            if (OUTPUT_BGR == config->output && picture_fit(ctx, frame, &bgr) < 0) {
+                printf("Error allocating output buffer\n");
+                st->ret = -1;
+                break;
+            }
+            t0 = now_ns();
+            if (OUTPUT_BGR == config->output) {
+                mydecoder_retrieve_frame(ctx, frame, bgr.data);
+            } else if (OUTPUT_VIEW == config->output) {
+                if (!mydecoder_frame_view_get(ctx, frame, &view))
+                    mydecoder_frame_view_release(&view);
+            } else if (OUTPUT_TENSOR == config->output) {
+                mydecoder_retrieve_batch(ctx, &frame, 1, &desc, out);
+            }
+            t1 = now_ns();
+            if (OUTPUT_NONE != config->output)
+                samples_add(&st->stages[STAGE_OUTPUT], t1 - t0);
+            got_frame--;
+            st->frames++;
+        }
+        if (st->ret < 0)
+            break;
+    }
+
+    mydecoder_get_stats(ctx, stats);
+    samples_add(&st->stages[STAGE_OPEN], stats->open_us * 1000);
+    if (stats->first_frame_us)
+        samples_add(&st->stages[STAGE_FIRST_FRAME], stats->first_frame_us * 1000);
+
+    free(out);
+    free(bgr.data);
+    mydecoder_close(ctx, frame, packet);
+    return NULL;
+}
+
+/* One run of n concurrent streams, returns the aggregate fps */
+static double bench_run(const BenchConfig *config, s32 n, SweepResult *result)
+{
+    Stream *streams;
+    struct rusage usage0, usage1;
+    s64 start, elapsed, frames = 0;
+    s32 i, c;
+
+    streams = (Stream *)calloc(n, sizeof(Stream));
+    if (!streams)
+        return -1;
+
+    getrusage(RUSAGE_SELF, &usage0);
+    start = now_ns();
+    for (i = 0; i < n; i++) {
+        streams[i].config = config;
+        pthread_create(&streams[i].thread, NULL, stream_run, &streams[i]);
+    }
+    for (i = 0; i < n; i++)
+        pthread_join(streams[i].thread, NULL);
+    elapsed = now_ns() - start;
+    getrusage(RUSAGE_SELF, &usage1);
+    if (result) {
+        result->minor_faults += usage1.ru_minflt - usage0.ru_minflt;
+        result->major_faults += usage1.ru_majflt - usage0.ru_majflt;
+    }
+
+    for (i = 0; i < n; i++) {
+        const MyTimerStats *latency = &streams[i].stats.timers[MYDECODER_TIMER_LATENCY];
+
+        if (streams[i].ret < 0)
+            frames = -1;
+        else if (frames >= 0)
+            frames += streams[i].frames;
+        if (result) {
+            result->latency_frames += latency->count;
+            result->latency_ns += latency->total_ns;
+            if (latency->max_ns > result->latency_max_ns)
+                result->latency_max_ns = latency->max_ns;
+            result->late_frames += streams[i].stats.late_frames;
+            result->frame_interval_us = streams[i].stats.frame_interval_us;
+        }
+        for (c = 0; c < STAGE_NB; c++) {
+            if (result)
+                samples_merge(&result->stages[c], &streams[i].stages[c]);
+            free(streams[i].stages[c].v);
+        }
+    }
+    free(streams);
+
+    if (frames < 0)
+        return -1;
+    if (result)
+        result->frames += frames;
+    return elapsed > 0 ? frames * 1e9 / elapsed : 0;
+}
+
+/*
+ * Squared error of a degraded BGR24 picture against the full quality one,
+ * bilinearly upscaled to the reference size first when it is smaller, the
+ * way a caller displaying it would.
+ */
+static double bgr_sse(const BenchPicture *ref, const BenchPicture *deg, s64 *samples)
+{
+    double sx = (double)deg->width / ref->width, sy = (double)deg->height / ref->height;
+    double fx, fy, wx, wy, v, d, sse = 0;
+    s32 x, y, c, x0, y0, x1, y1;
+
+    for (y = 0; y < ref->height; y++) {
+        fy = FFMAX((y + 0.5) * sy - 0.5, 0);
+        y0 = FFMIN((s32)fy, deg->height - 1);
+        y1 = FFMIN(y0 + 1, deg->height - 1);
+        wy = fy - y0;
+        for (x = 0; x < ref->width; x++) {
+            const u8 *a = ref->data + (y * ref->width + x) * 3;
+
+            fx = FFMAX((x + 0.5) * sx - 0.5, 0);
+            x0 = FFMIN((s32)fx, deg->width - 1);
+            x1 = FFMIN(x0 + 1, deg->width - 1);
+            wx = fx - x0;
+            for (c = 0; c < 3; c++) {
+                const u8 *r0 = deg->data + y0 * deg->width * 3 + c;
+                const u8 *r1 = deg->data + y1 * deg->width * 3 + c;
+
+                v = (1 - wy) * ((1 - wx) * r0[x0 * 3] + wx * r0[x1 * 3]) +
+                    wy * ((1 - wx) * r1[x0 * 3] + wx * r1[x1 * 3]);
+                d = a[c] - v;
+                sse += d * d;
+            }
+        }
+    }
+    *samples += (s64)ref->width * ref->height * 3;
+    return sse;
+}
+
+/*
+ * Decodes the clip twice in lockstep, at full quality and at quality, and
+ * compares what retrieve_frame hands back: FASTEST's half size pictures
+ * are scored against the full size ones they stand in for.
+ */
+static double quality_psnr(const BenchConfig *config, MyDecodeQuality quality)
+{
+    MyContext ctx[2];
+    MyPacket packet[2];
+    MyFrame frame[2];
+    BenchPicture pic[2];
+    s32 frame_num, packet_size[2], got_frame[2], i, n, ret = 0, frames = 0;
+    s64 samples = 0;
+    double sse = 0;
+
+    memset(pic, 0, sizeof(pic));
+    for (i = 0; i < 2; i++) {
+        ctx[i] = mydecoder_context_alloc();
+        packet[i] = mydecoder_packet_alloc();
+        frame[i] = mydecoder_frame_alloc();
+        mydecoder_set_decode_quality(ctx[i], i ? quality : MYDECODER_QUALITY_FULL);
+        if (mydecoder_open(ctx[i], config->file, config->decoder, &frame_num) < 0)
+            ret = -1;
+    }
+
+    while (!ret && (!config->frames || frames < config->frames)) {
+        for (i = 0; i < 2 && !ret; i++) {
+            do {
+                ret = mydecoder_get_packet(ctx[i], &packet[i], &packet_size[i]);
+            } while (ret == AVERROR(EAGAIN));
+        }
+        if (ret < 0 || packet_size[0] != packet_size[1])
+            break;
+        for (i = 0; i < 2; i++) {
+            got_frame[i] = 0;
+            if (packet_size[i])
+                mydecoder_decode(ctx[i], packet[i], frame[i], &got_frame[i]);
+        }
+        /* the same packets make the same frames, only the pixels differ */
+        for (n = 0; n < got_frame[0] || n < got_frame[1]; n++) {
+            s32 have_ref = n < got_frame[0] && !picture_retrieve(ctx[0], frame[0], &pic[0]);
+            s32 have_deg = n < got_frame[1] && !picture_retrieve(ctx[1], frame[1], &pic[1]);
+
+            if (have_ref && have_deg && pic[1].width <= pic[0].width &&
+                pic[1].height <= pic[0].height) {
+                sse += bgr_sse(&pic[0], &pic[1], &samples);
+                frames++;
+            }
+        }
+    }
+
+    for (i = 0; i < 2; i++) {
+        mydecoder_close(ctx[i], frame[i], packet[i]);
+        free(pic[i].data);
+    }
+    if (!samples)
+        return 0;
+    /* identical pictures are capped rather than infinite */
+    return sse ? FFMIN(10 * log10(255.0 * 255.0 * samples / sse), 99.0) : 99.0;
+}
+
+static double median(const double *v, s32 n)
+{
+    double tmp[64];
+    s32 i, j;
+
+    memcpy(tmp, v, n * sizeof(*v));
+    for (i = 1; i < n; i++) {
+        double x = tmp[i];
+
+        for (j = i; j > 0 && tmp[j - 1] > x; j--)
+            tmp[j] = tmp[j - 1];
+        tmp[j] = x;
+    }
+    return n ? tmp[n / 2] : 0;
+}
+
+static void print_text(const SweepResult *r)
+{
+    s32 c;
+
+    printf("streams: %d    fps: %.1f (median of %d)    per stream: %.1f    "
+           "page faults: %lld minor %lld major    quality: %s\n",
+           r->streams, median(r->fps, r->runs), r->runs, median(r->fps, r->runs) / r->streams,
+           r->minor_faults, r->major_faults, quality_names[r->quality]);
+    for (c = 0; c < STAGE_NB; c++) {
+        const Samples *s = &r->stages[c];
+
+        if (!s->count)
+            continue;
+        printf("    %-6s  n: %-8d p50: %8.1fus  p99: %8.1fus  max: %8.1fus\n", stage_names[c],
+               s->count, percentile(s, 0.5) / 1e3, percentile(s, 0.99) / 1e3,
+               s->v[s->count - 1] / 1e3);
+    }
+    if (r->latency_frames)
+        printf("    latency  n: %-8lld mean: %7.1fus  max: %8.1fus  "
+               "late: %lld (frame interval %lldus)\n",
+               r->latency_frames, r->latency_ns / 1e3 / r->latency_frames,
+               r->latency_max_ns / 1e3, r->late_frames, r->frame_interval_us);
+}
+
+/* Speed is relative to the first row, full quality */
+static void print_quality_table(const SweepResult *results, s32 n)
+{
+    double full = median(results[0].fps, results[0].runs);
+    double fps;
+    s32 i;
+
+    printf("\n%-8s  %10s  %10s  %8s\n", "quality", "fps", "speedup", "psnr");
+    for (i = 0; i < n; i++) {
+        fps = median(results[i].fps, results[i].runs);
+        printf("%-8s  %10.1f  %9.2fx  ", quality_names[results[i].quality], fps,
+               full > 0 ? fps / full : 0);
+        if (results[i].psnr > 0)
+            printf("%6.2fdB\n", results[i].psnr);
+        else
+            printf("%8s\n", "-");
+    }
+}
+
+static s32 write_json(const BenchConfig *config, const SweepResult *results, s32 n)
+{
+    FILE *f = strcmp(config->json, "-") ? fopen(config->json, "w") : stdout;
+    s32 i, j, c;
+
+    if (!f) {
+        printf("Could not open %s\n", config->json);
+        return -1;
+    }
+    fprintf(f, "{\n  \"file\": \"%s\",\n  \"decoder\": \"%s\",\n  \"output\": \"%s\",\n",
+            config->file, config->decoder, output_names[config->output]);
+    fprintf(f, "  \"width\": %d,\n  \"height\": %d,\n  \"frames\": %d,\n"
+            "  \"warmup\": %d,\n  \"repeats\": %d,\n  \"fast_open\": %d,\n"
+            "  \"convert_threads\": %d,\n  \"live\": %d,\n  \"mmap\": %d,\n  \"results\": [\n",
+            config->width, config->height, config->frames, config->warmup, config->repeats,
+            config->fast, config->convert_threads, config->live, config->mmap);
+    for (i = 0; i < n; i++) {
+        const SweepResult *r = &results[i];
+
+        fprintf(f, "    {\n      \"streams\": %d,\n      \"frames\": %lld,\n"
+                "      \"fps\": %.2f,\n      \"minor_faults\": %lld,\n"
+                "      \"major_faults\": %lld,\n      \"quality\": \"%s\",\n"
+                "      \"psnr\": %.2f,\n      \"fps_runs\": [",
+                r->streams, r->frames, median(r->fps, r->runs), r->minor_faults, r->major_faults,
+                quality_names[r->quality], r->psnr);
+        for (j = 0; j < r->runs; j++)
+            fprintf(f, "%s%.2f", j ? ", " : "", r->fps[j]);
+        fprintf(f, "],\n      \"stages_ns\": {");
+        for (c = 0; c < STAGE_NB; c++) {
+            const Samples *s = &r->stages[c];
+
+            fprintf(f, "%s\n        \"%s\": { \"count\": %d, \"p50\": %lld, \"p99\": %lld, \"max\": %lld }",
+                    c ? "," : "", stage_names[c], s->count, percentile(s, 0.5),
+                    percentile(s, 0.99), s->count ? s->v[s->count - 1] : 0);
+        }
+        fprintf(f, "\n      },\n      \"latency\": { \"count\": %lld, \"mean_ns\": %lld, "
+                "\"max_ns\": %lld, \"late\": %lld, \"frame_interval_us\": %lld }\n    }%s\n",
+                r->latency_frames, r->latency_frames ? r->latency_ns / r->latency_frames : 0,
+                r->latency_max_ns, r->late_frames, r->frame_interval_us, i + 1 < n ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    if (f != stdout)
+        fclose(f);
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [options] video_file\n"
+           "  -c decoder     h264/h264_v4l2m2m/rkmpp/hevc... (default h264)\n"
+           "  -f output      none/bgr/view/tensor (default bgr)\n"
+           "  -s WxH         output size for bgr and tensor (default frame size, 640x640 for tensor)\n"
+           "  -n frames      frames per stream and run (default whole clip)\n"
+           "  -w runs        untimed warm-up runs (default 1)\n"
+           "  -r runs        timed runs (default 3)\n"
+           "  -j list        concurrent streams to sweep, e.g. 1,2,4,8 (default 1)\n"
+           "  -o file        write JSON results, - for stdout\n"
+           "  -F             fast open: bounded probing, nothing before the first IDR\n"
+           "  -L             with -F, low delay decoding\n"
+           "  -k dir         with -F, skip probing using the parameter cache in dir\n"
+           "  -t threads     convert each frame in bands on that many threads (default 1)\n"
+           "  -l             live mode, reports decoder latency against the frame interval\n"
+           "  -m             read the file through a memory mapping instead of read()\n"
+           "  -q quality     full/fast/faster/fastest decoding (default full)\n"
+           "  -Q             every quality level at the first -j count, with PSNR\n", name);
+}
+
+static s32 parse_sweep(BenchConfig *config, char *arg)
+{
+    char *tok, *save = NULL;
+
+    config->nb_sweep = 0;
+    for (tok = strtok_r(arg, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        if (config->nb_sweep == MAX_SWEEP || atoi(tok) <= 0)
+            return -1;
+        config->sweep[config->nb_sweep++] = atoi(tok);
+    }
+    return config->nb_sweep ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchConfig config = { NULL, "h264", OUTPUT_BGR, 0, 0, 0, 1, 3, { 1 }, 1, NULL, 0, 0, NULL, 1,
+                           0, 0, MYDECODER_QUALITY_FULL, 0 };
+    BenchConfig run;
+    SweepResult *results;
+    s32 opt, i, j, c, nb_results;
+
+    while ((opt = getopt(argc, argv, "c:f:s:n:w:r:j:o:FLk:t:lmq:Qh")) != -1) {
+        switch (opt) {
+        case 'c':
+            config.decoder = optarg;
+            break;
+        case 'f':
+            for (i = 0; i <= OUTPUT_TENSOR && strcmp(optarg, output_names[i]); i++)
+                ;
+            if (i > OUTPUT_TENSOR) {
+                usage(argv[0]);
+                return 1;
+            }
+            config.output = (OutputMode)i;
+            break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &config.width, &config.height) != 2 ||
+                config.width <= 0 || config.height <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'n':
+            config.frames = atoi(optarg);
+            break;
+        case 'w':
+            config.warmup = atoi(optarg);
+            break;
+        case 'r':
+            config.repeats = atoi(optarg);
+            break;
+        case 'j':
+            if (parse_sweep(&config, optarg) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'o':
+            config.json = optarg;
+            break;
+        case 'F':
+            config.fast = 1;
+            break;
+        case 'L':
+            config.low_delay = 1;
+            break;
+        case 'k':
+            config.cache_dir = optarg;
+            break;
+        case 't':
+            config.convert_threads = atoi(optarg);
+            break;
+        case 'l':
+            config.live = 1;
+            break;
+        case 'm':
+            config.mmap = 1;
+            break;
+        case 'q':
+            for (i = 0; i <= MYDECODER_QUALITY_FASTEST && strcmp(optarg, quality_names[i]); i++)
+                ;
+            if (i > MYDECODER_QUALITY_FASTEST) {
+                usage(argv[0]);
+                return 1;
+            }
+            config.quality = (MyDecodeQuality)i;
+            break;
+        case 'Q':
+            config.quality_table = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || config.repeats <= 0 || config.repeats > 64) {
+        usage(argv[0]);
+        return 1;
+    }
+    config.file = argv[optind];
+    if (OUTPUT_TENSOR == config.output && !config.width) {
+        config.width = 640;
+        config.height = 640;
+    }
+
+    nb_results = config.quality_table ? MYDECODER_QUALITY_FASTEST + 1 : config.nb_sweep;
+    results = (SweepResult *)calloc(nb_results, sizeof(SweepResult));
+    if (!results)
+        return 1;
+
+    for (i = 0; i < nb_results; i++) {
+        SweepResult *r = &results[i];
+
+        run = config;
+        if (config.quality_table)
+            run.quality = (MyDecodeQuality)i;
+        r->streams = config.quality_table ? config.sweep[0] : config.sweep[i];
+        r->quality = run.quality;
+        for (j = 0; j < config.warmup; j++)
+            bench_run(&run, r->streams, NULL);
+        for (j = 0; j < config.repeats; j++) {
+            r->fps[r->runs] = bench_run(&run, r->streams, r);
+            if (r->fps[r->runs] < 0) {
+                printf("Run failed with %d streams\n", r->streams);
+                return 1;
+            }
+            r->runs++;
+        }
+        for (c = 0; c < STAGE_NB; c++) {
+            if (r->stages[c].count)
+                qsort(r->stages[c].v, r->stages[c].count, sizeof(s64), cmp_s64);
+        }
+        /* the same for every stream count */
+        if (i && !config.quality_table)
+            r->psnr = results[0].psnr;
+        else if (MYDECODER_QUALITY_FULL != r->quality)
+            r->psnr = quality_psnr(&config, r->quality);
+        /* keep stdout clean when it carries the JSON */
+        if (!config.json || strcmp(config.json, "-"))
+            print_text(r);
+    }
+
+    if (config.quality_table && (!config.json || strcmp(config.json, "-")))
+        print_quality_table(results, nb_results);
+    if (config.json && write_json(&config, results, nb_results) < 0)
+        return 1;
+
+    for (i = 0; i < nb_results; i++) {
+        for (c = 0; c < STAGE_NB; c++)
+            free(results[i].stages[c].v);
+    }
+    free(results);
+    return 0;
+}
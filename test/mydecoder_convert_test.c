@@ -0,0 +1,589 @@
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../mydecoder.h"
+#include "../mydecoder_convert.h"
+
+/* sws's table based yuv2rgb rounds differently from the fixed point kernels */
+#define MAX_ABS_DIFF     4
+#define MAX_MEAN_DIFF    1.0
+
+static double current_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Smooth gradients plus a little noise, like camera content */
+static void fill_nv12(u8 *y, u8 *uv, s32 width, s32 height)
+{
+    u32 seed = 12345;
+    s32 i, j;
+
+    for (j = 0; j < height; j++) {
+        for (i = 0; i < width; i++) {
+            seed = seed * 1103515245 + 12345;
+            y[j * width + i] = (u8)((i * 255 / width + j * 64 / height + (seed >> 28)) & 0xff);
+        }
+    }
+    for (j = 0; j < (height + 1) / 2; j++) {
+        for (i = 0; i < (width + 1) / 2; i++) {
+            uv[j * width + 2 * i] = (u8)(64 + i * 128 / width);
+            uv[j * width + 2 * i + 1] = (u8)(192 - j * 128 / height);
+        }
+    }
+}
+
+/* frame pointing at a tightly packed NV12 picture in nv12 */
+static void nv12_frame(AVFrame *frame, u8 *nv12, s32 width, s32 height)
+{
+    frame->format = AV_PIX_FMT_NV12;
+    frame->width = width;
+    frame->height = height;
+    av_image_fill_arrays(frame->data, frame->linesize, nv12, AV_PIX_FMT_NV12, width, height, 1);
+}
+
+/* The path mydecoder used before: NV12 -> YUV420P -> BGR24, two sws passes */
+static void sws_reference(struct SwsContext **c1, struct SwsContext **c2,
+    u8 *src, u8 *yuv, u8 *bgr, s32 width, s32 height)
+{
+    u8 *src_data[4], *yuv_data[4], *bgr_data[4];
+    s32 src_linesize[4], yuv_linesize[4], bgr_linesize[4];
+
+    av_image_fill_arrays(src_data, src_linesize, src, AV_PIX_FMT_NV12, width, height, 1);
+    av_image_fill_arrays(yuv_data, yuv_linesize, yuv, AV_PIX_FMT_YUV420P, width, height, 1);
+    av_image_fill_arrays(bgr_data, bgr_linesize, bgr, AV_PIX_FMT_BGR24, width, height, 1);
+
+    *c1 = sws_getCachedContext(*c1, width, height, AV_PIX_FMT_NV12,
+                               width, height, AV_PIX_FMT_YUV420P, SWS_BICUBIC, NULL, NULL, NULL);
+    *c2 = sws_getCachedContext(*c2, width, height, AV_PIX_FMT_YUV420P,
+                               width, height, AV_PIX_FMT_BGR24, SWS_BICUBIC, NULL, NULL, NULL);
+    sws_scale(*c1, (const uint8_t * const *)src_data, src_linesize, 0, height,
+              yuv_data, yuv_linesize);
+    sws_scale(*c2, (const uint8_t * const *)yuv_data, yuv_linesize, 0, height,
+              bgr_data, bgr_linesize);
+}
+
+static s32 compare(const char *name, const u8 *ref, const u8 *out, s32 size)
+{
+    s32 i, d, max_diff = 0;
+    double sum = 0;
+
+    for (i = 0; i < size; i++) {
+        d = abs(ref[i] - out[i]);
+        sum += d;
+        if (d > max_diff)
+            max_diff = d;
+    }
+    printf("%-8s max diff: %d    mean diff: %.3f\n", name, max_diff, sum / size);
+    return (max_diff > MAX_ABS_DIFF || sum / size > MAX_MEAN_DIFF) ? -1 : 0;
+}
+
+static s32 test_size(s32 width, s32 height, s32 loops)
+{
+    struct SwsContext *c1 = NULL, *c2 = NULL;
+    s32 frame_size = width * height * 3;
+    u8 *nv12 = (u8 *)malloc(width * height * 2);
+    u8 *yuv = (u8 *)malloc(width * height * 2);
+    u8 *ref = (u8 *)malloc(frame_size);
+    u8 *out_c = (u8 *)malloc(frame_size);
+    u8 *out_simd = (u8 *)malloc(frame_size);
+    MyYuvCoeffs coeffs;
+    double start, t_sws, t_c, t_simd;
+    s32 ret = 0, i;
+
+    fill_nv12(nv12, nv12 + width * height, width, height);
+    /* sws defaults to BT.601 limited range */
+    mydecoder_yuv_coeffs(&coeffs, 0, 0);
+
+    sws_reference(&c1, &c2, nv12, yuv, ref, width, height);
+    mydecoder_convert_force_c(1);
+    mydecoder_nv12_to_bgr24(nv12, width, nv12 + width * height, width,
+                            out_c, width * 3, width, height, &coeffs);
+    mydecoder_convert_force_c(0);
+    mydecoder_nv12_to_bgr24(nv12, width, nv12 + width * height, width,
+                            out_simd, width * 3, width, height, &coeffs);
+
+    printf("%dx%d (%s)\n", width, height, mydecoder_convert_isa());
+    ret |= compare("c", ref, out_c, frame_size);
+    ret |= compare(mydecoder_convert_isa(), ref, out_simd, frame_size);
+    if (memcmp(out_c, out_simd, frame_size)) {
+        printf("SIMD output differs from C output\n");
+        ret = -1;
+    }
+
+    start = current_sec();
+    for (i = 0; i < loops; i++)
+        sws_reference(&c1, &c2, nv12, yuv, ref, width, height);
+    t_sws = (current_sec() - start) * 1000 / loops;
+
+    mydecoder_convert_force_c(1);
+    start = current_sec();
+    for (i = 0; i < loops; i++)
+        mydecoder_nv12_to_bgr24(nv12, width, nv12 + width * height, width,
+                                out_c, width * 3, width, height, &coeffs);
+    t_c = (current_sec() - start) * 1000 / loops;
+
+    mydecoder_convert_force_c(0);
+    start = current_sec();
+    for (i = 0; i < loops; i++)
+        mydecoder_nv12_to_bgr24(nv12, width, nv12 + width * height, width,
+                                out_simd, width * 3, width, height, &coeffs);
+    t_simd = (current_sec() - start) * 1000 / loops;
+
+    printf("sws 2-pass: %3.3fms    c: %3.3fms    %s: %3.3fms    speedup: %3.2fx\n\n",
+           t_sws, t_c, mydecoder_convert_isa(), t_simd, t_sws / t_simd);
+
+    sws_freeContext(c1);
+    sws_freeContext(c2);
+    free(nv12);
+    free(yuv);
+    free(ref);
+    free(out_c);
+    free(out_simd);
+    return ret;
+}
+
+/* Every RGB layout, C and SIMD, against the BGR24 kernel; a width with SIMD tails */
+static s32 test_layouts(s32 width, s32 height)
+{
+    static const char *names[] = { "bgr24", "rgb24", "bgra", "rgba", "planar" };
+    s32 plane = width * height;
+    u8 *nv12 = (u8 *)malloc(plane * 2);
+    u8 *bgr = (u8 *)malloc(plane * 3);
+    u8 *out = (u8 *)malloc(plane * 4);
+    static const s32 order[4][4] = { { 0, 1, 2, -1 }, { 2, 1, 0, -1 },
+                                     { 0, 1, 2, 3 }, { 2, 1, 0, 3 } };
+    MyYuvCoeffs coeffs;
+    s32 layout, simd, i, c, bad, ret = 0;
+
+    fill_nv12(nv12, nv12 + plane, width, height);
+    mydecoder_yuv_coeffs(&coeffs, 0, 0);
+    mydecoder_convert_force_c(1);
+    mydecoder_nv12_to_bgr24(nv12, width, nv12 + plane, width, bgr, width * 3,
+                            width, height, &coeffs);
+
+    for (simd = 0; simd < 2; simd++) {
+        mydecoder_convert_force_c(!simd);
+        for (layout = MYDECODER_RGB_BGR24; layout <= MYDECODER_RGB_PLANAR; layout++) {
+            s32 bpp = MYDECODER_RGB_BGRA <= layout && layout <= MYDECODER_RGB_RGBA ? 4 : 3;
+            u8 *dst[3] = { out, out + plane, out + 2 * plane };
+            s32 stride[3] = { width * bpp, width, width };
+
+            if (MYDECODER_RGB_PLANAR == layout)
+                stride[0] = width;
+            mydecoder_nv12_to_rgb(nv12, width, nv12 + plane, width, dst, stride,
+                                  (MyRgbLayout)layout, width, height, &coeffs);
+            bad = 0;
+            for (i = 0; i < plane; i++) {
+                for (c = 0; c < 3; c++) {
+                    u8 v = MYDECODER_RGB_PLANAR == layout ? out[c * plane + i] :
+                           out[i * bpp + order[layout][c]];
+
+                    bad += v != bgr[i * 3 + c];
+                }
+                if (4 == bpp)
+                    bad += out[i * 4 + 3] != 255;
+            }
+            if (bad) {
+                printf("%s %s: %d bytes differ from bgr24\n", simd ? mydecoder_convert_isa() : "c",
+                       names[layout], bad);
+                ret = -1;
+            }
+        }
+    }
+    mydecoder_convert_force_c(0);
+    printf("layouts %dx%d: %s\n\n", width, height, ret ? "differ" : "match");
+    free(nv12);
+    free(bgr);
+    free(out);
+    return ret;
+}
+
+/* Whole-frame retrieve on one thread vs in bands on all cores: same bytes, less latency */
+static s32 test_slices(s32 width, s32 height, s32 loops)
+{
+    MyContext ctx = mydecoder_context_alloc();
+    AVFrame *frame = av_frame_alloc();
+    s32 threads = sysconf(_SC_NPROCESSORS_ONLN);
+    s32 size = width * height * 3;
+    u8 *nv12 = (u8 *)malloc(width * height * 3 / 2);
+    u8 *one = (u8 *)malloc(size);
+    u8 *banded = (u8 *)malloc(size);
+    double start, t_one, t_banded;
+    s32 ret = 0, i;
+
+    if (threads > MYDECODER_CONVERT_THREADS_MAX)
+        threads = MYDECODER_CONVERT_THREADS_MAX;
+    /* the same work per size */
+    loops = loops * (1920 * 1080) / (width * height);
+    if (loops < 1)
+        loops = 1;
+    fill_nv12(nv12, nv12 + width * height, width, height);
+    nv12_frame(frame, nv12, width, height);
+
+    mydecoder_retrieve_frame(ctx, frame, one);
+    start = current_sec();
+    for (i = 0; i < loops; i++)
+        mydecoder_retrieve_frame(ctx, frame, one);
+    t_one = (current_sec() - start) * 1000 / loops;
+
+    mydecoder_set_convert_threads(ctx, threads);
+    mydecoder_retrieve_frame(ctx, frame, banded);
+    start = current_sec();
+    for (i = 0; i < loops; i++)
+        mydecoder_retrieve_frame(ctx, frame, banded);
+    t_banded = (current_sec() - start) * 1000 / loops;
+
+    if (memcmp(one, banded, size)) {
+        printf("banded output differs from single-threaded output\n");
+        ret = -1;
+    }
+    printf("%dx%d bgr24: 1 thread %3.3fms    %d threads %3.3fms    speedup: %3.2fx\n",
+           width, height, t_one, threads, t_banded, t_one / t_banded);
+
+    av_frame_free(&frame);
+    mydecoder_close(ctx, NULL, NULL);
+    free(nv12);
+    free(one);
+    free(banded);
+    return ret;
+}
+
+/* Motion gate: the same frame is held back, a changed corner is let through and located */
+static s32 test_motion(s32 width, s32 height)
+{
+    MyContext ctx = mydecoder_context_alloc();
+    AVFrame *frame = av_frame_alloc();
+    MyMotionConfig config = { 1, 4, 2.0f, 8.0f, 4, 4, 0 };
+    MyMotionInfo info;
+    u8 *nv12 = (u8 *)malloc(width * height * 2);
+    u8 *bgr = (u8 *)malloc(width * height * 3);
+    s32 first, same, moved, x, y, ret = 0;
+
+    fill_nv12(nv12, nv12 + width * height, width, height);
+    nv12_frame(frame, nv12, width, height);
+    mydecoder_set_motion_gate(ctx, &config);
+
+    first = mydecoder_retrieve_frame(ctx, frame, bgr);
+    same = mydecoder_retrieve_frame(ctx, frame, bgr);
+    /* a bright block in the top left cell, too small for the global score */
+    for (y = 8; y < 40; y++) {
+        for (x = 8; x < 40; x++)
+            nv12[y * width + x] = 255;
+    }
+    moved = mydecoder_retrieve_frame(ctx, frame, bgr);
+    mydecoder_get_motion(ctx, &info);
+
+    printf("motion: first %d same %d moved %d score %.2f cell %.2f\n\n", first, same, moved,
+           info.score, info.grid[0]);
+    if (first != 0 || same != MYDECODER_UNCHANGED || moved != 0 || !info.changed ||
+        info.score >= config.threshold || info.grid[0] < config.cell_threshold ||
+        info.grid[15] != 0)
+        ret = -1;
+
+    av_frame_free(&frame);
+    mydecoder_close(ctx, NULL, NULL);
+    free(nv12);
+    free(bgr);
+    return ret;
+}
+
+/* Batch of one NV12 frame into an f32 NCHW RGB tensor vs the BGR24 kernel */
+static s32 test_tensor(s32 width, s32 height)
+{
+    MyContext ctx = mydecoder_context_alloc();
+    AVFrame *frame = av_frame_alloc();
+    MyFrame frames[1] = { frame };
+    MyTensorDesc desc = { MYDECODER_LAYOUT_NCHW, MYDECODER_DTYPE_F32, MYDECODER_ORDER_RGB,
+                          width, height, { 123.675f, 116.28f, 103.53f }, { 58.395f, 57.12f, 57.375f } };
+    u8 *nv12 = (u8 *)malloc(width * height * 2);
+    u8 *bgr = (u8 *)malloc(width * height * 3);
+    float *tensor = (float *)malloc(width * height * 3 * sizeof(float));
+    MyYuvCoeffs coeffs;
+    double d, max_diff = 0;
+    s32 ret, c, i;
+
+    fill_nv12(nv12, nv12 + width * height, width, height);
+    mydecoder_yuv_coeffs(&coeffs, 0, 0);
+    mydecoder_nv12_to_bgr24(nv12, width, nv12 + width * height, width,
+                            bgr, width * 3, width, height, &coeffs);
+
+    nv12_frame(frame, nv12, width, height);
+    ret = mydecoder_retrieve_batch(ctx, frames, 1, &desc, tensor);
+
+    for (c = 0; c < 3; c++) {
+        for (i = 0; i < width * height; i++) {
+            d = fabs((bgr[3 * i + 2 - c] - desc.mean[c]) / desc.std[c] - tensor[c * width * height + i]);
+            if (d > max_diff)
+                max_diff = d;
+        }
+    }
+    printf("tensor %dx%d f32 nchw max diff: %g\n\n", width, height, max_diff);
+
+    av_frame_free(&frame);
+    mydecoder_close(ctx, NULL, NULL);
+    free(nv12);
+    free(bgr);
+    free(tensor);
+    return (ret != 1 || max_diff > 1e-5) ? -1 : 0;
+}
+
+/*
+ * Regions at their own size must match the same pixels of the whole frame
+ * converted, a region reaching past the frame is clipped, and one scaled
+ * down must keep the flat colour of a flat area.
+ */
+static s32 test_rois(s32 width, s32 height)
+{
+    MyContext ctx = mydecoder_context_alloc();
+    AVFrame *frame = av_frame_alloc();
+    MyRoi rois[3] = { { 100, 50, 64, 32, 64, 32 },
+                      { width - 40, height - 20, 80, 40, 40, 20 },
+                      { 0, 0, 32, 32, 8, 8 } };
+    u8 *nv12 = (u8 *)malloc(width * height * 2);
+    u8 *bgr = (u8 *)malloc(width * height * 3);
+    u8 out[64 * 32 * 3 + 40 * 20 * 3 + 8 * 8 * 3];
+    const u8 *clip = out + 64 * 32 * 3, *small = clip + 40 * 20 * 3;
+    s32 ret, x, y, bad = 0;
+
+    fill_nv12(nv12, nv12 + width * height, width, height);
+    /* a flat top left corner for the scaled region */
+    for (y = 0; y < 32; y++)
+        memset(nv12 + y * width, 90, 32);
+    for (y = 0; y < 16; y++)
+        memset(nv12 + width * height + y * width, 140, 32);
+    nv12_frame(frame, nv12, width, height);
+    mydecoder_retrieve_frame(ctx, frame, bgr);
+    ret = mydecoder_retrieve_rois(ctx, frame, rois, 3, out);
+
+    for (y = 0; y < 32; y++)
+        bad += memcmp(out + y * 64 * 3, bgr + ((50 + y) * width + 100) * 3, 64 * 3) != 0;
+    /* 40x20 of the frame left after clipping, kept at that size */
+    for (y = 0; y < 20; y++)
+        bad += memcmp(clip + y * 40 * 3, bgr + ((height - 20 + y) * width + width - 40) * 3,
+                      40 * 3) != 0;
+    for (x = 0; x < 8 * 8; x++)
+        bad += memcmp(small + x * 3, bgr, 3) != 0;
+
+    printf("rois %dx%d: %d bad rows or pixels\n\n", width, height, bad);
+    av_frame_free(&frame);
+    mydecoder_close(ctx, NULL, NULL);
+    free(nv12);
+    free(bgr);
+    return (ret != 3 || bad) ? -1 : 0;
+}
+
+/*
+ * 1080p NV12 letterboxed to 640x640 through retrieve_frame: a flat picture
+ * must come out flat with 140 pad rows top and bottom. Timed against the
+ * full size conversion followed by an sws resize.
+ */
+static s32 test_resize(s32 loops)
+{
+    const s32 width = 1920, height = 1080, out_size = 640;
+    MyContext ctx = mydecoder_context_alloc();
+    AVFrame *frame = av_frame_alloc();
+    MyResizeConfig resize = { out_size, out_size, MYDECODER_FIT_LETTERBOX,
+                              MYDECODER_INTERP_BILINEAR, { 114, 114, 114 } };
+    struct SwsContext *sws = NULL;
+    u8 *nv12 = (u8 *)malloc(width * height * 3 / 2);
+    u8 *full = (u8 *)malloc(width * height * 3);
+    u8 *out = (u8 *)malloc(out_size * out_size * 3);
+    u8 *full_data[4], *out_data[4];
+    s32 full_linesize[4], out_linesize[4];
+    u8 flat[3];
+    MyYuvCoeffs coeffs;
+    double start, t_fused, t_sws;
+    s32 ret = 0, bad = 0, i, x, y;
+
+    memset(nv12, 100, width * height);
+    memset(nv12 + width * height, 160, width * height / 2);
+    mydecoder_yuv_coeffs(&coeffs, 0, 0);
+    mydecoder_nv12_to_bgr24(nv12, width, nv12 + width * height, width, flat, 3, 1, 1, &coeffs);
+
+    nv12_frame(frame, nv12, width, height);
+    mydecoder_set_resize(ctx, &resize);
+    mydecoder_retrieve_frame(ctx, frame, out);
+
+    for (y = 0; y < out_size; y++) {
+        for (x = 0; x < out_size; x++) {
+            const u8 *expect = (y < 140 || y >= 500) ? resize.pad : flat;
+
+            if (memcmp(out + (y * out_size + x) * 3, expect, 3))
+                bad++;
+        }
+    }
+    printf("resize 1080p -> %dx%d letterbox: %d bad pixels\n", out_size, out_size, bad);
+    if (bad)
+        ret = -1;
+
+    start = current_sec();
+    for (i = 0; i < loops; i++)
+        mydecoder_retrieve_frame(ctx, frame, out);
+    t_fused = (current_sec() - start) * 1000 / loops;
+
+    av_image_fill_arrays(full_data, full_linesize, full, AV_PIX_FMT_BGR24, width, height, 1);
+    av_image_fill_arrays(out_data, out_linesize, out, AV_PIX_FMT_BGR24, out_size, 360, 1);
+    start = current_sec();
+    for (i = 0; i < loops; i++) {
+        mydecoder_nv12_to_bgr24(nv12, width, nv12 + width * height, width,
+                                full, width * 3, width, height, &coeffs);
+        sws = sws_getCachedContext(sws, width, height, AV_PIX_FMT_BGR24,
+                                   out_size, 360, AV_PIX_FMT_BGR24, SWS_BILINEAR, NULL, NULL, NULL);
+        sws_scale(sws, (const uint8_t * const *)full_data, full_linesize, 0, height,
+                  out_data, out_linesize);
+    }
+    t_sws = (current_sec() - start) * 1000 / loops;
+    printf("fused: %3.3fms    convert + sws resize: %3.3fms\n\n", t_fused, t_sws);
+
+    sws_freeContext(sws);
+    av_frame_free(&frame);
+    mydecoder_close(ctx, NULL, NULL);
+    free(nv12);
+    free(full);
+    free(out);
+    return ret;
+}
+
+/*
+ * 8K down to 160x90 with area filtering averages 48 rows per output row:
+ * rows of random black or white must come out as the exact grey of their
+ * box, with neutral chroma, within rounding.
+ */
+static s32 test_area(void)
+{
+    const s32 width = 7680, height = 4320, out_w = 160, out_h = 90;
+    MyContext ctx = mydecoder_context_alloc();
+    AVFrame *frame = av_frame_alloc();
+    MyResizeConfig resize = { out_w, out_h, MYDECODER_FIT_STRETCH, MYDECODER_INTERP_AREA,
+                              { 0, 0, 0 } };
+    u8 *nv12 = (u8 *)malloc(width * height * 3 / 2);
+    u8 *out = (u8 *)malloc(out_w * out_h * 3);
+    u32 seed = 4321;
+    s32 x, y, r, bad = 0, rows = height / out_h;
+    double sum, expect;
+
+    for (y = 0; y < height; y++) {
+        seed = seed * 1103515245 + 12345;
+        memset(nv12 + y * width, (seed >> 16) & 1 ? 235 : 16, width);
+    }
+    memset(nv12 + width * height, 128, width * height / 2);
+    nv12_frame(frame, nv12, width, height);
+    mydecoder_set_resize(ctx, &resize);
+    mydecoder_retrieve_frame(ctx, frame, out);
+
+    for (y = 0; y < out_h; y++) {
+        for (sum = 0, r = 0; r < rows; r++)
+            sum += nv12[(y * rows + r) * width];
+        expect = (sum / rows - 16) * 255 / 219;
+        for (x = 0; x < out_w * 3; x++)
+            bad += fabs(out[y * out_w * 3 + x] - expect) > 2;
+    }
+    printf("area 8K -> %dx%d of black and white rows: %d bad samples\n\n", out_w, out_h, bad);
+    av_frame_free(&frame);
+    mydecoder_close(ctx, NULL, NULL);
+    free(nv12);
+    free(out);
+    return bad ? -1 : 0;
+}
+
+/*
+ * Full size BGR24, 640x360 RGB24 and 160x90 GRAY8 of one 1080p frame in
+ * one call must equal three retrieve_frame calls set up for each, and
+ * the fan-out is timed against those three.
+ */
+static s32 test_outputs(s32 loops)
+{
+    const s32 width = 1920, height = 1080;
+    MyContext ctx = mydecoder_context_alloc();
+    AVFrame *frame = av_frame_alloc();
+    MyOutputSpec outputs[3] = { { MYDECODER_OUT_BGR24, 0, 0, NULL },
+                                { MYDECODER_OUT_RGB24, 640, 360, NULL },
+                                { MYDECODER_OUT_GRAY8, 160, 90, NULL } };
+    MyResizeConfig resize = { 0, 0, MYDECODER_FIT_STRETCH, MYDECODER_INTERP_BILINEAR,
+                              { 0, 0, 0 } };
+    u8 *nv12 = (u8 *)malloc(width * height * 3 / 2);
+    u8 *ref = (u8 *)malloc(width * height * 3);
+    double start, t_fanout, t_separate;
+    s32 ret, size, bad = 0, i, k;
+
+    fill_nv12(nv12, nv12 + width * height, width, height);
+    nv12_frame(frame, nv12, width, height);
+    for (i = 0; i < 3; i++)
+        outputs[i].out = (u8 *)malloc(width * height * 3);
+    mydecoder_set_resize(ctx, &resize);
+    ret = mydecoder_retrieve_outputs(ctx, frame, outputs, 3);
+
+    for (i = 0; i < 3; i++) {
+        resize.width = outputs[i].width;
+        resize.height = outputs[i].height;
+        mydecoder_set_resize(ctx, &resize);
+        mydecoder_set_output_format(ctx, outputs[i].format);
+        mydecoder_retrieve_frame(ctx, frame, ref);
+        size = mydecoder_output_buffer_size(outputs[i].format,
+                                            outputs[i].width ? outputs[i].width : width,
+                                            outputs[i].height ? outputs[i].height : height);
+        bad += memcmp(ref, outputs[i].out, size) != 0;
+    }
+    printf("fan-out of 3 outputs: %d differ from retrieve_frame\n", bad);
+
+    start = current_sec();
+    for (k = 0; k < loops; k++)
+        mydecoder_retrieve_outputs(ctx, frame, outputs, 3);
+    t_fanout = (current_sec() - start) * 1000 / loops;
+    start = current_sec();
+    for (k = 0; k < loops; k++) {
+        for (i = 0; i < 3; i++) {
+            resize.width = outputs[i].width;
+            resize.height = outputs[i].height;
+            mydecoder_set_resize(ctx, &resize);
+            mydecoder_set_output_format(ctx, outputs[i].format);
+            mydecoder_retrieve_frame(ctx, frame, outputs[i].out);
+        }
+    }
+    t_separate = (current_sec() - start) * 1000 / loops;
+    printf("fan-out: %3.3fms    3 x retrieve_frame: %3.3fms\n\n", t_fanout, t_separate);
+
+    av_frame_free(&frame);
+    mydecoder_close(ctx, NULL, NULL);
+    for (i = 0; i < 3; i++)
+        free(outputs[i].out);
+    free(nv12);
+    free(ref);
+    return (ret != 3 || bad) ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    s32 loops = argc > 1 ? atoi(argv[1]) : 100;
+    s32 ret = 0;
+
+    ret |= test_size(1920, 1080, loops);
+    ret |= test_size(1280, 720, loops);
+    ret |= test_size(640, 360, loops);
+    ret |= test_layouts(78, 36);
+    ret |= test_tensor(640, 360);
+    ret |= test_motion(640, 360);
+    ret |= test_rois(640, 360);
+    ret |= test_resize(loops);
+    ret |= test_area();
+    ret |= test_outputs(loops);
+    ret |= test_slices(1920, 1080, loops);
+    ret |= test_slices(3840, 2160, loops);
+    ret |= test_slices(7680, 4320, loops);
+    printf("\n");
+
+    printf("%s\n", ret ? "FAILED" : "PASSED");
+    return ret ? 1 : 0;
+}
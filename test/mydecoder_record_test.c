@@ -0,0 +1,95 @@
+#include <libavformat/avformat.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../mydecoder.h"
+
+/*
+ * Decodes a file while recording it in short segments, then demuxes every
+ * segment again: each must open on its own, start with a video keyframe,
+ * and together they must hold every packet the recorder says it wrote.
+ */
+
+/* Packets in one segment, -1 when it does not open or starts wrong */
+static s32 check_segment(const char *path)
+{
+    AVFormatContext *fmt_ctx = NULL;
+    AVPacket *pkt = av_packet_alloc();
+    s32 video, count = 0, first = 1;
+
+    if (!pkt || avformat_open_input(&fmt_ctx, path, NULL, NULL) < 0 ||
+        avformat_find_stream_info(fmt_ctx, NULL) < 0) {
+        printf("%s does not open\n", path);
+        av_packet_free(&pkt);
+        return -1;
+    }
+    video = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    while (av_read_frame(fmt_ctx, pkt) >= 0) {
+        if (first && pkt->stream_index == video) {
+            if (!(pkt->flags & AV_PKT_FLAG_KEY)) {
+                printf("%s does not start with a keyframe\n", path);
+                count = -1;
+                av_packet_unref(pkt);
+                break;
+            }
+            first = 0;
+        }
+        count++;
+        av_packet_unref(pkt);
+    }
+    avformat_close_input(&fmt_ctx);
+    av_packet_free(&pkt);
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    char *decoder = argc > 2 ? argv[2] : "h264";
+    const char *prefix = argc > 3 ? argv[3] : "/tmp/mydecoder_record";
+    MyRecordConfig config = { prefix, MYDECODER_RECORD_MP4, 2, 0 };
+    MyRecordStats stats;
+    MyContext ctx = mydecoder_context_alloc();
+    MyPacket packet = mydecoder_packet_alloc();
+    MyFrame frame = mydecoder_frame_alloc();
+    char path[1024];
+    s32 frame_num, packet_size, got_frame, i, count;
+    s64 total = 0;
+
+    if (argc < 2) {
+        printf("Usage: %s video_file [decoder_name] [output_prefix]\n", argv[0]);
+        return 1;
+    }
+    if (!ctx || !packet || !frame || mydecoder_open(ctx, argv[1], decoder, &frame_num) < 0 ||
+        mydecoder_record_start(ctx, &config) < 0) {
+        printf("Could not record %s\n", argv[1]);
+        return 1;
+    }
+    while (mydecoder_get_packet(ctx, &packet, &packet_size) >= 0) {
+        if (packet_size)
+            mydecoder_decode(ctx, packet, frame, &got_frame);
+    }
+    /* the numbers once the queue is drained and the last segment written */
+    mydecoder_record_stop(ctx, &stats);
+
+    for (i = 0; ; i++) {
+        snprintf(path, sizeof(path), "%s_%05d.mp4", prefix, i);
+        if (access(path, F_OK))
+            break;
+        count = check_segment(path);
+        if (count < 0)
+            return 1;
+        total += count;
+        remove(path);
+    }
+    printf("%d segments, %lld packets, %lld dropped\n", i, total, stats.dropped);
+    mydecoder_close(ctx, frame, packet);
+    if (!i || total != stats.packets) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include <libavutil/avutil.h>
+#include <libavutil/pixfmt.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../mydecoder.h"
+
+/*
+ * One publisher, one reader in a child process that is slow now and then.
+ * With the PROTECT policy the reader must never see a frame that changed
+ * under it: every byte of frame n is n & 0xff and frames come in order.
+ */
+
+#define WIDTH     320
+#define HEIGHT    240
+#define FRAMES    2000
+
+static void sleep_us(s32 us)
+{
+    struct timespec ts = { 0, us * 1000L };
+
+    nanosleep(&ts, NULL);
+}
+
+static s32 reader(const char *name, s32 ready)
+{
+    MyShm shm = mydecoder_shm_open(name);
+    MyFrameView view;
+    s64 last = -1;
+    s32 frames = 0, bad = 0, x, y, ret;
+
+    if (!shm)
+        return 1;
+    if (write(ready, "r", 1) != 1)
+        return 1;
+    while ((ret = mydecoder_shm_read(shm, &view, 2000)) == 0) {
+        if (view.pts <= last || MYDECODER_PIX_FMT_GRAY8 != view.format ||
+            WIDTH != view.width || HEIGHT != view.height)
+            bad++;
+        for (y = 0; y < view.height; y++) {
+            for (x = 0; x < view.width; x++)
+                bad += view.data[0][y * view.linesize[0] + x] != (u8)view.pts;
+        }
+        if (frames % 100 == 0)
+            sleep_us(20000);
+        if (mydecoder_shm_done(shm) < 0)
+            bad++;
+        last = view.pts;
+        frames++;
+    }
+    printf("reader: %d frames, %lld skipped, %d bad, ended with %d\n", frames,
+           mydecoder_shm_dropped(shm), bad, ret);
+    mydecoder_shm_close(shm);
+    fflush(stdout);
+    return (bad || ret != AVERROR_EOF || frames < FRAMES / 2) ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *name = argc > 1 ? argv[1] : "/mydecoder_shm_test";
+    MyShmConfig config = { 4, WIDTH * HEIGHT, 2, MYDECODER_SHM_PROTECT };
+    u8 *picture = (u8 *)malloc(WIDTH * HEIGHT);
+    MyFrameView view;
+    MyShm shm;
+    s32 fds[2], status, dropped = 0, i;
+    pid_t pid;
+    char c;
+
+    shm = mydecoder_shm_create(name, &config);
+    if (!shm || !picture || pipe(fds) < 0) {
+        printf("Could not create %s\n", name);
+        return 1;
+    }
+    pid = fork();
+    if (0 == pid)
+        _exit(reader(name, fds[1]));
+    if (read(fds[0], &c, 1) != 1) {
+        printf("Reader did not start\n");
+        return 1;
+    }
+
+    memset(&view, 0, sizeof(view));
+    view.data[0] = picture;
+    view.linesize[0] = WIDTH;
+    view.width = WIDTH;
+    view.height = HEIGHT;
+    view.format = MYDECODER_PIX_FMT_GRAY8;
+    view.av_format = AV_PIX_FMT_GRAY8;
+    for (i = 0; i < FRAMES; i++) {
+        memset(picture, i & 0xff, WIDTH * HEIGHT);
+        view.pts = i;
+        dropped += mydecoder_shm_write(shm, &view) == 1;
+        sleep_us(500);
+    }
+    printf("publisher: %d frames, %d dropped for the reader\n", FRAMES, dropped);
+    mydecoder_shm_destroy(shm);
+    free(picture);
+
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -36,11 +36,16 @@ int main(int argc, char *argv[])
     s32 total_frame_num = 1000;
     s32 got_frame = 0;
     s32 frame_count = 0;
-    u8 bgr_data[1920*1080*3];
+    s8 *codec_name = argc > 2 ? argv[2] : "h264";
+    u8 *bgr_data = NULL;
+    s32 bgr_size = 0, width, height, size;
 
     long long int start, end;
-    float diff = 0.0;
-    float fps = 0.0;
+
+    if (argc < 2) {
+        printf("Usage: %s video_file [decoder_name]\n", argv[0]);
+        exit(1);
+    }
 
     packet = mydecoder_packet_alloc();
     if (!packet) {
@@ -55,7 +60,10 @@ int main(int argc, char *argv[])
     }
  
     ctx = mydecoder_context_alloc();
-    mydecoder_open(&ctx, (const char *)argv[1], "h264_v4l2m2m", &total_frame_num);
+    if (mydecoder_open(ctx, (const char *)argv[1], codec_name, &total_frame_num) < 0) {
+        printf("Could not open %s with %s\n", argv[1], codec_name);
+        exit(1);
+    }
 
     /* cannot get total frame number from *.h264, set to 1000 for test */
     if (total_frame_num == 0)
@@ -70,13 +78,28 @@ int main(int argc, char *argv[])
         ret = mydecoder_get_packet(ctx, &packet, &packet_size);
         if (ret == AVERROR(EAGAIN)) 
             continue;
+        if (ret < 0)
+            break;
 
         if (packet_size) {
-            mydecoder_decode(packet, &frame, &got_frame);
+            mydecoder_decode(ctx, packet, frame, &got_frame);
         }
 
         while (got_frame) {
-            mydecoder_retrieve_frame(frame, bgr_data);
+            /* sized from the frame, which may change mid stream */
+            if (mydecoder_get_output_size(ctx, frame, &width, &height) < 0)
+                break;
+            size = mydecoder_output_buffer_size(MYDECODER_OUT_BGR24, width, height);
+            if (size > bgr_size) {
+                free(bgr_data);
+                bgr_data = (u8 *)malloc(size);
+                if (!bgr_data) {
+                    printf("Error allocating BGR buffer\n");
+                    exit(1);
+                }
+                bgr_size = size;
+            }
+            mydecoder_retrieve_frame(ctx, frame, bgr_data);
             got_frame--;
             frame_count++;
         }
@@ -84,12 +107,12 @@ int main(int argc, char *argv[])
 
     end = current_ms();
 
-    diff = (end - start) * 1.0 / (frame_count - 1);
-    fps = (frame_count - 1) / ((end - start) / 1000.0);
-    
-    printf("frame_number: %d    time: %3.2fms    fps: %3.2f\n", frame_count - 1, diff, fps);
+    /* see mydecoder_bench for timings */
+    printf("frame_number: %d    time: %lldms\n", frame_count, end - start);
 
-    mydecoder_close(frame, packet);
+    mydecoder_close(ctx, frame, packet);
+    free(bgr_data);
+    return 0;
     
 }
 